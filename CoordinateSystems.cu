@@ -1,28 +1,26 @@
 #include "itmlibdefines.h"
+#include <map>
+#include <mutex>
 
 __managed__ CoordinateSystem* globalcs = 0;
 
 
-/// (0,0,0) is the lower corner of the first voxel block, (1,1,1) its upper corner,
-/// corresponding to (voxelBlockSize, voxelBlockSize, voxelBlockSize) in world coordinates.
-__managed__ CoordinateSystem* voxelBlockCoordinates = 0;
-
-/// (0,0,0) is the lower corner of the voxel, (1,1,1) its upper corner,
-/// corresponding to (voxelSize, voxelSize, voxelSize) in world coordinates.
-/// aka "voxel-fractional-world-coordinates"
-__managed__ CoordinateSystem* voxelCoordinates = 0;
-
-void initCoordinateSystems() {
+void getVoxelCoordinateSystems(const float voxelSize_, CoordinateSystem*& voxelBlockCoordinates_, CoordinateSystem*& voxelCoordinates_) {
+    static std::mutex m;
+    std::lock_guard<std::mutex> lock(m);
     CoordinateSystem::global(); // make sure it exists
 
-    Matrix4f m;
+    // never deleted: coordinate systems are compared by pointer, and points in them may still be around
+    static std::map<float, std::pair<CoordinateSystem*, CoordinateSystem*>> systems;
+    auto s = systems.find(voxelSize_);
+    if (s == systems.end()) {
+        Matrix4f m;
+        m.setIdentity(); m.setScale(voxelSize_ * SDF_BLOCK_SIZE);
+        CoordinateSystem* const blockCoordinates = new CoordinateSystem(m);
 
-    if (voxelBlockCoordinates) {
-        assert(voxelCoordinates); return;
+        m.setIdentity(); m.setScale(voxelSize_);
+        s = systems.insert(std::make_pair(voxelSize_, std::make_pair(blockCoordinates, new CoordinateSystem(m)))).first;
     }
-    m.setIdentity(); m.setScale(voxelBlockSize);
-    voxelBlockCoordinates = new CoordinateSystem(m);
-
-    m.setIdentity(); m.setScale(voxelSize);
-    voxelCoordinates = new CoordinateSystem(m);
+    voxelBlockCoordinates_ = s->second.first;
+    voxelCoordinates_ = s->second.second;
 }
\ No newline at end of file
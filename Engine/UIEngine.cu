@@ -238,7 +238,7 @@ void UIEngine::glutMouseWheelFunction(int button, int dir, int x, int y)
 void UIEngine::Initialise(int & argc, char** argv, ImageFileReader *imageSource, ITMMainEngine *mainEngine ) 
 {
     this->freeviewActive = 1;
-    this->freeviewPose.SetT(Vector3f(0, 0,  100 * voxelSize)); // move back a bit to see something
+    this->freeviewPose.SetT(Vector3f(0, 0,  100 * mainEngine->scene->params.voxelSize_)); // move back a bit to see something
     //viewFrustum_max
 	this->imageSource = imageSource;
 	this->mainEngine = mainEngine;
@@ -43,45 +43,34 @@ struct TrackingLevel : public Managed {
         depthImage(0) {
     }
 };
-// ViewHierarchy, 0 is highest resolution
-static std::vector<TrackingLevel*> trackingLevels;
-struct ITMDepthTracker_
-{
-    ITMDepthTracker_() {
-        // Tweaking
-        // Tracking strategy:
-        const int noHierarchyLevels = 5;
-        const float distThreshStep = depthTrackerICPMaxThreshold / noHierarchyLevels;
-        // starting with highest resolution (lowest level, last to be executed)
+/// ViewHierarchy, 0 is highest resolution. Created per ImprovePose call, such that several can run at the same time.
+static std::vector<TrackingLevel*> createTrackingLevels() {
+    std::vector<TrackingLevel*> trackingLevels;
+    // Tweaking
+    // Tracking strategy:
+    const int noHierarchyLevels = 5;
+    const float distThreshStep = depthTrackerICPMaxThreshold / noHierarchyLevels;
+    // starting with highest resolution (lowest level, last to be executed)
 #define iterations
-        trackingLevels.push_back(new TrackingLevel(2  iterations, TRACKER_ITERATION_BOTH, depthTrackerICPMaxThreshold - distThreshStep * 4));
-        trackingLevels.push_back(new TrackingLevel(4  iterations, TRACKER_ITERATION_BOTH, depthTrackerICPMaxThreshold - distThreshStep * 3));
-        trackingLevels.push_back(new TrackingLevel(6  iterations, TRACKER_ITERATION_ROTATION, depthTrackerICPMaxThreshold - distThreshStep * 2));
-        trackingLevels.push_back(new TrackingLevel(8  iterations, TRACKER_ITERATION_ROTATION, depthTrackerICPMaxThreshold - distThreshStep));
-        trackingLevels.push_back(new TrackingLevel(10 iterations, TRACKER_ITERATION_ROTATION, depthTrackerICPMaxThreshold));
-        assert(trackingLevels.size() == noHierarchyLevels);
+    trackingLevels.push_back(new TrackingLevel(2  iterations, TRACKER_ITERATION_BOTH, depthTrackerICPMaxThreshold - distThreshStep * 4));
+    trackingLevels.push_back(new TrackingLevel(4  iterations, TRACKER_ITERATION_BOTH, depthTrackerICPMaxThreshold - distThreshStep * 3));
+    trackingLevels.push_back(new TrackingLevel(6  iterations, TRACKER_ITERATION_ROTATION, depthTrackerICPMaxThreshold - distThreshStep * 2));
+    trackingLevels.push_back(new TrackingLevel(8  iterations, TRACKER_ITERATION_ROTATION, depthTrackerICPMaxThreshold - distThreshStep));
+    trackingLevels.push_back(new TrackingLevel(10 iterations, TRACKER_ITERATION_ROTATION, depthTrackerICPMaxThreshold));
+    assert(trackingLevels.size() == noHierarchyLevels);
 #undef iterations
-    }
-} _;
-
-static __managed__ /*const*/ TrackingLevel* currentTrackingLevel;
-
-static TrackerIterationType iterationType() {
-    return currentTrackingLevel->iterationType;
+    return trackingLevels;
 }
-static bool shortIteration() {
-    return (iterationType() == TRACKER_ITERATION_ROTATION);
+
+static bool shortIteration(const TrackingLevel* const level) {
+    return (level->iterationType == TRACKER_ITERATION_ROTATION);
 }
 /// In world-coordinates squared
 //!< \f$\epsilon_d\f$
-GPU_ONLY static float distThresh() {
-    return currentTrackingLevel->distanceThreshold;
+GPU_ONLY static float distThresh(const TrackingLevel* const level) {
+    return level->distanceThreshold;
 }
 
-static __managed__ /*const*/ AccuCell accu;
-/// In world coordinates, points map, normals map, for frame k-1, \f$V_{k-1}\f$
-static __managed__ DEVICEPTR(RayImage) * lastFrameICPMap = 0;
-
 
 /**
 Computes
@@ -107,13 +96,15 @@ GPU_ONLY static inline bool computePerPointGH_Depth_Ab(
     THREADPTR(float) AT[6], //!< [out]
     THREADPTR(float) &b,//!< [out]
 
-    const CONSTPTR(int) & x, const CONSTPTR(int) & y
+    const CONSTPTR(int) & x, const CONSTPTR(int) & y,
+    const TrackingLevel* const level,
+    const RayImage* const lastFrameICPMap //!< In world coordinates, points map, normals map, for frame k-1, \f$V_{k-1}\f$
     )
 {
     // p_k := T_{g,k}V_k(u) = V_k^g(u)
-    Point V_ku = currentTrackingLevel->depthImage->getPointForPixel(Vector2i(x, y));
+    Point V_ku = level->depthImage->getPointForPixel(Vector2i(x, y));
     if (V_ku.location.z <= 1e-8f) return false;
-    assert(V_ku.coordinateSystem == currentTrackingLevel->depthImage->eyeCoordinates);
+    assert(V_ku.coordinateSystem == level->depthImage->eyeCoordinates);
     Point p_k = CoordinateSystem::global()->convert(V_ku);
 
     // hat_u = \pi(K T_{k-1,g} T_{g,k}V_k(u) )
@@ -140,7 +131,7 @@ GPU_ONLY static inline bool computePerPointGH_Depth_Ab(
     // [
     // Projective data assocation rejection test, "\Omega_k(u) != 0"
     // TODO check whether normal matches normal from image, done in the original paper, but does not seem to be required
-    if (length2(d.direction) > distThresh()) return false;
+    if (length2(d.direction) > distThresh(level)) return false;
     // ]
 
     // (2) Point-plane ICP computations
@@ -169,7 +160,11 @@ GPU_ONLY static inline bool computePerPointGH_Depth_Ab(
 }
 
 #define REDUCE_BLOCK_SIZE 256 // must be power of 2. Used for reduction of a sum.
-static KERNEL depthTrackerOneLevel_g_rt_device_main()
+static KERNEL depthTrackerOneLevel_g_rt_device_main(
+    const TrackingLevel* const level,
+    const RayImage* const lastFrameICPMap,
+    AccuCell* const accu //!< [out] sums into
+    )
 {
     int x = threadIdx.x + blockIdx.x * blockDim.x, y = threadIdx.y + blockIdx.y * blockDim.y;
 
@@ -184,12 +179,12 @@ static KERNEL depthTrackerOneLevel_g_rt_device_main()
     float b;
     bool isValidPoint = false;
 
-    auto viewImageSize = currentTrackingLevel->depthImage->imgSize();
+    auto viewImageSize = level->depthImage->imgSize();
     if (x < viewImageSize.width && y < viewImageSize.height
         )
     {
         isValidPoint = computePerPointGH_Depth_Ab(
-            A, b, x, y);
+            A, b, x, y, level, lastFrameICPMap);
         if (isValidPoint) should_prefix = true;
     }
 
@@ -209,17 +204,17 @@ static KERNEL depthTrackerOneLevel_g_rt_device_main()
             isValidPoint,
             dim_shared1,
             locId_local,
-            &(accu.noValidPoints));
+            &(accu->noValidPoints));
     }
 #define reduce(what, into) warpReduce256<float>((what),dim_shared1,locId_local,&(into));
     { //reduction for energy function value
-        reduce(b*b, accu.f);
+        reduce(b*b, accu->f);
     }
 
     //reduction for nabla
     for (unsigned char paraId = 0; paraId < 6; paraId++)
     {
-        reduce(b*A[paraId], accu.ATb[paraId]);
+        reduce(b*A[paraId], accu->ATb[paraId]);
     }
 
     float AT_A[6][6];
@@ -230,28 +225,38 @@ static KERNEL depthTrackerOneLevel_g_rt_device_main()
             AT_A[r][c] = A[r] * A[c];
 
             //reduction for hessian
-            reduce(AT_A[r][c], accu.AT_A[r][c]);
+            reduce(AT_A[r][c], accu->AT_A[r][c]);
         }
     }
 }
 
 // host methods
 
-AccuCell ComputeGandH(Matrix4f T_g_k_estimate) {
+/// Everything one ImprovePose call works on
+struct Tracking {
+    const ITMView* view;
+    /// In world coordinates, points map, normals map, for frame k-1, \f$V_{k-1}\f$
+    RayImage* lastFrameICPMap;
+    TrackingLevel* level;
+    /// managed
+    AccuCell* accu;
+};
+
+AccuCell ComputeGandH(const Tracking& t, Matrix4f T_g_k_estimate) {
     cudaDeviceSynchronize(); // prepare writing to __managed__
 
-    assert(lastFrameICPMap->pointCoordinates == CoordinateSystem::global());
-    assert(!(lastFrameICPMap->eyeCoordinates == CoordinateSystem::global()));
-    assert(lastFrameICPMap->eyeCoordinates == currentView->depthImage->eyeCoordinates);
+    assert(t.lastFrameICPMap->pointCoordinates == CoordinateSystem::global());
+    assert(!(t.lastFrameICPMap->eyeCoordinates == CoordinateSystem::global()));
+    assert(t.lastFrameICPMap->eyeCoordinates == t.view->depthImage->eyeCoordinates);
 
     //::depth = currentTrackingLevel->depth->GetData(MEMORYDEVICE_CUDA);
     //::viewIntrinsics = currentTrackingLevel->intrinsics;
-    auto viewImageSize = currentTrackingLevel->depthImage->imgSize();
+    auto viewImageSize = t.level->depthImage->imgSize();
 
     //::T_g_k = T_g_k_estimate;
     std::auto_ptr<CoordinateSystem> depthCoordinateSystemEstimate(new CoordinateSystem(T_g_k_estimate)); // TODO should this be deleted when going out of scope?
     // do we really need to recreate it every time? Should it be the same instance ('new depth eye coordinate system') for all resolutions?
-    currentTrackingLevel->depthImage->eyeCoordinates = depthCoordinateSystemEstimate.get();
+    t.level->depthImage->eyeCoordinates = depthCoordinateSystemEstimate.get();
 
     dim3 blockSize(16, 16); // must equal REDUCE_BLOCK_SIZE
     assert(16 * 16 == REDUCE_BLOCK_SIZE);
@@ -260,13 +265,13 @@ AccuCell ComputeGandH(Matrix4f T_g_k_estimate) {
         (int)ceil((float)viewImageSize.x / (float)blockSize.x),
         (int)ceil((float)viewImageSize.y / (float)blockSize.y));
 
-    assert(!(currentTrackingLevel->depthImage->eyeCoordinates == CoordinateSystem::global()));
+    assert(!(t.level->depthImage->eyeCoordinates == CoordinateSystem::global()));
 
-    ::accu.reset();
-    LAUNCH_KERNEL(depthTrackerOneLevel_g_rt_device_main, gridSize, blockSize);
+    t.accu->reset();
+    LAUNCH_KERNEL(depthTrackerOneLevel_g_rt_device_main, gridSize, blockSize, t.level, t.lastFrameICPMap, t.accu);
 
     cudaDeviceSynchronize(); // for later access of accu
-    return accu;
+    return *t.accu;
 }
 
 /// evaluate error function at the supplied T_g_k_estimate, 
@@ -274,11 +279,12 @@ AccuCell ComputeGandH(Matrix4f T_g_k_estimate) {
 /// next update step (note: this system is not yet solved and we don't know the new energy yet!)
 /// \returns noValidPoints
 int ComputeGandH(
+    const Tracking& t,
     float &f,
     float sum_ATb[6],
     float sum_AT_A[6][6],
     Matrix4f T_g_k_estimate) {
-    AccuCell accu = ComputeGandH(T_g_k_estimate);
+    AccuCell accu = ComputeGandH(t, T_g_k_estimate);
 
     memcpy(sum_ATb, accu.ATb, sizeof(float) * 6);
     assert(sum_ATb[4] == accu.ATb[4]);
@@ -296,12 +302,12 @@ int ComputeGandH(
 /// \param hessian 6x6
 /// \param delta 3 or 6
 /// \param nabla 3 or 6
-/// \param shortIteration whether there are only 3 parameters
-void ComputeDelta(float step[6], float nabla[6], float hessian[6][6])
+/// \param level shortIteration(level): whether there are only 3 parameters
+void ComputeDelta(const TrackingLevel* const level, float step[6], float nabla[6], float hessian[6][6])
 {
     for (int i = 0; i < 6; i++) step[i] = 0;
 
-    if (shortIteration())
+    if (shortIteration(level))
     {
         // Keep only upper 3x3 part of hessian
         float smallHessian[3][3];
@@ -333,7 +339,7 @@ bool HasConverged(float *step)
     return false;
 }
 
-Matrix4f ComputeTinc(const float delta[6])
+Matrix4f ComputeTinc(const TrackingLevel* const level, const float delta[6])
 {
     // step is T_inc, expressed as a parameter vector 
     // (beta, gamma, alpha, tx,ty, tz)
@@ -341,7 +347,7 @@ Matrix4f ComputeTinc(const float delta[6])
     float step[6];
 
     // Depending on the iteration type, fill in 0 for values that where not computed.
-    switch (currentTrackingLevel->iterationType)
+    switch (level->iterationType)
     {
     case TRACKER_ITERATION_ROTATION:
         step[0] = (float)(delta[0]); step[1] = (float)(delta[1]); step[2] = (float)(delta[2]);
@@ -373,21 +379,25 @@ c.f. newcombe_etal_ismar2011.pdf section "Sensor Pose Estimation"
 6-d parameter vector "x" is (beta, gamma, alpha, tx, ty, tz)
 */
 /// \file c.f. newcombe_etal_ismar2011.pdf, Sensor Pose Estimation section
-void ImprovePose() {
-    assert(currentView);
-    assert(!lastFrameICPMap);
-    lastFrameICPMap = CreateICPMapsForCurrentView();
+void ImprovePose(const ITMContext& context) {
+    ITMView* const view = context.view;
+    assert(view);
+    Tracking t;
+    t.view = view;
+    t.lastFrameICPMap = CreateICPMaps(context);
+    t.accu = new AccuCell;
+    const std::vector<TrackingLevel*> trackingLevels = createTrackingLevels();
 
     /// Initialize one tracking event base data. Init hierarchy level 0 (finest).
     cudaDeviceSynchronize(); // prepare writing to __managed__
 
     /// Init image hierarchy levels
-    assert(currentView->depthImage->imgSize().area() > 1);
-    trackingLevels[0]->depthImage = //currentView->depthImage;
+    assert(view->depthImage->imgSize().area() > 1);
+    trackingLevels[0]->depthImage = //view->depthImage;
         new DepthImage(
-        currentView->depthImage->image,
-        new CoordinateSystem(*currentView->depthImage->eyeCoordinates),
-        currentView->depthImage->cameraIntrinsics
+        view->depthImage->image,
+        new CoordinateSystem(*view->depthImage->eyeCoordinates),
+        view->depthImage->cameraIntrinsics
         );
 
     for (int i = 1; i < trackingLevels.size(); i++)
@@ -406,20 +416,21 @@ void ImprovePose() {
             );
 
         assert(currentLevel->depthImage->imgSize() == previousLevel->depthImage->imgSize() / 2);
-        assert(currentLevel->depthImage->imgSize().area() < currentView->depthImage->imgSize().area());
+        assert(currentLevel->depthImage->imgSize().area() < view->depthImage->imgSize().area());
     }
 
     ITMPose T_k_g_estimate;
-    T_k_g_estimate.SetM(currentView->depthImage->eyeCoordinates->fromGlobal);
+    T_k_g_estimate.SetM(view->depthImage->eyeCoordinates->fromGlobal);
     {
         Matrix4f M_d = T_k_g_estimate.GetM();
-        assert(M_d == currentView->depthImage->eyeCoordinates->fromGlobal);
+        assert(M_d == view->depthImage->eyeCoordinates->fromGlobal);
     }
     // Coarse to fine
     for (int levelId = trackingLevels.size() - 1; levelId >= 0; levelId--)
     {
-        currentTrackingLevel = trackingLevels[levelId];
-        if (iterationType() == TRACKER_ITERATION_NONE) continue;
+        TrackingLevel* const currentTrackingLevel = trackingLevels[levelId];
+        t.level = currentTrackingLevel;
+        if (currentTrackingLevel->iterationType == TRACKER_ITERATION_NONE) continue;
 
         // T_{k,g} transforms global (g) coordinates to eye or view coordinates of the k-th frame
         // T_g_k_estimate caches T_k_g_estimate->GetInvM()
@@ -482,7 +493,7 @@ T_g_k_estimate = T_k_g_estimate.GetInvM();
             int noValidPoints;
             float new_sum_ATb[6];
             float new_sum_AT_A[6][6];
-            noValidPoints = ComputeGandH(f_new, new_sum_ATb, new_sum_AT_A, T_g_k_estimate);
+            noValidPoints = ComputeGandH(t, f_new, new_sum_ATb, new_sum_AT_A, T_g_k_estimate);
             // ]]
 
             float least_energy_sum_AT_A[6][6],
@@ -521,14 +532,14 @@ T_g_k_estimate = T_k_g_estimate.GetInvM();
 
             // compute the update step parameter vector x
             float x[6];
-            ComputeDelta(x,
+            ComputeDelta(currentTrackingLevel, x,
                 least_energy_sum_ATb,
                 damped_least_energy_sum_AT_A);
 
             // Apply the corresponding Tinc
             set_T_k_g_estimate_from_T_g_k_estimate(
                 /* T_g_k_estimate = */
-                ComputeTinc(x) * T_g_k_estimate
+                ComputeTinc(currentTrackingLevel, x) * T_g_k_estimate
                 );
 
             // if step is small, assume it's going to decrease the error and finish
@@ -536,8 +547,12 @@ T_g_k_estimate = T_k_g_estimate.GetInvM();
         }
     }
 
-    delete lastFrameICPMap;
-    lastFrameICPMap = 0;
+    cudaDeviceSynchronize();
+    delete t.lastFrameICPMap->image;
+    delete t.lastFrameICPMap->normalImage;
+    delete t.lastFrameICPMap;
+    delete t.accu;
+    for (auto level : trackingLevels) delete level;
 
     // Apply new guess
     Matrix4f M_d = T_k_g_estimate.GetM();
@@ -546,8 +561,8 @@ T_g_k_estimate = T_k_g_estimate.GetInvM();
     assert(M_d != id);
 
     cudaDeviceSynchronize(); // necessary here?
-    assert(currentView->depthImage->eyeCoordinates);
-    assert(M_d != currentView->depthImage->eyeCoordinates->fromGlobal);
-    currentView->ChangePose(M_d);
+    assert(view->depthImage->eyeCoordinates);
+    assert(M_d != view->depthImage->eyeCoordinates->fromGlobal);
+    view->ChangePose(M_d);
 }
 // 540        
\ No newline at end of file
@@ -4,6 +4,7 @@
 #include "itmcudautils.h"
 #include "ITMLowLevelEngine.h"
 #include "ITMView.h"
+#include "ITMContext.h"
 
 /** Performing ICP based depth tracking. 
 Implements the original KinectFusion tracking algorithm.
@@ -12,4 +13,5 @@ c.f. newcombe_etal_ismar2011.pdf section "Sensor Pose Estimation"
 
 6-d parameter vector "x" is (beta, gamma, alpha, tx, ty, tz)
 */
-void ImprovePose();
+/// Updates the pose of context.view, tracking it against a raycast of context.scene
+void ImprovePose(const ITMContext& context);
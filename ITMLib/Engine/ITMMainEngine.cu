@@ -1,24 +1,25 @@
 #include "ITMMainEngine.h"
 
 
-__managed__ int counter = 0;
-static KERNEL buildBlockRequests(Vector3i offset) {
-    Scene::requestCurrentSceneVoxelBlockAllocation(
+static KERNEL buildBlockRequests(Scene* const scene, Vector3i offset) {
+    scene->requestVoxelBlockAllocation(
         VoxelBlockPos(
         offset.x + blockIdx.x,
         offset.y + blockIdx.y,
         offset.z + blockIdx.z));
 }
-static __managed__ float radiusInWorldCoordinates;
-static KERNEL buildSphereRequests() {
-    Scene::requestCurrentSceneVoxelBlockAllocation(
+static KERNEL buildSphereRequests(Scene* const scene) {
+    scene->requestVoxelBlockAllocation(
         VoxelBlockPos(blockIdx.x,
         blockIdx.y,
         blockIdx.z));
 }
 
 struct BuildSphere {
-    doForEachAllocatedVoxel_process() {
+    float radiusInWorldCoordinates;
+    ITMSceneParams params;
+
+    doForEachAllocatedVoxel_process_member() {
         assert(v);
         assert(radiusInWorldCoordinates > 0);
 
@@ -32,8 +33,9 @@ struct BuildSphere {
 
         // Truncate and convert to -1..1 for band of size mu
         const float eta = dist;
-        v->setSDF(MAX(MIN(1.0f, eta / mu), -1.f));
+        v->setSDF(MAX(MIN(1.0f, eta / params.mu_), -1.f));
 
+#if VOXEL_HAS_COLOR
         // set color as if there where a white directional light at positive x 
         Vector3f n = normalize(voxelGlobalPos); // normal is normalized worldspace position for a sphere
         float cos = n.x > 0 ? n.x : 0;
@@ -41,22 +43,24 @@ struct BuildSphere {
 
 
         v->w_color = 1;
+#endif
         v->w_depth = 1;
     }
 };
 
-static KERNEL countAllocatedBlocks(Vector3i offset) {
-    if (Scene::getCurrentSceneVoxel(
+static KERNEL countAllocatedBlocks(Scene* const scene, Vector3i offset, int* const counter) {
+    if (scene->getVoxel(
         VoxelBlockPos(
         offset.x + blockIdx.x,
         offset.y + blockIdx.y,
         offset.z + blockIdx.z).toInt() * SDF_BLOCK_SIZE
         ))
-        atomicAdd(&counter, 1);
+        atomicAdd(counter, 1);
 }
-void buildSphereScene(const float radiusInWorldCoordinates) {
+void buildSphereScene(Scene* const scene, const float radiusInWorldCoordinates) {
+    assert(scene);
     assert(radiusInWorldCoordinates > 0);
-    ::radiusInWorldCoordinates = radiusInWorldCoordinates;
+    const float voxelBlockSize = scene->params.voxelBlockSize();
     const float diameterInWorldCoordinates = radiusInWorldCoordinates * 2;
     int offseti = -ceil(radiusInWorldCoordinates / voxelBlockSize) - 1; // -1 for extra space
     assert(offseti < 0);
@@ -67,18 +71,23 @@ void buildSphereScene(const float radiusInWorldCoordinates) {
     dim3 count(counti, counti, counti);
     assert(offseti + count.x == -offseti);
 
-    // repeat allocation a few times to avoid holes
-    do {
-        buildBlockRequests << <count, 1 >> >(offset);
-        cudaDeviceSynchronize();
-        Scene::performCurrentSceneAllocations();
-        cudaDeviceSynchronize();
-        counter = 0;
-        countAllocatedBlocks << <count, 1 >> >(offset);
-        cudaDeviceSynchronize();
-    } while (counter != counti*counti*counti);
-
-    Scene::getCurrentScene()->doForEachAllocatedVoxel<BuildSphere>();
+    buildBlockRequests << <count, 1 >> >(scene, offset);
+    cudaDeviceSynchronize();
+    scene->performAllocationsCompletely();
+    cudaDeviceSynchronize();
+
+    // no holes
+    int* counter;
+    cudaSafeCall(cudaMallocManaged(&counter, sizeof(int)));
+    cudaSafeCall(cudaDeviceSynchronize());
+    *counter = 0;
+    countAllocatedBlocks << <count, 1 >> >(scene, offset, counter);
+    cudaDeviceSynchronize();
+    assert(*counter == counti*counti*counti);
+    cudaFree(counter);
+
+    const BuildSphere buildSphere = {radiusInWorldCoordinates, scene->params};
+    scene->doForEachAllocatedVoxel(buildSphere);
 }
 
 // assumes buildWallRequests has been executed
@@ -88,31 +97,36 @@ void buildSphereScene(const float radiusInWorldCoordinates) {
 // z == (SDF_BLOCK_SIZE / 2)*voxelSize
 // and negative at bigger z.
 struct BuildWall {
-    doForEachAllocatedVoxel_process() {
+    ITMSceneParams params;
+
+    doForEachAllocatedVoxel_process_member() {
         assert(v);
 
-        float z = (threadIdx.z) * voxelSize;
-        float eta = (SDF_BLOCK_SIZE / 2)*voxelSize - z;
-        v->setSDF(MAX(MIN(1.0f, eta / mu), -1.f));
+        float z = (threadIdx.z) * params.voxelSize_;
+        float eta = (SDF_BLOCK_SIZE / 2)*params.voxelSize_ - z;
+        v->setSDF(MAX(MIN(1.0f, eta / params.mu_), -1.f));
     }
 };
-void buildWallScene() {
+void buildWallScene(Scene* const scene) {
+    assert(scene);
     // Build wall scene
-    buildBlockRequests << <dim3(10, 10, 1), 1 >> >(Vector3i(0, 0, 0));
+    buildBlockRequests << <dim3(10, 10, 1), 1 >> >(scene, Vector3i(0, 0, 0));
     cudaDeviceSynchronize();
-    Scene::performCurrentSceneAllocations();
+    scene->performAllocations();
     cudaDeviceSynchronize();
-    Scene::getCurrentScene()->doForEachAllocatedVoxel<BuildWall>();
+    const BuildWall buildWall = {scene->params};
+    scene->doForEachAllocatedVoxel(buildWall);
 }
 
-//void buildSphereScene(const float radiusInWorldCoordinates);
-ITMMainEngine::ITMMainEngine(const ITMRGBDCalib *calib)
+//void buildSphereScene(Scene* scene, const float radiusInWorldCoordinates);
+ITMMainEngine::ITMMainEngine(const ITMRGBDCalib *calib, const ITMSceneParams& sceneParams)
 {
-    scene = new Scene();
-    CURRENT_SCENE_SCOPE(scene);
+    scene = Scene::createMultiResolution(sceneParams, multiResolutionLevels, multiResolutionFirstLevelMaxDepth);
+    frameCount = 0;
+    lastFuseStatistics = FuseStatistics();
     
-    //buildSphereScene(2 * voxelBlockSize);
-    //buildWallScene();
+    //buildSphereScene(scene, 2 * scene->params.voxelBlockSize());
+    //buildWallScene(scene);
 
     view = new ITMView(calib); // will be allocated by the view builder
 }
@@ -125,11 +139,9 @@ ITMMainEngine::~ITMMainEngine()
 }
 
 // HACK:
-int frameCount = 0;
-Matrix4f cameraMatrices[1000];
 bool computeLighting;
-void estimateLightingModel_();
-void computeArtificialLighting_();
+void estimateLightingModel_(Scene* scene);
+void computeArtificialLighting_(Scene* scene);
 
 void ITMMainEngine::ProcessFrame(ITMUChar4Image *rgbImage, ITMShortImage *rawDepthImage)
 {
@@ -137,25 +149,43 @@ void ITMMainEngine::ProcessFrame(ITMUChar4Image *rgbImage, ITMShortImage *rawDep
     assert(rgbImage->noDims.area() > 1);
     assert(rawDepthImage->noDims.area() > 1);
 
-    CURRENT_SCENE_SCOPE(scene);
-    currentView = view;
+    const ITMContext context(scene, view);
 
-    currentView->ChangeImages(rgbImage, rawDepthImage);
+    view->ChangeImages(rgbImage, rawDepthImage);
     cudaDeviceSynchronize();
     
-    Matrix4f old_M_d = currentView->depthImage->eyeCoordinates->fromGlobal;
-    assert(old_M_d == currentView->depthImage->eyeCoordinates->fromGlobal);
-    ImprovePose();
-    assert(old_M_d != currentView->depthImage->eyeCoordinates->fromGlobal);
+    Matrix4f old_M_d = view->depthImage->eyeCoordinates->fromGlobal;
+    assert(old_M_d == view->depthImage->eyeCoordinates->fromGlobal);
+    ImprovePose(context);
+    assert(old_M_d != view->depthImage->eyeCoordinates->fromGlobal);
 
-    Fuse();
+    if (fuseOnCPU) FuseOnCPU(context);
+    else lastFuseStatistics = Fuse(context);
+
+    if (rollingWindowRadius > 0) {
+        const Vector3f camera(view->depthImage->eyeCoordinates->toGlobal * Vector4f(0, 0, 0, 1));
+        scene->crop(camera - Vector3f(rollingWindowRadius), camera + Vector3f(rollingWindowRadius));
+    }
+
+    for (Scene* level = scene; level; level = level->coarser) {
+        if (voxelBlockRelayoutInterval > 0 && frameCount % voxelBlockRelayoutInterval == voxelBlockRelayoutInterval - 1)
+            level->relayoutVoxelBlocks();
+
+        if (uniformVoxelBlockCompressionFrames > 0)
+            level->compressUniformVoxelBlocks(uniformVoxelBlockCompressionFrames);
+
+        if (voxelBlockSwapOutFrames > 0)
+            level->swapOutUnseenVoxelBlocks(voxelBlockSwapOutFrames);
+        level->nextFrame();
+    }
 
-    // record camera toGlobal matrix
-    cameraMatrices[frameCount++] = view->depthImage->eyeCoordinates->toGlobal;
+    frameCount++;
+#if VOXEL_HAS_COLOR
     if (computeLighting) {
-        computeArtificialLighting_();
-            estimateLightingModel_();
+        computeArtificialLighting_(scene);
+            estimateLightingModel_(scene);
     }
+#endif
 }
 #include "fileutils.h"
 #include <memory>
@@ -224,8 +254,7 @@ void ITMMainEngine::GetImage(
 {
     assert(out->noDims.area() > 1);
     assert(outDepth->noDims == out->noDims);
-    CURRENT_SCENE_SCOPE(scene);
-	auto ci = RenderImage(pose, intrinsics, out->noDims, outDepth, shader); // <- good place to stop freeze if a current scene should be set
+	auto ci = RenderImage(ITMContext(scene, view), pose, intrinsics, out->noDims, outDepth, shader);
     
     assert(outDepth->GetData()[0] >= 0);
 
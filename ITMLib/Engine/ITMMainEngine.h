@@ -40,14 +40,21 @@
 
 	To access the internal information, look at the member
 	variables @ref trackingState and @ref scene.
+
+	Each instance has its own scene and view, so several instances can process
+	independent sequences at the same time from different threads (see ITMContext).
 */
 class ITMMainEngine
 {
 private:
 	ITMView *view;
+    /// Frames processed so far
+    int frameCount;
 
 public:
     Scene* scene;
+    /// Of the latest ProcessFrame, e.g. the time of its allocation pass. All zero when fusing on the cpu (fuseOnCPU).
+    FuseStatistics lastFuseStatistics;
 	/// Gives access to the current input frame
 	ITMView* GetView() { return view; }
 
@@ -65,7 +72,8 @@ public:
         );
 
 	explicit ITMMainEngine(
-        const ITMRGBDCalib *calib
+        const ITMRGBDCalib *calib,
+        const ITMSceneParams& sceneParams = ITMSceneParams::defaults() //!< voxel size etc. of the scene that is built
         );
 	~ITMMainEngine();
 };
@@ -6,34 +6,40 @@
 #include "ITMLibDefines.h"
 #include "itmcudautils.h"
 
-#define weightedCombine(oldX, oldW, newX, newW) \
+#define weightedCombine(oldX, oldW, newX, newW, maxW_) \
     newX = (float)oldW * oldX + (float)newW * newX; \
     newW = oldW + newW;\
     newX /= (float)newW;\
-    newW = MIN(newW, maxW);
+    newW = MIN(newW, maxW_);
 
 /// Linearized pixel index
 CPU_AND_GPU inline int pixelLocId(const int x, const int y, const THREADPTR(Vector2i) &imgSize) {
     return x + y * imgSize.x;
 }
 
+#if VOXEL_HAS_COLOR
 CPU_AND_GPU inline void updateVoxelColorInformation(
-    DEVICEPTR(ITMVoxel) & voxel,
-    const Vector3f oldC, const int oldW, Vector3f newC, int newW)
+    ITMVoxelRef voxel,
+    const Vector3f oldC, const int oldW, Vector3f newC, int newW,
+    const int maxW_ //!< of the scene, see ITMSceneParams
+    )
 {
-    weightedCombine(oldC, oldW, newC, newW);
+    weightedCombine(oldC, oldW, newC, newW, maxW_);
 
     // write back
     /// C(X) <-  
     voxel.clr = TO_UCHAR3(newC);
     voxel.w_color = (uchar)newW;
 }
+#endif
 
 CPU_AND_GPU inline void updateVoxelDepthInformation(
-    DEVICEPTR(ITMVoxel) & voxel,
-    const float oldF, const int oldW, float newF, int newW)
+    ITMVoxelRef voxel,
+    const float oldF, const int oldW, float newF, int newW,
+    const int maxW_ //!< of the scene, see ITMSceneParams
+    )
 {
-    weightedCombine(oldF, oldW, newF, newW);
+    weightedCombine(oldF, oldW, newF, newW, maxW_);
 
     // write back
     /// D(X) <-  (4)
@@ -74,7 +80,7 @@ static void forEachPixel(T* image, Vector2i imgSize) {
 
 // === forEachPixelNoImage ===
 template<typename F>
-static KERNEL forEachPixelNoImage_device(Vector2i imgSize) {
+static KERNEL forEachPixelNoImage_device(Vector2i imgSize, const F f) {
     const int
         x = threadIdx.x + blockIdx.x * blockDim.x,
         y = threadIdx.y + blockIdx.y * blockDim.y;
@@ -82,24 +88,27 @@ static KERNEL forEachPixelNoImage_device(Vector2i imgSize) {
     if (x > imgSize.x - 1 || y > imgSize.y - 1) return;
     const int locId = pixelLocId(x, y, imgSize);
 
-    F::process(x, y, locId);
+    f.process(x, y, locId);
 }
 
 #define forEachPixelNoImage_process() GPU_ONLY static void process(const int x, const int y, const int locId)
+// the same for F that carry their arguments (the scene, images etc.) instead of reading globals
+#define forEachPixelNoImage_process_member() GPU_ONLY void process(const int x, const int y, const int locId) const
 /** apply
-F::process(int x, int y, int locId)
+f.process(int x, int y, int locId)
 to each (hypothetical) pixel in the image 
 
 locId runs through values generated by pixelLocId(x, y, imgSize);
+f is copied to the device, so it must be plain old data (pointers to managed or device memory are fine).
 */
 template<typename F>
-static void forEachPixelNoImage(Vector2i imgSize) {
+static void forEachPixelNoImage(Vector2i imgSize, const F& f = F()) {
     const dim3 blockSize(16, 16);
     //LAUNCH_KERNEL(
     forEachPixelNoImage_device<F> << <
         getGridSize(dim3(xy(imgSize)), blockSize),
         blockSize >> >
-        (imgSize);
+        (imgSize, f);
     //);
 }
 //
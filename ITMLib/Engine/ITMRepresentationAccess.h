@@ -1,5 +1,6 @@
 /// \file Implements sparse voxel data structure
-/// All of these access the current scene
+/// All of these access the scene passed (or that of the VoxelBlockCache passed), and its coarser levels
+/// where it is a multi-resolution scene (Scene::createMultiResolution)
 
 #pragma once
 
@@ -7,13 +8,113 @@
 #include "ITMPixelUtils.h"
 #include "Scene.h"
 
+/// Entries of VoxelBlockCache, 2^n. 0 disables caching (every access goes to the hash map), for comparison.
+#ifndef VOXEL_BLOCK_CACHE_SIZE
+#define VOXEL_BLOCK_CACHE_SIZE 8
+#endif
+
+/// When 1, every VoxelBlockCache adds its hits and misses to voxelBlockCacheHits/Misses when it goes out of scope
+#ifndef VOXEL_BLOCK_CACHE_STATISTICS
+#define VOXEL_BLOCK_CACHE_STATISTICS 0
+#endif
+
+/// Totals of all VoxelBlockCaches, see VOXEL_BLOCK_CACHE_STATISTICS. Reset them from the host.
+extern __managed__ unsigned long long voxelBlockCacheHits, voxelBlockCacheMisses;
+
+/**
+Per-thread cache of the voxel blocks of a scene that were looked up last,
+to be kept in a local variable while a thread reads many voxels that mostly lie in the same few blocks.
+
+Direct mapped: the block at pos goes to entry (pos.x & 1) | (pos.y & 1) << 1 | (pos.z & 1) << 2 (modulo the size),
+so with 8 entries the (at most) 2x2x2 blocks touched by one interpolation or gradient never evict each other.
+Blocks that are not allocated are cached too (as NULL).
+
+Must not be used across allocations or removals.
+*/
+class VoxelBlockCache {
+public:
+    static const int SIZE = VOXEL_BLOCK_CACHE_SIZE;
+
+    GPU_ONLY VoxelBlockCache(Scene* const scene) : scene(scene), hits(0), misses(0) {
+        for (int i = 0; i < STORED; i++) positions[i] = INVALID_VOXEL_BLOCK_POS;
+    }
+
+    GPU_ONLY ~VoxelBlockCache() {
+#if VOXEL_BLOCK_CACHE_STATISTICS
+        atomicAdd(&voxelBlockCacheHits, (unsigned long long)hits);
+        atomicAdd(&voxelBlockCacheMisses, (unsigned long long)misses);
+#endif
+    }
+
+    /// Caches a block that is already known, e.g. the one the current thread works on
+    GPU_ONLY void insert(ITMVoxelBlock* const block) {
+        if (SIZE == 0) return;
+        const int i = entry(block->pos);
+        positions[i] = block->pos;
+        blocks[i] = block;
+    }
+
+    /// \returns NULL if the voxel block is not allocated
+    GPU_ONLY ITMVoxelBlock* getVoxelBlock(const VoxelBlockPos& pos) {
+        if (SIZE == 0) return scene->getVoxelBlock(pos);
+        const int i = entry(pos);
+        if (positions[i] == pos) {
+            hits++;
+            return blocks[i];
+        }
+        misses++;
+        positions[i] = pos;
+        return blocks[i] = scene->getVoxelBlock(pos);
+    }
+
+    /// Like Scene::getVoxel: \returns NULL when the voxel was not found
+    GPU_ONLY ITMVoxelPtr getVoxel(const Vector3i& point) {
+        const VoxelBlockPos blockPos = Scene::pointToVoxelBlockPos(point);
+        ITMVoxelBlock* const b = getVoxelBlock(blockPos);
+        if (b == NULL) return NULL;
+        return b->getVoxel(point - blockPos.toInt() * SDF_BLOCK_SIZE);
+    }
+
+    GPU_ONLY Scene* getScene() const { return scene; }
+
+    /// Lookups answered from the cache and ones that went to the hash map, by this object
+    GPU_ONLY uint getHits() const { return hits; }
+    GPU_ONLY uint getMisses() const { return misses; }
+
+private:
+    static const int STORED = SIZE > 0 ? SIZE : 1;
+
+    GPU_ONLY static int entry(const VoxelBlockPos& pos) {
+        return ((pos.x & 1) | (pos.y & 1) << 1 | (pos.z & 1) << 2) & (SIZE - 1);
+    }
+
+    Scene* const scene;
+    VoxelBlockPos positions[STORED];
+    ITMVoxelBlock* blocks[STORED];
+    uint hits, misses;
+};
 
 /// === ITMBlockhash methods (readVoxel) ===
 GPU_ONLY inline ITMVoxel readVoxel(
 	const THREADPTR(Vector3i) & point,
-    THREADPTR(bool) &isFound)
+    THREADPTR(bool) &isFound,
+    VoxelBlockCache& cache)
+{
+    ITMVoxelPtr v = cache.getVoxel(point);
+    if (!v) {
+        isFound = false;
+        return ITMVoxel();
+    }
+    isFound = true;
+    return *v;
+}
+
+GPU_ONLY inline ITMVoxel readVoxel(
+	const THREADPTR(Vector3i) & point,
+    THREADPTR(bool) &isFound,
+    Scene* const scene)
 {
-    ITMVoxel* v = Scene::getCurrentSceneVoxel(point);
+    ITMVoxelPtr v = scene->getVoxel(point);
     if (!v) {
         isFound = false;
         return ITMVoxel();
@@ -23,53 +124,144 @@ GPU_ONLY inline ITMVoxel readVoxel(
 }
 
 
+/// Like readVoxel(...).getSDF(), but reads only the SDF of the voxel (see VOXEL_BLOCK_SOA).
+/// 1 when the voxel was not found.
+GPU_ONLY inline float readSDF(
+	const THREADPTR(Vector3i) & point,
+    THREADPTR(bool) &isFound,
+    VoxelBlockCache& cache)
+{
+    ITMVoxelPtr v = cache.getVoxel(point);
+    isFound = (bool)v;
+    return v ? v->getSDF() : 1.f;
+}
+
+
+/// Like readSDF, but clears allFound when the voxel was not found
+GPU_ONLY inline float readSDFAll(
+    const THREADPTR(Vector3i) & point,
+    THREADPTR(bool) &allFound,
+    VoxelBlockCache& cache)
+{
+    bool isFound;
+    const float sdf = readSDF(point, isFound, cache);
+    allFound = allFound && isFound;
+    return sdf;
+}
+
+/// Converts point from the voxel coordinates of level to those of level->coarser, and returns that
+GPU_ONLY inline Scene* toCoarserLevel(Scene* const level, THREADPTR(Vector3f) & point) {
+    assert(level->coarser);
+    point *= level->params.voxelSize_ / level->coarser->params.voxelSize_;
+    return level->coarser;
+}
+
+/// Converts a normalized SDF value of level to the truncation band (mu) of scene, clamped to [-1, 1]
+GPU_ONLY inline float toTruncationBandOf(const Scene* const scene, const Scene* const level, const float sdf) {
+    return CLAMP(sdf * level->params.mu_ / scene->params.mu_, -1.f, 1.f);
+}
+
 /// === Generic methods (readSDF) ===
+// In a multi-resolution scene, these go to the next coarser level where voxels are missing,
+// with the point in its voxel coordinates and the result converted back.
+// The variants without VoxelBlockCache argument use a cache of their own, for the lookups of this one call.
+
 GPU_ONLY inline float readFromSDF_float_uninterpolated(
     Vector3f point, //!< in voxel-fractional-world-coordinates (such that one voxel has size 1)
-    THREADPTR(bool) &isFound)
+    THREADPTR(bool) &isFound,
+    VoxelBlockCache& cache)
 {
-    ITMVoxel res = readVoxel(TO_INT_ROUND3(point), isFound);
-    return res.getSDF();
+    float sdf = readSDF(TO_INT_ROUND3(point), isFound, cache);
+    for (Scene* level = cache.getScene(); !isFound && level->coarser;) {
+        level = toCoarserLevel(level, point);
+        VoxelBlockCache levelCache(level);
+        const float levelSDF = readSDF(TO_INT_ROUND3(point), isFound, levelCache);
+        if (isFound) sdf = toTruncationBandOf(cache.getScene(), level, levelSDF);
+    }
+    return sdf;
+}
+
+GPU_ONLY inline float readFromSDF_float_uninterpolated(
+    Vector3f point, //!< in voxel-fractional-world-coordinates (such that one voxel has size 1)
+    THREADPTR(bool) &isFound,
+    Scene* const scene)
+{
+    VoxelBlockCache cache(scene);
+    return readFromSDF_float_uninterpolated(point, isFound, cache);
 }
 
 #define COMPUTE_COEFF_POS_FROM_POINT() \
     /* Coeff are the sub-block coordinates, used for interpolation*/\
     Vector3f coeff; Vector3i pos; TO_INT_FLOOR3(pos, coeff, point);
 
-#define lookup(dx,dy,dz) readVoxel(pos + Vector3i(dx,dy,dz), isFound).getSDF()
+#define lookup(dx,dy,dz) readSDF(pos + Vector3i(dx,dy,dz), isFound, cache)
+#define lookupAll(dx,dy,dz) readSDFAll(pos + Vector3i(dx,dy,dz), allFound, cache)
 
-GPU_ONLY inline float readFromSDF_float_interpolated(
+/// Trilinear interpolation in the scene of cache only. Clears allFound when one of the 8 voxels is missing (reads as 1).
+GPU_ONLY inline float interpolateSDF(
     Vector3f point, //!< in voxel-fractional-world-coordinates (such that one voxel has size 1)
-    THREADPTR(bool) &isFound)
+    THREADPTR(bool) &allFound,
+    VoxelBlockCache& cache)
 {
 	float res1, res2, v1, v2;
     COMPUTE_COEFF_POS_FROM_POINT();
 
     // z = 0 layer -> res1
-	v1 = lookup(0, 0, 0);
-	v2 = lookup(1, 0, 0);
+	v1 = lookupAll(0, 0, 0);
+	v2 = lookupAll(1, 0, 0);
 	res1 = (1.0f - coeff.x) * v1 + coeff.x * v2;
 
-	v1 = lookup(0, 1, 0);
-	v2 = lookup(1, 1, 0);
+	v1 = lookupAll(0, 1, 0);
+	v2 = lookupAll(1, 1, 0);
 	res1 = (1.0f - coeff.y) * res1 + coeff.y * ((1.0f - coeff.x) * v1 + coeff.x * v2);
 
     // z = 1 layer -> res2
-	v1 = lookup(0, 0, 1);
-	v2 = lookup(1, 0, 1);
+	v1 = lookupAll(0, 0, 1);
+	v2 = lookupAll(1, 0, 1);
 	res2 = (1.0f - coeff.x) * v1 + coeff.x * v2;
 
-	v1 = lookup(0, 1, 1);
-	v2 = lookup(1, 1, 1);
+	v1 = lookupAll(0, 1, 1);
+	v2 = lookupAll(1, 1, 1);
 	res2 = (1.0f - coeff.y) * res2 + coeff.y * ((1.0f - coeff.x) * v1 + coeff.x * v2);
 
-	isFound = true;
     return (1.0f - coeff.z) * res1 + coeff.z * res2;
 }
 
+/// Interpolates in the finest level that has all 8 voxels around point, so that values are continuous
+/// across the border of two levels. Where none has them, the finest level's value, with missing voxels read as 1.
+GPU_ONLY inline float readFromSDF_float_interpolated(
+    Vector3f point, //!< in voxel-fractional-world-coordinates (such that one voxel has size 1)
+    THREADPTR(bool) &isFound,
+    VoxelBlockCache& cache)
+{
+    bool allFound = true;
+    float sdf = interpolateSDF(point, allFound, cache);
+    for (Scene* level = cache.getScene(); !allFound && level->coarser;) {
+        level = toCoarserLevel(level, point);
+        VoxelBlockCache levelCache(level);
+        allFound = true;
+        const float levelSDF = interpolateSDF(point, allFound, levelCache);
+        if (allFound) sdf = toTruncationBandOf(cache.getScene(), level, levelSDF);
+    }
+
+	isFound = true;
+    return sdf;
+}
+
+GPU_ONLY inline float readFromSDF_float_interpolated(
+    Vector3f point, //!< in voxel-fractional-world-coordinates (such that one voxel has size 1)
+    THREADPTR(bool) &isFound,
+    Scene* const scene)
+{
+    VoxelBlockCache cache(scene);
+    return readFromSDF_float_interpolated(point, isFound, cache);
+}
+
+#if VOXEL_HAS_COLOR
 /// Assumes voxels store color in some type convertible to Vector3f (e.g. Vector3u)
 GPU_ONLY inline Vector3f readFromSDF_color4u_interpolated(
-    const THREADPTR(Vector3f) & point //!< in voxel-fractional world coordinates, comes e.g. from raycastResult
+    const THREADPTR(Vector3f) & point, //!< in voxel-fractional world coordinates, comes e.g. from raycastResult
+    VoxelBlockCache& cache
     )
 {
     ITMVoxel resn; 
@@ -79,7 +271,7 @@ GPU_ONLY inline Vector3f readFromSDF_color4u_interpolated(
     COMPUTE_COEFF_POS_FROM_POINT()
 
 #define access(dx,dy,dz) \
-    resn = readVoxel(pos + Vector3i(dx, dy, dz), isFound);\
+    resn = readVoxel(pos + Vector3i(dx, dy, dz), isFound, cache);\
     ret += \
     (dx ? coeff.x : 1.0f - coeff.x) *\
     (dy ? coeff.y : 1.0f - coeff.y) *\
@@ -98,11 +290,22 @@ GPU_ONLY inline Vector3f readFromSDF_color4u_interpolated(
     return ret;
 }
 
+GPU_ONLY inline Vector3f readFromSDF_color4u_interpolated(
+    const THREADPTR(Vector3f) & point, //!< in voxel-fractional world coordinates, comes e.g. from raycastResult
+    Scene* const scene
+    )
+{
+    VoxelBlockCache cache(scene);
+    return readFromSDF_color4u_interpolated(point, cache);
+}
+#endif
+
 // TODO test and visualize
 // e.g. round to voxel position when rendering and draw this
 GPU_ONLY inline Vector3f computeSingleNormalFromSDFByForwardDifference(
     const THREADPTR(Vector3i) &pos, //!< [in] global voxel position
-    bool& isFound //!< [out] whether all values needed existed;
+    bool& isFound, //!< [out] whether all values needed existed;
+    VoxelBlockCache& cache
     ) {
     float sdf0 = lookup(0,0,0);
     if (!isFound) return Vector3f();
@@ -116,19 +319,28 @@ GPU_ONLY inline Vector3f computeSingleNormalFromSDFByForwardDifference(
     return n.normalised(); // TODO in a distance field, normalization should not be necesary. But this is not a true distance field.
 }
 
-/// Compute SDF normal by interpolated symmetric differences
-/// Used in processPixelGrey
+GPU_ONLY inline Vector3f computeSingleNormalFromSDFByForwardDifference(
+    const THREADPTR(Vector3i) &pos, //!< [in] global voxel position
+    bool& isFound, //!< [out] whether all values needed existed;
+    Scene* const scene
+    ) {
+    VoxelBlockCache cache(scene);
+    return computeSingleNormalFromSDFByForwardDifference(pos, isFound, cache);
+}
+
+/// Compute SDF gradient by interpolated symmetric differences, in the scene of cache only.
+/// Clears allFound when one of the voxels is missing (reads as 1).
 // Note: this gets the localVBA list, not just a *single* voxel block.
-GPU_ONLY inline Vector3f computeSingleNormalFromSDF(
-    const THREADPTR(Vector3f) &point)
+GPU_ONLY inline Vector3f computeSDFGradient(
+    const THREADPTR(Vector3f) &point,
+    THREADPTR(bool) &allFound,
+    VoxelBlockCache& cache)
 {
 
 	Vector3f ret;
     COMPUTE_COEFF_POS_FROM_POINT();
     Vector3f ncoeff = Vector3f(1,1,1) - coeff;
 
-    bool isFound; // swallow
-
     /*
     x direction gradient at point is evaluated by computing interpolated sdf value in next (1 -- 2, v2) and previous (-1 -- 0, v1) cell:
 
@@ -156,14 +368,14 @@ GPU_ONLY inline Vector3f computeSingleNormalFromSDF(
 
 	// all 8 values are going to be reused several times
 	Vector4f front, back;
-    front.x = lookup(0, 0, 0);
-	front.y = lookup(1, 0, 0);
-	front.z = lookup(0, 1, 0);
-	front.w = lookup(1, 1, 0);
-	back.x  = lookup(0, 0, 1);
-	back.y  = lookup(1, 0, 1);
-	back.z  = lookup(0, 1, 1);
-	back.w  = lookup(1, 1, 1);
+    front.x = lookupAll(0, 0, 0);
+	front.y = lookupAll(1, 0, 0);
+	front.z = lookupAll(0, 1, 0);
+	front.w = lookupAll(1, 1, 0);
+	back.x  = lookupAll(0, 0, 1);
+	back.y  = lookupAll(1, 0, 1);
+	back.z  = lookupAll(0, 1, 1);
+	back.w  = lookupAll(1, 1, 1);
 
 	Vector4f tmp;
 	float p1, p2, v1;
@@ -175,10 +387,10 @@ GPU_ONLY inline Vector3f computeSingleNormalFromSDF(
 	     back.x  * ncoeff.y *  coeff.z +
          back.z  *  coeff.y *  coeff.z;
     // (-1)-layer
-	tmp.x = lookup(-1, 0, 0);
-	tmp.y = lookup(-1, 1, 0);
-	tmp.z = lookup(-1, 0, 1);
-    tmp.w = lookup(-1, 1, 1);
+	tmp.x = lookupAll(-1, 0, 0);
+	tmp.y = lookupAll(-1, 1, 0);
+	tmp.z = lookupAll(-1, 0, 1);
+    tmp.w = lookupAll(-1, 1, 1);
 	p2 = tmp.x * ncoeff.y * ncoeff.z +
 	     tmp.y *  coeff.y * ncoeff.z +
 	     tmp.z * ncoeff.y *  coeff.z +
@@ -193,10 +405,10 @@ GPU_ONLY inline Vector3f computeSingleNormalFromSDF(
 	     back.y  * ncoeff.y *  coeff.z +
          back.w  *  coeff.y *  coeff.z;
     // 2-layer
-	tmp.x = lookup(2, 0, 0);
-	tmp.y = lookup(2, 1, 0);
-	tmp.z = lookup(2, 0, 1);
-	tmp.w = lookup(2, 1, 1);
+	tmp.x = lookupAll(2, 0, 0);
+	tmp.y = lookupAll(2, 1, 0);
+	tmp.z = lookupAll(2, 0, 1);
+	tmp.w = lookupAll(2, 1, 1);
 	p2 = tmp.x * ncoeff.y * ncoeff.z +
 	     tmp.y *  coeff.y * ncoeff.z +
 	     tmp.z * ncoeff.y *  coeff.z +
@@ -212,10 +424,10 @@ GPU_ONLY inline Vector3f computeSingleNormalFromSDF(
 	     front.y *  coeff.x * ncoeff.z +
 	     back.x  * ncoeff.x *  coeff.z +
 	     back.y  *  coeff.x *  coeff.z;
-	tmp.x = lookup(0, -1, 0);
-	tmp.y = lookup(1, -1, 0);
-	tmp.z = lookup(0, -1, 1);
-	tmp.w = lookup(1, -1, 1);
+	tmp.x = lookupAll(0, -1, 0);
+	tmp.y = lookupAll(1, -1, 0);
+	tmp.z = lookupAll(0, -1, 1);
+	tmp.w = lookupAll(1, -1, 1);
 	p2 = tmp.x * ncoeff.x * ncoeff.z +
 	     tmp.y *  coeff.x * ncoeff.z +
 	     tmp.z * ncoeff.x *  coeff.z +
@@ -226,10 +438,10 @@ GPU_ONLY inline Vector3f computeSingleNormalFromSDF(
 	     front.w *  coeff.x * ncoeff.z +
 	     back.z  * ncoeff.x *  coeff.z +
 	     back.w  *  coeff.x *  coeff.z;
-	tmp.x = lookup(0, 2, 0);
-	tmp.y = lookup(1, 2, 0);
-	tmp.z = lookup(0, 2, 1);
-	tmp.w = lookup(1, 2, 1);
+	tmp.x = lookupAll(0, 2, 0);
+	tmp.y = lookupAll(1, 2, 0);
+	tmp.z = lookupAll(0, 2, 1);
+	tmp.w = lookupAll(1, 2, 1);
 	p2 = tmp.x * ncoeff.x * ncoeff.z +
 	     tmp.y *  coeff.x * ncoeff.z +
 	     tmp.z * ncoeff.x *  coeff.z +
@@ -242,10 +454,10 @@ GPU_ONLY inline Vector3f computeSingleNormalFromSDF(
 	     front.y *  coeff.x * ncoeff.y +
 	     front.z * ncoeff.x *  coeff.y +
 	     front.w *  coeff.x *  coeff.y;
-	tmp.x = lookup(0, 0, -1);
-	tmp.y = lookup(1, 0, -1);
-	tmp.z = lookup(0, 1, -1);
-	tmp.w = lookup(1, 1, -1);
+	tmp.x = lookupAll(0, 0, -1);
+	tmp.y = lookupAll(1, 0, -1);
+	tmp.z = lookupAll(0, 1, -1);
+	tmp.w = lookupAll(1, 1, -1);
 	p2 = tmp.x * ncoeff.x * ncoeff.y +
 	     tmp.y *  coeff.x * ncoeff.y +
 	     tmp.z * ncoeff.x *  coeff.y +
@@ -256,10 +468,10 @@ GPU_ONLY inline Vector3f computeSingleNormalFromSDF(
 	     back.y *  coeff.x * ncoeff.y +
 	     back.z * ncoeff.x *  coeff.y +
 	     back.w *  coeff.x *  coeff.y;
-	tmp.x = lookup(0, 0, 2);
-	tmp.y = lookup(1, 0, 2);
-	tmp.z = lookup(0, 1, 2);
-	tmp.w = lookup(1, 1, 2);
+	tmp.x = lookupAll(0, 0, 2);
+	tmp.y = lookupAll(1, 0, 2);
+	tmp.z = lookupAll(0, 1, 2);
+	tmp.w = lookupAll(1, 1, 2);
 	p2 = tmp.x * ncoeff.x * ncoeff.y +
 	     tmp.y *  coeff.x * ncoeff.y +
 	     tmp.z * ncoeff.x *  coeff.y +
@@ -267,7 +479,36 @@ GPU_ONLY inline Vector3f computeSingleNormalFromSDF(
 
     ret.z = (p1 * ncoeff.z + p2 * coeff.z - v1);
 #undef lookup
+#undef lookupAll
 	return ret;
 }
 
+/// Compute SDF normal by interpolated symmetric differences, not normalized.
+/// Like readFromSDF_float_interpolated, uses the finest level that has all voxels needed.
+/// Used in processPixelGrey
+GPU_ONLY inline Vector3f computeSingleNormalFromSDF(
+    const THREADPTR(Vector3f) &point,
+    VoxelBlockCache& cache)
+{
+    bool allFound = true;
+    Vector3f ret = computeSDFGradient(point, allFound, cache);
+    Vector3f levelPoint = point;
+    for (Scene* level = cache.getScene(); !allFound && level->coarser;) {
+        level = toCoarserLevel(level, levelPoint);
+        VoxelBlockCache levelCache(level);
+        allFound = true;
+        const Vector3f levelGradient = computeSDFGradient(levelPoint, allFound, levelCache);
+        if (allFound) ret = levelGradient; // same direction in the voxel coordinates of any level
+    }
+    return ret;
+}
+
+GPU_ONLY inline Vector3f computeSingleNormalFromSDF(
+    const THREADPTR(Vector3f) &point,
+    Scene* const scene)
+{
+    VoxelBlockCache cache(scene);
+    return computeSingleNormalFromSDF(point, cache);
+}
+
 #undef COMPUTE_COEFF_POS_FROM_POINT
@@ -5,37 +5,42 @@
 #include "ITMRepresentationAccess.h"
 #include "CoordinateSystem.h"
 #include "CameraImage.h"
+#include "CPUParallel.h"
+#include <chrono>
 
 /// Fusion Stage - Camera Data Integration
 /// \returns \f$\eta\f$, -1 on failure
 // Note that the stored T-SDF values are normalized to lie
 // in [-1,1] within the truncation band.
-GPU_ONLY inline float computeUpdatedVoxelDepthInfo(
-    DEVICEPTR(ITMVoxel) &voxel, //!< X
-    const THREADPTR(Point) & pt_model //!< in world space
+CPU_AND_GPU inline float computeUpdatedVoxelDepthInfo(
+    ITMVoxelRef voxel, //!< X
+    const THREADPTR(Point) & pt_model, //!< in world space
+    const ITMView* const view,
+    const ITMSceneParams& params //!< of the scene voxel belongs to
     )
 {
+    const float mu_ = params.mu_;
 
     // project point into depth image
     /// X_d, depth camera coordinate system
     const Vector4f pt_camera = Vector4f(
-        currentView->depthImage->eyeCoordinates->convert(pt_model).location,
+        view->depthImage->eyeCoordinates->convert(pt_model).location,
         1);
     /// \pi(K_dX_d), projection into the depth image
     Vector2f pt_image;
-    if (!currentView->depthImage->project(pt_model, pt_image))
+    if (!view->depthImage->project(pt_model, pt_image))
         return -1;
 
     // get measured depth from image, no interpolation
     /// I_d(\pi(K_dX_d))
-    auto p = currentView->depthImage->getPointForPixel(pt_image.toInt());
+    auto p = view->depthImage->getPointForPixel(pt_image.toInt());
     const float depth_measure = p.location.z;
     if (depth_measure <= 0.0) return -1;
 
     /// I_d(\pi(K_dX_d)) - X_d^(z)          (3)
     float const eta = depth_measure - pt_camera.z;
     // check whether voxel needs updating
-    if (eta < -mu) return eta;
+    if (eta < -mu_) return eta;
 
     // compute updated SDF value and reliability (number of observations)
     /// D(X), w(X)
@@ -43,112 +48,453 @@ GPU_ONLY inline float computeUpdatedVoxelDepthInfo(
     int const oldW = voxel.w_depth;
 
     // newF, normalized for -1 to 1
-    float const newF = MIN(1.0f, eta / mu);
+    float const newF = MIN(1.0f, eta / mu_);
     int const newW = 1;
 
     updateVoxelDepthInformation(
         voxel,
-        oldF, oldW, newF, newW);
+        oldF, oldW, newF, newW, params.maxW_);
 
     return eta;
 }
 
+#if VOXEL_HAS_COLOR
 /// \returns early on failure
-GPU_ONLY inline void computeUpdatedVoxelColorInfo(
-    DEVICEPTR(ITMVoxel) &voxel,
-    const THREADPTR(Point) & pt_model)
+CPU_AND_GPU inline void computeUpdatedVoxelColorInfo(
+    ITMVoxelRef voxel,
+    const THREADPTR(Point) & pt_model,
+    const ITMView* const view,
+    const ITMSceneParams& params)
 {
     Vector2f pt_image;
-    if (!currentView->colorImage->project(pt_model, pt_image))
+    if (!view->colorImage->project(pt_model, pt_image))
         return;
 
     int oldW = (float)voxel.w_color;
     const Vector3f oldC = TO_FLOAT3(voxel.clr);
 
     /// Like formula (4) for depth
-    const Vector3f newC = TO_VECTOR3(interpolateBilinear<Vector4f>(currentView->colorImage->image->GetData(), pt_image, currentView->colorImage->imgSize()));
+    const Vector3f newC = TO_VECTOR3(interpolateBilinear<Vector4f>(view->colorImage->image->GetData(), pt_image, view->colorImage->imgSize()));
     int newW = 1;
 
     updateVoxelColorInformation(
         voxel,
-        oldC, oldW, newC, newW);
+        oldC, oldW, newC, newW, params.maxW_);
 }
+#endif
 
 
-GPU_ONLY static void computeUpdatedVoxelInfo(
-    DEVICEPTR(ITMVoxel) & voxel, //!< [in, out] updated voxel
-    const THREADPTR(Point) & pt_model) {
-    const float eta = computeUpdatedVoxelDepthInfo(voxel, pt_model);
+CPU_AND_GPU static void computeUpdatedVoxelInfo(
+    ITMVoxelRef voxel, //!< [in, out] updated voxel
+    const THREADPTR(Point) & pt_model,
+    const ITMView* const view,
+    const ITMSceneParams& params) {
+    const float eta = computeUpdatedVoxelDepthInfo(voxel, pt_model, view, params);
 
+#if VOXEL_HAS_COLOR
     // Only the voxels within +- 25% mu of the surface get color
-    if ((eta > mu) || (fabs(eta / mu) > 0.25f)) return;
-    computeUpdatedVoxelColorInfo(voxel, pt_model);
+    if ((eta > params.mu_) || (fabs(eta / params.mu_) > 0.25f)) return;
+    computeUpdatedVoxelColorInfo(voxel, pt_model, view, params);
+#endif
 }
 
-/// Determine the blocks around a given depth sample that are currently visible
-/// and need to be allocated.
-/// Builds hashVisibility and entriesAllocType.
-/// \param x,y [in] loop over depth image.
-struct buildHashAllocAndVisibleTypePP {
-    forEachPixelNoImage_process() {
-        // Find 3d position of depth pixel xy, in eye coordinates
-        auto pt_camera = currentView->depthImage->getPointForPixel(Vector2i(x, y));
-
-        const float depth = pt_camera.location.z;
-        if (depth <= 0 || (depth - mu) < 0 || (depth - mu) < viewFrustum_min || (depth + mu) > viewFrustum_max) return;
-
-        // the found point +- mu
-        const Vector pt_camera_v = (pt_camera - currentView->depthImage->location());
-        const float norm = length(pt_camera_v.direction);
-        const Vector pt_camera_v_minus_mu = pt_camera_v*(1.0f - mu / norm);
-        const Vector pt_camera_v_plus_mu = pt_camera_v*(1.0f + mu / norm);
-
-        // Convert to voxel block coordinates  
-        // the initial point pt_camera_v_minus_mu
-        Point point = voxelBlockCoordinates->convert(currentView->depthImage->location() + pt_camera_v_minus_mu);
-        // the direction towards pt_camera_v_plus_mu in voxelBlockCoordinates
-        const Vector vector = voxelBlockCoordinates->convert(pt_camera_v_plus_mu - pt_camera_v_minus_mu);
-
-        // We will step along point -> point_e and add all voxel blocks we encounter to the visible list
-        // "Create a segment on the line of sight in the range of the T-SDF truncation band"
-        const int noSteps = (int)ceil(2.0f* length(vector.direction) ); // make steps smaller than 1, maybe even < 1/2 to really land in all blocks at least once
-        const Vector direction = vector * (1.f / (float)(noSteps - 1));
-
-        //add neighbouring blocks
-        for (int i = 0; i < noSteps; i++)
-        {
-            // "take the block coordinates of voxels on this line segment"
-            const VoxelBlockPos blockPos = TO_SHORT_FLOOR3(point.location);
-            Scene::requestCurrentSceneVoxelBlockAllocation(blockPos);
-
-            point = point + direction;
+/// Determine the blocks of BLOCK_SIZE voxels (scene->params.blockSize_) of scene around a given depth sample of view that are currently visible
+/// and need to be allocated: calls visit(blockPos) for each of them, once each
+/// (unless ALLOCATION_SAMPLES_PER_BLOCK > 0, then some more than once).
+/// blockPos is in units of BLOCK_SIZE voxels, see forEachVoxelBlockOfBlock.
+/// \param x,y [in] pixel of the depth image.
+/// \returns the number of calls to visit
+// visit is GPU_ONLY for Fuse and host only for FuseOnCPU
+#pragma hd_warning_disable
+template<int BLOCK_SIZE, typename Visitor>
+CPU_AND_GPU inline uint forEachBlockOfDepthSample(const Scene* const scene, const ITMView* const view, const int x, const int y, const Visitor& visit) {
+    assert(scene->params.blockSize_ == BLOCK_SIZE);
+    const ITMSceneParams& params = scene->params;
+    const float mu_ = params.mu_;
+
+    // Find 3d position of depth pixel xy, in eye coordinates
+    auto pt_camera = view->depthImage->getPointForPixel(Vector2i(x, y));
+
+    const float depth = pt_camera.location.z;
+    if (depth <= 0 || (depth - mu_) < 0 || (depth - mu_) < params.viewFrustum_min_ || (depth + mu_) > params.viewFrustum_max_) return 0;
+    // another level of a multi-resolution scene takes this sample
+    if (depth < scene->levelDepthRange.x || depth >= scene->levelDepthRange.y) return 0;
+
+    // the found point +- mu
+    const Vector pt_camera_v = (pt_camera - view->depthImage->location());
+    const float norm = length(pt_camera_v.direction);
+    const Vector pt_camera_v_minus_mu = pt_camera_v*(1.0f - mu_ / norm);
+    const Vector pt_camera_v_plus_mu = pt_camera_v*(1.0f + mu_ / norm);
+
+    // Convert to voxel block coordinates  
+    // the initial point pt_camera_v_minus_mu
+    Point point = scene->voxelBlockCoordinateSystem->convert(view->depthImage->location() + pt_camera_v_minus_mu);
+    // the direction towards pt_camera_v_plus_mu in voxel block coordinates
+    const Vector vector = scene->voxelBlockCoordinateSystem->convert(pt_camera_v_plus_mu - pt_camera_v_minus_mu);
+    // and on to the coordinates of the blocks of BLOCK_SIZE voxels
+    const float toBlocks = SDF_BLOCK_SIZE / (float)BLOCK_SIZE;
+
+    // "Create a segment on the line of sight in the range of the T-SDF truncation band"
+    // and add all blocks it passes through
+#if ALLOCATION_SAMPLES_PER_BLOCK == 0
+    return Scene::forEachVoxelBlockOnSegment(point.location * toBlocks, (point + vector).location * toBlocks, visit);
+#else
+    // step along point -> point + vector, sampling the blocks we land in: small steps land in all blocks, most of them more than once
+    const int noSteps = (int)ceil(ALLOCATION_SAMPLES_PER_BLOCK * length(vector.direction) * toBlocks);
+    const Vector direction = vector * (1.f / (float)(noSteps - 1));
+
+    for (int i = 0; i < noSteps; i++)
+    {
+        // "take the block coordinates of voxels on this line segment"
+        const VoxelBlockPos blockPos = TO_SHORT_FLOOR3(point.location * toBlocks);
+        visit(blockPos);
+
+        point = point + direction;
+    }
+    return noSteps;
+#endif
+}
+
+/// Calls visit(voxelBlockPos) for each of the (BLOCK_SIZE / SDF_BLOCK_SIZE)^3 voxel blocks of the block of BLOCK_SIZE voxels at blockPos
+#pragma hd_warning_disable
+template<int BLOCK_SIZE, typename Visitor>
+CPU_AND_GPU inline void forEachVoxelBlockOfBlock(const VoxelBlockPos& blockPos, const Visitor& visit) {
+    const int n = BLOCK_SIZE / SDF_BLOCK_SIZE;
+    static_assert(n * SDF_BLOCK_SIZE == BLOCK_SIZE, "blocks must consist of whole voxel blocks");
+    for (int z = 0; z < n; z++)
+        for (int y = 0; y < n; y++)
+            for (int x = 0; x < n; x++)
+                visit(VoxelBlockPos(blockPos.x * n + x, blockPos.y * n + y, blockPos.z * n + z));
+}
+
+struct RequestVoxelBlock {
+    Scene* const scene;
+    GPU_ONLY void operator()(const VoxelBlockPos& blockPos) const {
+        scene->requestVoxelBlockAllocation(blockPos);
+        scene->markVoxelBlockSeen(blockPos);
+    }
+};
+
+/// Requests the voxel blocks of the block of BLOCK_SIZE voxels at blockPos, see forEachVoxelBlockOfBlock
+template<int BLOCK_SIZE>
+struct RequestBlock {
+    Scene* const scene;
+    GPU_ONLY void operator()(const VoxelBlockPos& blockPos) const {
+        const RequestVoxelBlock request = {scene};
+        forEachVoxelBlockOfBlock<BLOCK_SIZE>(blockPos, request);
+    }
+};
+
+/// Side length of the tiles of the depth image whose allocation requests are deduplicated together, in pixels
+static const int allocationTileSize = 16;
+/// Slots of the set of the blocks requested by a tile, 2^n.
+/// A tile requests a few dozen blocks, more where the surface is seen at a grazing angle.
+static const uint allocationTileSetSize = 512;
+static const unsigned long long emptyTileSetSlot = ~0ull; // no VoxelBlockPos packs to this
+
+GPU_ONLY static unsigned long long packVoxelBlockPos(const VoxelBlockPos& pos) {
+    return (unsigned long long)(ushort)pos.x | (unsigned long long)(ushort)pos.y << 16 | (unsigned long long)(ushort)pos.z << 32;
+}
+GPU_ONLY static VoxelBlockPos unpackVoxelBlockPos(const unsigned long long key) {
+    return VoxelBlockPos((short)(key & 0xffff), (short)(key >> 16 & 0xffff), (short)(key >> 32 & 0xffff));
+}
+
+/// Adds blockPos, of a block of BLOCK_SIZE voxels, to the set of a tile (open addressing with linear probing),
+/// or requests it right away, counting the requests of its voxel blocks in *requests, when the set is full.
+template<int BLOCK_SIZE>
+struct InsertIntoTileSet {
+    Scene* const scene;
+    unsigned long long* const set;
+    uint* const requests;
+    GPU_ONLY void operator()(const VoxelBlockPos& blockPos) const {
+        const unsigned long long key = packVoxelBlockPos(blockPos);
+        uint slot = ((uint)blockPos.x * 73856093u ^ (uint)blockPos.y * 19349669u ^ (uint)blockPos.z * 83492791u) & (allocationTileSetSize - 1);
+        for (uint probe = 0; probe < allocationTileSetSize; probe++, slot = (slot + 1) & (allocationTileSetSize - 1)) {
+            const unsigned long long old = atomicCAS(&set[slot], emptyTileSetSlot, key);
+            if (old == emptyTileSetSlot || old == key) return;
         }
+        const RequestBlock<BLOCK_SIZE> request = {scene};
+        request(blockPos);
+        atomicAdd(requests, voxelBlocksPerBlock);
     }
+    static const uint voxelBlocksPerBlock = (BLOCK_SIZE / SDF_BLOCK_SIZE) * (BLOCK_SIZE / SDF_BLOCK_SIZE) * (BLOCK_SIZE / SDF_BLOCK_SIZE);
 };
 
+/// The counters of one Fuse call, per level, in managed memory. Per call, such that Fuse can run on several threads.
+struct FuseCounters {
+    uint allocationRequests;
+    uint visibleVoxelBlocks, requestedVoxelBlocks, culledOutsideImage, culledByDepth;
+};
+
+/// Requests the allocation of the voxel blocks of scene for all depth samples of view, and marks them seen,
+/// in whole blocks of BLOCK_SIZE voxels (scene->params.blockSize_).
+/// Neighbouring depth samples mostly request the same blocks, so each thread block first collects the blocks of its tile
+/// of the depth image into a set in shared memory, then requests each of them once: the hash is probed once per voxel block and tile,
+/// not once per voxel block and depth sample. Counts the requests of voxel blocks in counters->allocationRequests.
+template<int BLOCK_SIZE>
+static KERNEL requestVoxelBlocksOfTiles(Scene* const scene, const ITMView* const view, const Vector2i imgSize, FuseCounters* const counters) {
+    __shared__ unsigned long long set[allocationTileSetSize];
+    __shared__ uint requests;
+    const uint thread = threadIdx.x + threadIdx.y * blockDim.x, threads = blockDim.x * blockDim.y;
+    for (uint i = thread; i < allocationTileSetSize; i += threads) set[i] = emptyTileSetSlot;
+    if (thread == 0) requests = 0;
+    __syncthreads();
+
+    const int
+        x = threadIdx.x + blockIdx.x * blockDim.x,
+        y = threadIdx.y + blockIdx.y * blockDim.y;
+    const InsertIntoTileSet<BLOCK_SIZE> insert = {scene, set, &requests};
+    if (x < imgSize.x && y < imgSize.y) // all threads must reach __syncthreads
+        forEachBlockOfDepthSample<BLOCK_SIZE>(scene, view, x, y, insert);
+    __syncthreads();
+
+    const RequestBlock<BLOCK_SIZE> request = {scene};
+    for (uint i = thread; i < allocationTileSetSize; i += threads) {
+        if (set[i] == emptyTileSetSlot) continue;
+        request(unpackVoxelBlockPos(set[i]));
+        atomicAdd(&requests, InsertIntoTileSet<BLOCK_SIZE>::voxelBlocksPerBlock);
+    }
+    __syncthreads();
+    if (thread == 0 && requests) atomicAdd(&counters->allocationRequests, requests);
+}
+
 #include <cuda_runtime.h>
 
+/// Integrates view into the voxels of a scene with the given params
 struct IntegrateVoxel {
-    doForEachAllocatedVoxel_process() {
-        computeUpdatedVoxelInfo(*v, globalPoint);
+    const ITMView* view;
+    ITMSceneParams params;
+    doForEachAllocatedVoxel_process_member_CPU_AND_GPU() {
+        computeUpdatedVoxelInfo(*v, globalPoint, view, params);
     }
 };
 
-/// Fusion stage of the system
-void Fuse()
+/// Side length of the tiles of the depth image whose largest depth cullVoxelBlock looks up, in pixels
+static const int depthTileSize = 16;
+
+/// maxima[tile] = the largest valid depth in the tile of the depth image, 0 when it has none. One thread block per tile.
+static KERNEL computeDepthTileMaxima(const ITMView* const view, const Vector2i imgSize, float* const maxima) {
+    __shared__ int maximum; // non-negative floats compare like their bits as int
+    if (threadIdx.x == 0 && threadIdx.y == 0) maximum = 0;
+    __syncthreads();
+
+    const int
+        x = threadIdx.x + blockIdx.x * blockDim.x,
+        y = threadIdx.y + blockIdx.y * blockDim.y;
+    if (x < imgSize.x && y < imgSize.y) { // all threads must reach __syncthreads
+        const float depth = view->depthImage->getPointForPixel(Vector2i(x, y)).location.z;
+        if (depth > 0) atomicMax(&maximum, __float_as_int(depth));
+    }
+    __syncthreads();
+    if (threadIdx.x == 0 && threadIdx.y == 0) maxima[blockIdx.x + blockIdx.y * gridDim.x] = __int_as_float(maximum);
+}
+
+enum VoxelBlockCulling { NOT_CULLED, CULLED_OUTSIDE_IMAGE, CULLED_BY_DEPTH };
+
+/// Whether computeUpdatedVoxelDepthInfo can update none of the voxels of the block at pos, and why, from its 8 corners alone:
+/// CULLED_OUTSIDE_IMAGE when they project outside of the depth image or lie behind the camera,
+/// CULLED_BY_DEPTH when the depths in the rectangle they project to are all invalid or all more than mu in front of the nearest corner,
+/// such that the whole block lies beyond the truncation band behind the observed surface.
+/// Voxels in front of the surface are updated too, so only the largest depth in the rectangle matters.
+/// Conservative: looks up the largest depth per tile (depthTileMaxima, see computeDepthTileMaxima)
+/// and keeps the blocks that cross the plane of the camera.
+GPU_ONLY static VoxelBlockCulling cullVoxelBlock(const ITMView* const view, const ITMSceneParams& params, const VoxelBlockPos& pos, const float* const depthTileMaxima) {
+    const Vector4f projParams = view->depthImage->projParams();
+    const Vector2i imgSize = view->depthImage->imgSize();
+    Vector2f imageMin(FLT_MAX), imageMax(-FLT_MAX);
+    float zMin = FLT_MAX;
+    int cornersInFront = 0;
+    for (int corner = 0; corner < 8; corner++) {
+        const Vector3i cornerVoxel = (pos.toInt() + Vector3i(corner & 1, (corner >> 1) & 1, corner >> 2)) * SDF_BLOCK_SIZE;
+        const Point p(CoordinateSystem::global(), cornerVoxel.toFloat() * params.voxelSize_);
+        const Vector3f pt_camera = view->depthImage->eyeCoordinates->convert(p).location;
+        Vector2f pt_image;
+        if (!projectNoBounds(projParams, Vector4f(pt_camera, 1.f), pt_image)) continue;
+        cornersInFront++;
+        zMin = MIN(zMin, pt_camera.z);
+        imageMin.x = MIN(imageMin.x, pt_image.x); imageMin.y = MIN(imageMin.y, pt_image.y);
+        imageMax.x = MAX(imageMax.x, pt_image.x); imageMax.y = MAX(imageMax.y, pt_image.y);
+    }
+    if (cornersInFront == 0) return CULLED_OUTSIDE_IMAGE;
+    if (cornersInFront < 8) return NOT_CULLED; // the corners do not bound where the voxels project to
+
+    // the voxels project into this rectangle, a pixel more for rounding
+    imageMin -= Vector2f(1.f); imageMax += Vector2f(1.f);
+    if (imageMax.x < 0 || imageMax.y < 0 || imageMin.x > imgSize.x - 1 || imageMin.y > imgSize.y - 1) return CULLED_OUTSIDE_IMAGE;
+    const Vector2i
+        tileMin((int)MAX(imageMin.x, 0.f) / depthTileSize, (int)MAX(imageMin.y, 0.f) / depthTileSize),
+        tileMax((int)MIN(imageMax.x, imgSize.x - 1.f) / depthTileSize, (int)MIN(imageMax.y, imgSize.y - 1.f) / depthTileSize);
+    const int tilesX = (imgSize.x + depthTileSize - 1) / depthTileSize;
+    float depthMax = 0;
+    for (int y = tileMin.y; y <= tileMax.y; y++)
+        for (int x = tileMin.x; x <= tileMax.x; x++)
+            depthMax = MAX(depthMax, depthTileMaxima[x + y * tilesX]);
+
+    if (depthMax <= 0 || depthMax - zMin < -params.mu_) return CULLED_BY_DEPTH; // eta < -mu for all voxels
+    return NOT_CULLED;
+}
+
+/// Appends the sequence numbers of the blocks of scene that are visible in view (see FuseStatistics::visibleVoxelBlocks) to out,
+/// counting them in counters->visibleVoxelBlocks.
+/// The allocation pass marked the blocks it requested seen in the current frame, counts those in counters->requestedVoxelBlocks,
+/// and the others that cullVoxelBlock skips in counters->culledOutsideImage and counters->culledByDepth.
+static KERNEL collectVisibleVoxelBlocks(const Scene* const scene, const ITMView* const view, const uint n, const float* const depthTileMaxima, uint* const out, FuseCounters* const counters) {
+    const uint i = blockIdx.x * blockDim.x + threadIdx.x;
+    if (i == 0 || i >= n) return;
+    const VoxelBlockPos pos = scene->localVBA->get(i)->pos_;
+    if (pos == INVALID_VOXEL_BLOCK_POS) return; // removed
+    if (scene->lastSeenFrame[i] == scene->frame) atomicAdd(&counters->requestedVoxelBlocks, 1);
+    else switch (cullVoxelBlock(view, scene->params, pos, depthTileMaxima)) {
+    case CULLED_OUTSIDE_IMAGE: atomicAdd(&counters->culledOutsideImage, 1); return;
+    case CULLED_BY_DEPTH: atomicAdd(&counters->culledByDepth, 1); return;
+    case NOT_CULLED: break;
+    }
+    out[atomicAdd(&counters->visibleVoxelBlocks, 1)] = i;
+}
+
+/// Fusion stage of the system, for each level of the scene (see Scene::createMultiResolution)
+FuseStatistics Fuse(const ITMContext& context)
 {
-    cudaDeviceSynchronize();
-    assert(Scene::getCurrentScene());
-    assert(currentView);
+    assert(context.scene);
+    assert(context.view);
+    ITMView* const view = context.view;
+    FuseCounters* counters;
+    cudaSafeCall(cudaMallocManaged(&counters, sizeof(FuseCounters)));
+    FuseStatistics statistics = {};
+    for (Scene* level = context.scene; level; level = level->coarser) {
+        cudaSafeCall(cudaDeviceSynchronize()); // want to write managed memory
+        *counters = FuseCounters();
+
+        // allocation request
+        const auto allocationStart = std::chrono::high_resolution_clock::now();
+        const Vector2i imgSize = view->depthImage->imgSize();
+        const dim3 tile(allocationTileSize, allocationTileSize);
+        switch (level->params.blockSize_) {
+        case 8: LAUNCH_KERNEL(requestVoxelBlocksOfTiles<8>, getGridSize(imgSize, tile), tile, level, view, imgSize, counters); break;
+        case 16: LAUNCH_KERNEL(requestVoxelBlocksOfTiles<16>, getGridSize(imgSize, tile), tile, level, view, imgSize, counters); break;
+        default: assert(false); // see ITMSceneParams::check
+        }
+        statistics.allocationRequests += counters->allocationRequests;
 
-    // allocation request
-    forEachPixelNoImage<buildHashAllocAndVisibleTypePP>(currentView->depthImage->imgSize());
-    cudaDeviceSynchronize();
+        // allocation
+        level->performAllocations();
+        cudaDeviceSynchronize();
+        statistics.allocationMilliseconds += std::chrono::duration<float, std::milli>(std::chrono::high_resolution_clock::now() - allocationStart).count();
 
-    // allocation
-    Scene::performCurrentSceneAllocations();
+        // visible blocks
+        const dim3 depthTile(depthTileSize, depthTileSize);
+        const dim3 depthTiles = getGridSize(imgSize, depthTile);
+        float* depthTileMaxima;
+        cudaSafeCall(cudaMalloc(&depthTileMaxima, depthTiles.x * depthTiles.y * sizeof(float)));
+        LAUNCH_KERNEL(computeDepthTileMaxima, depthTiles, depthTile, view, imgSize, depthTileMaxima);
 
-    // camera data integration
-    cudaDeviceSynchronize();
-    Scene::getCurrentScene()->doForEachAllocatedVoxel<IntegrateVoxel>();
+        const uint n = level->voxelBlockHash->getLowestFreeSequenceNumber();
+        uint* visible;
+        cudaSafeCall(cudaMalloc(&visible, n * sizeof(uint)));
+        LAUNCH_KERNEL(collectVisibleVoxelBlocks, (uint)ceil(n / 256.), 256, level, view, n, depthTileMaxima, visible, counters);
+        cudaFree(depthTileMaxima);
+        statistics.allocatedVoxelBlocks += level->voxelBlockHash->countAllocatedEntries();
+        statistics.visibleVoxelBlocks += counters->visibleVoxelBlocks;
+        statistics.requestedVoxelBlocks += counters->requestedVoxelBlocks;
+        statistics.culledOutsideImageVoxelBlocks += counters->culledOutsideImage;
+        statistics.culledByDepthVoxelBlocks += counters->culledByDepth;
+
+        // camera data integration
+        const IntegrateVoxel integrate = {view, level->params};
+        level->doForEachAllocatedVoxel(visible, counters->visibleVoxelBlocks, integrate);
+        cudaFree(visible);
+    }
+    cudaFree(counters);
+    return statistics;
+}
+
+// --- FuseOnCPU ---
+#include <algorithm>
+
+struct CollectVoxelBlock {
+    std::vector<VoxelBlockPos>* const out;
+    void operator()(const VoxelBlockPos& blockPos) const {
+        if (out->empty() || out->back() != blockPos) out->push_back(blockPos);
+    }
+};
+
+/// Collects the voxel blocks of the blocks of BLOCK_SIZE voxels it is called with
+template<int BLOCK_SIZE>
+struct CollectVoxelBlocks {
+    std::vector<VoxelBlockPos>* const out;
+    void operator()(const VoxelBlockPos& blockPos) const {
+        const CollectVoxelBlock collect = {out};
+        forEachVoxelBlockOfBlock<BLOCK_SIZE>(blockPos, collect);
+    }
+};
+
+static bool lessVoxelBlockPos(const VoxelBlockPos& a, const VoxelBlockPos& b) {
+    if (a.x != b.x) return a.x < b.x;
+    if (a.y != b.y) return a.y < b.y;
+    return a.z < b.z;
+}
+
+static KERNEL requestVoxelBlocks(Scene* const scene, const VoxelBlockPos* const positions, const uint count) {
+    const uint i = blockIdx.x * blockDim.x + threadIdx.x;
+    if (i >= count) return;
+    const RequestVoxelBlock request = {scene};
+    request(positions[i]);
+}
+
+/// The allocation requests of buildHashAllocAndVisibleTypePP for scene and view, computed on the cpu row by row,
+/// without duplicates and in a fixed order
+template<int BLOCK_SIZE>
+static void requestAllocationsOnCPU(Scene* const scene, const ITMView* const view) {
+    const Vector2i imgSize = view->depthImage->imgSize();
+    view->depthImage->image->GetData(MEMORYDEVICE_CPU); // copy to the host once, before the threads read it
+
+    std::vector<std::vector<VoxelBlockPos>> rows(imgSize.y);
+    parallelForWorkStealing(imgSize.y, [&](const uint y) {
+        const CollectVoxelBlocks<BLOCK_SIZE> collect = {&rows[y]};
+        for (int x = 0; x < imgSize.x; x++) forEachBlockOfDepthSample<BLOCK_SIZE>(scene, view, x, y, collect);
+        std::sort(rows[y].begin(), rows[y].end(), lessVoxelBlockPos);
+        rows[y].erase(std::unique(rows[y].begin(), rows[y].end()), rows[y].end());
+    });
+
+    std::vector<VoxelBlockPos> positions;
+    for (auto& row : rows) positions.insert(positions.end(), row.begin(), row.end());
+    std::sort(positions.begin(), positions.end(), lessVoxelBlockPos);
+    positions.erase(std::unique(positions.begin(), positions.end()), positions.end());
+    const uint count = (uint)positions.size();
+    if (count == 0) return;
+
+    VoxelBlockPos* gpu_positions;
+    cudaSafeCall(cudaMalloc(&gpu_positions, count * sizeof(VoxelBlockPos)));
+    cudaSafeCall(cudaMemcpy(gpu_positions, positions.data(), count * sizeof(VoxelBlockPos), cudaMemcpyHostToDevice));
+    LAUNCH_KERNEL(requestVoxelBlocks, (uint)ceil(count / 256.), 256, scene, gpu_positions, count);
+    cudaFree(gpu_positions);
+}
+
+/// Like Fuse, but computes on the cpu, see ITMSceneReconstructionEngine.h
+void FuseOnCPU(const ITMContext& context)
+{
+    assert(context.scene);
+    assert(context.view);
+    ITMView* const view = context.view;
+    for (Scene* level = context.scene; level; level = level->coarser) {
+        cudaDeviceSynchronize();
+
+        // allocation request
+        switch (level->params.blockSize_) {
+        case 8: requestAllocationsOnCPU<8>(level, view); break;
+        case 16: requestAllocationsOnCPU<16>(level, view); break;
+        default: assert(false); // see ITMSceneParams::check
+        }
+
+        // allocation
+        level->performAllocations();
+
+        // camera data integration, reading the images on the host
+        view->depthImage->image->GetData(MEMORYDEVICE_CPU);
+#if VOXEL_HAS_COLOR
+        view->colorImage->image->GetData(MEMORYDEVICE_CPU);
+#endif
+        const IntegrateVoxel integrate = {view, level->params};
+        level->doForEachAllocatedVoxelOnCPU(integrate);
+    }
 }
\ No newline at end of file
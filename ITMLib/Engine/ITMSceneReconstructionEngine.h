@@ -5,8 +5,73 @@
 #include "ITMLibDefines.h"
 
 #include "ITMView.h"
+#include "ITMContext.h"
+#include <string>
+#include <sstream>
+
+/// What one Fuse call did, summed over the levels of the scene. toJSON for logging per frame.
+struct FuseStatistics {
+    /// Voxel blocks allocated after the allocation pass
+    uint allocatedVoxelBlocks;
+    /// Of those, the ones integrated: the blocks the allocation pass requested, and the others that are not culled
+    uint visibleVoxelBlocks;
+    /// Of the others, the ones skipped since they project outside of the depth image or lie behind the camera
+    uint culledOutsideImageVoxelBlocks;
+    /// and the ones skipped since they lie beyond the truncation band behind all depths in the part of the depth image they project to
+    uint culledByDepthVoxelBlocks;
+    /// Allocation requests (each a hash lookup) the allocation pass made, over all depth samples
+    uint allocationRequests;
+    /// The distinct blocks among them that are allocated, the others were requested more than once
+    /// (by several tiles of the depth image, see Fuse) or could not be allocated yet
+    uint requestedVoxelBlocks;
+    /// Wall time of the allocation pass, requests and allocation, in milliseconds
+    float allocationMilliseconds;
+
+    /// Hash lookups of the allocation pass beyond one per requested block
+    uint redundantAllocationRequests() const {
+        return allocationRequests - requestedVoxelBlocks;
+    }
+
+    /// A single line JSON object with all the fields above
+    std::string toJSON() const {
+        std::ostringstream o;
+        o << "{"
+            << "\"allocatedVoxelBlocks\":" << allocatedVoxelBlocks
+            << ",\"visibleVoxelBlocks\":" << visibleVoxelBlocks
+            << ",\"culledOutsideImageVoxelBlocks\":" << culledOutsideImageVoxelBlocks
+            << ",\"culledByDepthVoxelBlocks\":" << culledByDepthVoxelBlocks
+            << ",\"allocationRequests\":" << allocationRequests
+            << ",\"requestedVoxelBlocks\":" << requestedVoxelBlocks
+            << ",\"redundantAllocationRequests\":" << redundantAllocationRequests()
+            << ",\"allocationMilliseconds\":" << allocationMilliseconds
+            << "}";
+        return o.str();
+    }
+};
 
 /** \brief
-    main KinectFusion depth integration process
+    main KinectFusion depth integration process: integrates context.view into context.scene
+
+    Only the visible voxel blocks are integrated (see FuseStatistics::visibleVoxelBlocks), so the cost of integration
+    follows what the camera sees rather than the size of the scene. Blocks in which no voxel could be updated are
+    culled from their 8 corners and the largest depth per 16x16 tile of the depth image, rather than by projecting each voxel.
+
+    The allocation pass deduplicates the blocks the depth samples request per 16x16 tile of the depth image before it
+    looks them up in the hash, see FuseStatistics::allocationRequests.
+*/
+FuseStatistics Fuse(const ITMContext& context);
+
+/** \brief
+    Fuse on the cpu: the allocation pass runs over the rows of the depth image and the integration pass over the voxel blocks
+    (Scene::doForEachAllocatedVoxelOnCPU), both on all hardware threads with work stealing (parallelForWorkStealing).
+    Only the voxel block hash stays on the gpu: the requested blocks are deduplicated on the cpu, then allocated there.
+    The scene keeps a host copy of its voxel blocks between calls (see Scene::doForEachAllocatedVoxelOnCPU), so a frame copies
+    only the newly allocated blocks to the host and the updated ones back, unless something else changed the blocks on the gpu.
+
+    Integration runs the same code as in Fuse. Its results equal those of Fuse bit for bit when the device code is compiled
+    without fused multiply-add contraction (nvcc --fmad=false), otherwise a few SDF values differ in the last bit.
+    Where allocation requests collide in the hash, which of them are allocated in this frame can differ from Fuse.
+    Integrates all allocated blocks, not only the visible ones: the others get no updates, since none of their voxels
+    projects into the depth image, except near the border of the image.
 */
-void Fuse();
+void FuseOnCPU(const ITMContext& context);
@@ -1,25 +1,23 @@
-#define ITMVIEW_
 #include "ITMView.h"
 #include "CUDADefines.h"
 #include "MemoryBlock.h"
 #include "ITMPixelUtils.h"
 #include "itmlibdefines.h"
 
-static __managed__ float *d_out;
-static __managed__ const short *d_in;
-static __managed__ Vector2f disparityCalibParams;
-static __managed__ float fx_depth;
-
-/// current depth & color image
-__managed__ ITMView * currentView = 0;
-
-
 /// case ITMDisparityCalib::TRAFO_KINECT:
 /// Raw values are transformed according to \f$\frac{8 c_2 f_x}{c_1 - d}\f$
 /// Where f_x is the x focal length of the depth camera.
 //!< \returns >0 on success, outputs INVALID_DEPTH on failure
-struct ConvertDisparityToDepth {
-    forEachPixelNoImage_process() {
+struct DepthConversion {
+    const short *d_in;
+    float *d_out;
+    float fx_depth;
+    Vector2f disparityCalibParams;
+};
+
+struct ConvertDisparityToDepth : DepthConversion {
+    ConvertDisparityToDepth(const DepthConversion& c) : DepthConversion(c) {}
+    forEachPixelNoImage_process_member() {
         const short disparity = d_in[locId];
 
         // for kinect, raw (e.g. Teddy)
@@ -34,8 +32,9 @@ struct ConvertDisparityToDepth {
     }
 };
 
-struct ScaleAndValidateDepth {
-    forEachPixelNoImage_process() {
+struct ScaleAndValidateDepth : DepthConversion {
+    ScaleAndValidateDepth(const DepthConversion& c) : DepthConversion(c) {}
+    forEachPixelNoImage_process_member() {
         const short depth = d_in[locId];
         // http://qianyi.info/scenedata.html
         // for fountain
@@ -53,16 +52,17 @@ void ITMView::ChangeImages(ITMUChar4Image *rgbImage, ITMShortImage *rawDepthImag
     // copy rawDepthImage to gpu, then store ConvertDisparityToDepth result in view->depth
     rawDepthImageGPU->SetFrom(rawDepthImage, CPU_TO_CUDA);
 
-    ::d_in = rawDepthImageGPU->GetData(MEMORYDEVICE_CUDA);
+    DepthConversion c;
+    c.d_in = rawDepthImageGPU->GetData(MEMORYDEVICE_CUDA);
 
 
     depthData->ChangeDims(rawDepthImageGPU->noDims);
 
-    ::d_out = depthData->GetData(MEMORYDEVICE_CUDA);
-    ::fx_depth = calib->intrinsics_d.projectionParamsSimple.fx;
-    ::disparityCalibParams = calib->disparityCalib.params;
+    c.d_out = depthData->GetData(MEMORYDEVICE_CUDA);
+    c.fx_depth = calib->intrinsics_d.projectionParamsSimple.fx;
+    c.disparityCalibParams = calib->disparityCalib.params;
 
-#define dcp(name) if (ITMView::depthConversionType == #name) {forEachPixelNoImage<name>(depthData->noDims); return;}
+#define dcp(name) if (ITMView::depthConversionType == #name) {forEachPixelNoImage(depthData->noDims, name(c)); return;}
     dcp(ConvertDisparityToDepth);
     dcp(ScaleAndValidateDepth);
 
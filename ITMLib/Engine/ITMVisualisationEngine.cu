@@ -4,44 +4,39 @@
 #include "ITMLibDefines.h"
 #include "ITMSceneReconstructionEngine.h"
 #include "ITMRepresentationAccess.h"
-/**
-the 3D intersection locations generated by the latest raycast
-in voxelCoordinates
-*/
-static __managed__ PointImage* raycastResult;
-
-// for ICP
-//!< [out] receives output points in world coordinates
-//!< [out] receives world space normals computed from points (image space)
-static __managed__ DEVICEPTR(RayImage) * lastFrameICPMap = 0;
-
-// for RenderImage
-static __managed__ CameraImage<Vector4u>* outRendering = 0;
-static __managed__ Vector3f towardsCamera;
-
-// written by rendering
-static __managed__ ITMFloatImage* outDepth;
+// The raycast and the shaders get the scene and the images they read and write as members (copied to the device with each launch),
+// such that several contexts can render at the same time.
 
 // === raycasting, rendering ===
 /// \param x,y [in] camera space pixel determining ray direction
 //!< [out] raycastResult[locId]: the intersection point. 
 // w is 1 for a valid point, 0 for no intersection; in voxel-fractional-world-coordinates
+// BLOCK_SIZE is scene->params.blockSize_
+template<int BLOCK_SIZE>
 struct castRay {
-    forEachPixelNoImage_process()
+    Scene* scene;
+    /// the 3D intersection locations generated by the raycast, in the voxel coordinates of scene
+    PointImage* raycastResult;
+
+    forEachPixelNoImage_process_member()
     {
+        const ITMSceneParams& params = scene->params;
+        assert(params.blockSize_ == BLOCK_SIZE);
+        const CoordinateSystem* const sceneVoxelCoordinates = scene->voxelCoordinateSystem;
+
         // Find 3d position of depth pixel xy, in eye coordinates
-        auto pt_camera_f = raycastResult->getRayThroughPixel(Vector2i(x, y), viewFrustum_min);
+        auto pt_camera_f = raycastResult->getRayThroughPixel(Vector2i(x, y), params.viewFrustum_min_);
         assert(pt_camera_f.origin.coordinateSystem == raycastResult->eyeCoordinates);
         auto l = pt_camera_f.endpoint().location;
-        assert(l.z == viewFrustum_min);
+        assert(l.z == params.viewFrustum_min_);
 
         // Length given in voxel-fractional-coordinates (such that one voxel has size 1)
-        auto pt_camera_f_vc = voxelCoordinates->convert(pt_camera_f);
+        auto pt_camera_f_vc = sceneVoxelCoordinates->convert(pt_camera_f);
         float totalLength = length(pt_camera_f_vc.direction.direction);
-        assert(voxelSize < 1);
+        assert(params.voxelSize_ < 1);
         assert(totalLength > length(pt_camera_f.direction.direction));
         assert(abs(
-            totalLength - length(pt_camera_f.direction.direction) / voxelSize) < 0.0001f);
+            totalLength - length(pt_camera_f.direction.direction) / params.voxelSize_) < 0.0001f);
 
         // in voxel-fractional-world-coordinates (such that one voxel has size 1)
         assert(pt_camera_f.endpoint().coordinateSystem == raycastResult->eyeCoordinates);
@@ -49,21 +44,22 @@ struct castRay {
         const auto pt_block_s = pt_camera_f_vc.endpoint();
 
         // End point
-        auto pt_camera_e = raycastResult->getRayThroughPixel(Vector2i(x, y), viewFrustum_max);
-        auto pt_camera_e_vc = voxelCoordinates->convert(pt_camera_e);
+        auto pt_camera_e = raycastResult->getRayThroughPixel(Vector2i(x, y), params.viewFrustum_max_);
+        auto pt_camera_e_vc = sceneVoxelCoordinates->convert(pt_camera_e);
         const float totalLengthMax = length(pt_camera_e_vc.direction.direction);
         const auto pt_block_e = pt_camera_e_vc.endpoint();
 
         assert(totalLength < totalLengthMax);
-        assert(pt_block_s.coordinateSystem == voxelCoordinates);
-        assert(pt_block_e.coordinateSystem == voxelCoordinates);
+        assert(pt_block_s.coordinateSystem == sceneVoxelCoordinates);
+        assert(pt_block_e.coordinateSystem == sceneVoxelCoordinates);
 
         // Raymarching
-        const auto rayDirection = Vector(voxelCoordinates, normalize(pt_block_e.location - pt_block_s.location));
+        const auto rayDirection = Vector(sceneVoxelCoordinates, normalize(pt_block_e.location - pt_block_s.location));
         auto pt_result = pt_block_s; // Current position in voxel-fractional-world-coordinates
-        const float stepScale = mu * oneOverVoxelSize; // sdf values are distances in world-coordinates, normalized by division through mu. This is the factor to convert to voxelCoordinates.
+        const float stepScale = params.mu_ / params.voxelSize_; // sdf values are distances in world-coordinates, normalized by division through mu. This is the factor to convert to voxelCoordinates.
 
-        // TODO use caching, we will access the same voxel block multiple times
+        // consecutive steps mostly stay in the same voxel blocks
+        VoxelBlockCache cache(scene);
         float sdfValue = 1.0f;
         bool hash_found;
 
@@ -72,11 +68,12 @@ struct castRay {
 
         while (totalLength < totalLengthMax) {
             // D(X)
-            sdfValue = readFromSDF_float_uninterpolated(pt_result.location, hash_found);
+            sdfValue = readFromSDF_float_uninterpolated(pt_result.location, hash_found, cache);
 
             if (!hash_found) {
-                //  First we try to find an allocated voxel block, and the length of the steps we take is determined by the block size
-                stepLength = SDF_BLOCK_SIZE;
+                //  First we try to find an allocated voxel block, and the length of the steps we take is determined by the block size.
+                //  Fuse allocates whole blocks of BLOCK_SIZE voxels, so where one voxel block is missing its whole block mostly is.
+                stepLength = BLOCK_SIZE;
             }
             else {
                 // If we found an allocated block, 
@@ -84,7 +81,7 @@ struct castRay {
 
                 // using trilinear interpolation only if we have read values in the range −0.5 ≤ D(X) ≤ 0.1
                 if ((sdfValue <= 0.1f) && (sdfValue >= -0.5f)) {
-                    sdfValue = readFromSDF_float_interpolated(pt_result.location, hash_found);
+                    sdfValue = readFromSDF_float_interpolated(pt_result.location, hash_found, cache);
                 }
                 // once we read a negative value from the SDF, we found the intersection with the surface.
                 if (sdfValue <= 0.0f) break;
@@ -111,7 +108,7 @@ struct castRay {
             pt_result = pt_result + rayDirection * stepLength;
 
             // Read again
-            sdfValue = readFromSDF_float_interpolated(pt_result.location, hash_found);
+            sdfValue = readFromSDF_float_interpolated(pt_result.location, hash_found, cache);
             // Refine position
             stepLength = sdfValue * stepScale;
             pt_result = pt_result + rayDirection * stepLength;
@@ -121,8 +118,8 @@ struct castRay {
         else pt_found = false;
 
         raycastResult->image->GetData()[locId] = Vector4f(pt_result.location, (pt_found) ? 1.0f : 0.0f);
-        assert(raycastResult->pointCoordinates == voxelCoordinates);
-        assert(pt_result.coordinateSystem == voxelCoordinates);
+        assert(raycastResult->pointCoordinates == sceneVoxelCoordinates);
+        assert(pt_result.coordinateSystem == sceneVoxelCoordinates);
     }
 };
 
@@ -131,13 +128,15 @@ struct castRay {
 GPU_ONLY inline void computeNormalAndAngle(
     THREADPTR(bool) & foundPoint, //!< [in,out]
     const THREADPTR(Vector3f) & point, //!< [in]
+    const Vector3f& towardsCamera, //!< [in] (negative camera z axis)
+    VoxelBlockCache& cache, //!< [in] of the scene point lies in
     THREADPTR(Vector3f) & outNormal,//!< [out] 
     THREADPTR(float) & angle //!< [out] outNormal . towardsCamera
     )
 {
     if (!foundPoint) return;
 
-    outNormal = normalize(computeSingleNormalFromSDF(point));
+    outNormal = normalize(computeSingleNormalFromSDF(point, cache));
 
     angle = dot(outNormal, towardsCamera);
     // dont consider points not facing the camera (raycast will hit these, do backface culling now)
@@ -152,7 +151,8 @@ GPU_ONLY inline void computeNormalAndAngle(
 DEVICEPTR(Vector4u) & dest,/* in voxel-fractional world coordinates, comes from raycastResult*/\
 const CONSTPTR(Vector3f) & point, /* in voxel-fractional world coordinates, comes from raycastResult*/\
 const THREADPTR(Vector3f) & normal_obj,\
-const THREADPTR(float) & angle
+const THREADPTR(float) & angle,\
+VoxelBlockCache& cache /* of the scene point lies in */
 
 GPU_ONLY inline void drawPixelGrey(DRAWFUNCTIONPARAMS)
 {
@@ -167,26 +167,44 @@ GPU_ONLY inline void drawPixelNormal(DRAWFUNCTIONPARAMS) {
 }
 
 GPU_ONLY inline void drawPixelColour(DRAWFUNCTIONPARAMS) {
-    const Vector3f clr = readFromSDF_color4u_interpolated(point);
+#if VOXEL_HAS_COLOR
+    const Vector3f clr = readFromSDF_color4u_interpolated(point, cache);
     dest = Vector4u(TO_UCHAR3(clr), 255);
+#else
+    drawPixelGrey(dest, point, normal_obj, angle, cache);
+#endif
 }
 
+/// What the shaders read and write
+struct RenderArguments {
+    Scene* scene;
+    /// from castRay
+    PointImage* raycastResult;
+    CameraImage<Vector4u>* outRendering;
+    /// written by rendering
+    ITMFloatImage* outDepth;
+    /// (negative camera z axis)
+    Vector3f towardsCamera;
+};
+
 #define PROCESS_AND_DRAW_PIXEL(PROCESSFUNCTION, DRAWFUNCTION) \
-struct PROCESSFUNCTION { \
-    forEachPixelNoImage_process() {\
+struct PROCESSFUNCTION : RenderArguments { \
+    PROCESSFUNCTION(const RenderArguments& a) : RenderArguments(a) {} \
+    forEachPixelNoImage_process_member() {\
         DEVICEPTR(Vector4u) &outRender = outRendering->image->GetData()[locId]; \
 Point voxelCoordinatePoint = raycastResult->getPointForPixel(Vector2i(x,y));\
-assert(voxelCoordinatePoint.coordinateSystem == voxelCoordinates); \
+assert(voxelCoordinatePoint.coordinateSystem == scene->voxelCoordinateSystem); \
         const CONSTPTR(Vector3f) point = voxelCoordinatePoint.location; \
-float& outZ = ::outDepth->GetData()[locId];\
+float& outZ = outDepth->GetData()[locId];\
     auto a = outRendering->eyeCoordinates->convert(voxelCoordinatePoint);\
 outZ = a.location.z; /* in world / eye coordinates (distance) */ \
         bool foundPoint = raycastResult->image->GetData()[locId].w > 0; \
         \
+        VoxelBlockCache cache(scene); \
         Vector3f outNormal; \
         float angle; \
-computeNormalAndAngle(foundPoint, point, outNormal, angle); \
-        if (foundPoint) {/*assert(outZ >= viewFrustum_min && outZ <= viewFrustum_max); -- approx*/DRAWFUNCTION(outRender, point, outNormal, angle);} \
+computeNormalAndAngle(foundPoint, point, towardsCamera, cache, outNormal, angle); \
+        if (foundPoint) {/*assert(outZ >= viewFrustum_min && outZ <= viewFrustum_max); -- approx*/DRAWFUNCTION(outRender, point, outNormal, angle, cache);} \
         else {\
             outRender = Vector4u((uchar)0); outZ = 0;\
         } \
@@ -198,60 +216,75 @@ PROCESS_AND_DRAW_PIXEL(renderGrey, drawPixelGrey)
 PROCESS_AND_DRAW_PIXEL(renderColourFromNormal, drawPixelNormal)
 
 
-/// Initializes raycastResult
-static void Common(
+/// Raycasts scene, \returns the raycastResult (in the voxel coordinates of scene), computed once the device is synchronized.
+/// Delete it and its image after that.
+static PointImage* Common(
+Scene* const scene,
 const ITMPose *pose,
 const ITMIntrinsics *intrinsics,
-const Vector2i imgSize
+const Vector2i imgSize,
+Vector3f& towardsCamera //!< [out] (negative camera z axis)
 ) {
+    assert(scene);
     assert(imgSize.area() > 1);
     auto raycastImage = new ITMFloat4Image(imgSize);
     auto invPose_M = pose->GetInvM();
     auto cameraCs = new CoordinateSystem(invPose_M);
-    raycastResult = new PointImage(
+    PointImage* const raycastResult = new PointImage(
         raycastImage,
-        voxelCoordinates,
+        scene->voxelCoordinateSystem,
 
         cameraCs,
         intrinsics->projectionParamsSimple.all
         );
 
-    // (negative camera z axis)
     towardsCamera = -Vector3f(invPose_M.getColumn(2));
 
-    forEachPixelNoImage<castRay>(imgSize);
+    switch (scene->params.blockSize_) {
+    case 8: { const castRay<8> cast = {scene, raycastResult}; forEachPixelNoImage(imgSize, cast); break; }
+    case 16: { const castRay<16> cast = {scene, raycastResult}; forEachPixelNoImage(imgSize, cast); break; }
+    default: assert(false); // see ITMSceneParams::check
+    }
+    return raycastResult;
 }
 
 CameraImage<Vector4u>* RenderImage(
+    const ITMContext& context,
     const ITMPose *pose,
     const ITMIntrinsics *intrinsics,
     const Vector2i imgSize,
     ITMFloatImage* const outDepth,
     std::string shader)
 {
+    assert(context.scene);
     assert(imgSize.area() > 1);
     assert(outDepth);
     assert(outDepth->noDims == imgSize);
-    ::outDepth = outDepth;
 
     auto outImage = new ITMUChar4Image(imgSize);
     auto outCs = new CoordinateSystem(pose->GetInvM());
-    outRendering = new CameraImage<Vector4u>(
+    RenderArguments a;
+    a.scene = context.scene;
+    a.outDepth = outDepth;
+    a.outRendering = new CameraImage<Vector4u>(
         outImage,
         outCs,
         intrinsics->projectionParamsSimple.all
         );
 
-    Common(pose, intrinsics, outRendering->imgSize());
-    cudaDeviceSynchronize(); // want to read imgSize
-
+    a.raycastResult = Common(a.scene, pose, intrinsics, imgSize, a.towardsCamera);
 
-#define isShader(s) if (shader == #s) {forEachPixelNoImage<s>(outRendering->imgSize());cudaDeviceSynchronize(); return outRendering;}
+    CameraImage<Vector4u>* result = nullptr;
+#define isShader(s) if (shader == #s) {forEachPixelNoImage(imgSize, s(a)); result = a.outRendering;}
     isShader(renderColour);
     isShader(renderColourFromNormal);
     isShader(renderGrey);
-    assert(false); // unkown shader
-    return nullptr;
+#undef isShader
+    assert(result); // unkown shader
+    cudaDeviceSynchronize();
+    delete a.raycastResult->image;
+    delete a.raycastResult;
+    return result;
 }
 
 /// Computing the surface normal in image space given raycasted image (raycastResult).
@@ -265,6 +298,9 @@ template <bool useSmoothing>
 GPU_ONLY inline void computeNormalImageSpace(
     THREADPTR(bool) & foundPoint, //!< [in,out] Set to false when the normal cannot be computed
     const THREADPTR(int) &x, const THREADPTR(int) &y,
+    const PointImage* const raycastResult, //!< [in]
+    const float voxelSize_, //!< of the scene raycastResult comes from
+    const Vector3f& towardsCamera, //!< [in] (negative camera z axis)
     THREADPTR(Vector3f) & outNormal
     )
 {
@@ -296,7 +332,7 @@ GPU_ONLY inline void computeNormalImageSpace(
 #define isAnyPointIllegal() (xp1_y.w <= 0 || x_yp1.w <= 0 || xm1_y.w <= 0 || x_ym1.w <= 0)
 
     float length_diff = MAX(length2(diff_x.toVector3()), length2(diff_y.toVector3()));
-    bool lengthDiffTooLarge = (length_diff * voxelSize * voxelSize > (0.15f * 0.15f));
+    bool lengthDiffTooLarge = (length_diff * voxelSize_ * voxelSize_ > (0.15f * 0.15f));
 
     if (isAnyPointIllegal() || (lengthDiffTooLarge && useSmoothing)) {
         if (!useSmoothing) { foundPoint = false; return; }
@@ -322,21 +358,26 @@ GPU_ONLY inline void computeNormalImageSpace(
 
 #define useSmoothing true
 
-static __managed__ RayImage* outIcpMap = 0;
-/// Produces a shaded image (outRendering) and a point cloud for e.g. tracking.
+/// Produces a point cloud (outIcpMap) for e.g. tracking from raycastResult.
 /// Uses image space normals.
 /// \param useSmoothing whether to compute normals by forward differences two pixels away (true) or just one pixel away (false)
 struct processPixelICP {
-    forEachPixelNoImage_process() {
+    const PointImage* raycastResult;
+    float voxelSize_; //!< of the scene raycastResult comes from
+    Vector3f towardsCamera;
+    //!< [out] receives output points in world coordinates
+    //!< [out] receives world space normals computed from points (image space)
+    RayImage* outIcpMap;
+
+    forEachPixelNoImage_process_member() {
         const Vector4f point = raycastResult->image->GetData()[locId];
-        assert(raycastResult->pointCoordinates == voxelCoordinates);
 
         bool foundPoint = point.w > 0.0f;
 
         Vector3f outNormal;
         // TODO could we use the world space normals here? not without change
         computeNormalImageSpace<useSmoothing>(
-            foundPoint, x, y, outNormal);
+            foundPoint, x, y, raycastResult, voxelSize_, towardsCamera, outNormal);
 
 #define pointsMap outIcpMap->image->GetData()
 #define normalsMap outIcpMap->normalImage->GetData()
@@ -348,7 +389,7 @@ struct processPixelICP {
         }
 
         // Convert point to world coordinates
-        pointsMap[locId] = Vector4f(point.toVector3() * voxelSize, 1);
+        pointsMap[locId] = Vector4f(point.toVector3() * voxelSize_, 1);
         // Normals are the same whether in world or voxel coordinates
         normalsMap[locId] = Vector4f(outNormal, 0);
 #undef pointsMap
@@ -370,52 +411,58 @@ void approxEqual(Matrix3f a, Matrix3f b, const float eps = 0.00001) {
         approxEqual(a.m[i], b.m[i], eps);
 }
 
-// 1. raycast scene from current viewpoint 
+// 1. raycast scene from the viewpoint of the view
 // to create point cloud for tracking
-RayImage * CreateICPMapsForCurrentView() {
-    assert(currentView);
+RayImage * CreateICPMaps(const ITMContext& context) {
+    ITMView* const view = context.view;
+    Scene* const scene = context.scene;
+    assert(view);
+    assert(scene);
 
-    auto imgSize_d = currentView->depthImage->imgSize();
+    auto imgSize_d = view->depthImage->imgSize();
     assert(imgSize_d.area() > 1);
     auto pointsMap = new ITMFloat4Image(imgSize_d);
     auto normalsMap = new ITMFloat4Image(imgSize_d);
 
-    assert(!outIcpMap);
-    outIcpMap = new RayImage(
+    processPixelICP icp;
+    icp.outIcpMap = new RayImage(
         pointsMap, 
         normalsMap,
         CoordinateSystem::global(),
 
-        currentView->depthImage->eyeCoordinates,
-        currentView->depthImage->cameraIntrinsics
+        view->depthImage->eyeCoordinates,
+        view->depthImage->cameraIntrinsics
         );
-
-    assert(Scene::getCurrentScene());
+    icp.voxelSize_ = scene->params.voxelSize_;
 
     // TODO reduce conversion friction
-    ITMPose pose; pose.SetM(currentView->depthImage->eyeCoordinates->fromGlobal);
+    ITMPose pose; pose.SetM(view->depthImage->eyeCoordinates->fromGlobal);
     ITMIntrinsics intrin; 
-    intrin.projectionParamsSimple.all = currentView->depthImage->cameraIntrinsics;
-    Common(
+    intrin.projectionParamsSimple.all = view->depthImage->cameraIntrinsics;
+    PointImage* const raycastResult = Common(
+        scene,
         &pose, //trackingState->pose_d,
         &intrin,
-        imgSize_d
+        imgSize_d,
+        icp.towardsCamera
         );
+    icp.raycastResult = raycastResult;
     cudaDeviceSynchronize(); 
 
-    approxEqual(raycastResult->eyeCoordinates->fromGlobal, currentView->depthImage->eyeCoordinates->fromGlobal);
-    assert(raycastResult->pointCoordinates == voxelCoordinates);
+    approxEqual(raycastResult->eyeCoordinates->fromGlobal, view->depthImage->eyeCoordinates->fromGlobal);
+    assert(raycastResult->pointCoordinates == scene->voxelCoordinateSystem);
 
     // Create ICP maps
-    forEachPixelNoImage<processPixelICP>(imgSize_d);
+    forEachPixelNoImage(imgSize_d, icp);
     cudaDeviceSynchronize();
+    delete raycastResult->image;
+    delete raycastResult;
 
     // defensive
-    assert(outIcpMap->eyeCoordinates == currentView->depthImage->eyeCoordinates);
-    assert(outIcpMap->pointCoordinates == CoordinateSystem::global());
-    assert(outIcpMap->imgSize() == imgSize_d);
-    assert(outIcpMap->normalImage->noDims == imgSize_d);
-    auto icpMap = outIcpMap;
-    outIcpMap = 0;
+    RayImage* const icpMap = icp.outIcpMap;
+    assert(icpMap->eyeCoordinates == view->depthImage->eyeCoordinates);
+    assert(icpMap->pointCoordinates == CoordinateSystem::global());
+    assert(icpMap->imgSize() == imgSize_d);
+    assert(icpMap->normalImage->noDims == imgSize_d);
     return icpMap;
 }
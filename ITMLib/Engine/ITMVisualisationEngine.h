@@ -15,14 +15,18 @@ operations.
 #include "ITMLibDefines.h"
 #include "ITMView.h"
 #include "ITMPose.h"
+#include "ITMContext.h"
     
 /** This will render an image using raycasting.
 TODO could render into a view*/
 CameraImage<Vector4u>* RenderImage(
+    const ITMContext& context, //!< the scene to render, view is not used
     const ITMPose *pose,
     const ITMIntrinsics *intrinsics,
     const Vector2i imgSize,
     ITMFloatImage* const outDepth,
     std::string shader);
 
-RayImage * CreateICPMapsForCurrentView();
\ No newline at end of file
+/// Raycasts context.scene from the viewpoint of the depth image of context.view,
+/// \returns the points (in world coordinates) and normals found, e.g. for tracking.
+RayImage * CreateICPMaps(const ITMContext& context);
\ No newline at end of file
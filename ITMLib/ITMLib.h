@@ -1,6 +1,7 @@
 #pragma once
 #include "Utils/ITMLibDefines.h"
 #include "Objects/ITMView.h"
+#include "Objects/ITMContext.h"
 #include "Engine/ITMLowLevelEngine.h"
 #include "Engine/ITMDepthTracker.h"
 #include "Engine/ITMSceneReconstructionEngine.h"
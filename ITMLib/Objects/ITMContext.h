@@ -0,0 +1,23 @@
+#pragma once
+#include "Scene.h"
+#include "ITMView.h"
+
+/** \brief
+What the engines (ImprovePose, Fuse, RenderImage) work on: the scene, with its ITMSceneParams, and the input view.
+
+The engines take it explicitly and pass the scene, the view and the scene parameters on to their kernels as arguments.
+Their scratch data (counters, raycast results, tracking levels) belongs to the call, so engines with different contexts
+can run at the same time on several threads, e.g. one ITMMainEngine per sequence on a thread pool.
+
+The host reads and writes managed memory between kernels (counters, the hash maps' request counts), which only works
+while kernels of other threads run on devices with cudaDevAttrConcurrentManagedAccess.
+*/
+struct ITMContext {
+    Scene* scene;
+    /// NULL when only rendering
+    ITMView* view;
+
+    ITMContext(Scene* const scene, ITMView* const view) : scene(scene), view(view) {
+        assert(scene);
+    }
+};
@@ -0,0 +1,66 @@
+#pragma once
+// included by ITMLibSettings.h, after the defaults
+
+/** \brief
+Parameters of a Scene that are chosen at runtime, so that the same binary can map a large area coarsely
+or scan an object finely. They are fixed for the lifetime of the Scene, see Scene::params.
+
+The engines take the scene and pass its params to their kernels by value,
+so scenes with different parameters can be processed at the same time.
+
+Plain old data.
+*/
+struct ITMSceneParams {
+    /// Size of a voxel, in world space coordinates (meters)
+    float voxelSize_;
+    /// Width of the band of the truncated signed distance transform (on each side of the surface), in world space coordinates.
+    /// A voxel storing the value 1 has world-space-distance mu from the surface.
+    float mu_;
+    /// Size of the thin shell region for volumetric refinement-from-shading computation, in world space coordinates
+    float t_shell_;
+    /// Up to maxW observations per voxel are averaged, beyond that a sliding average is computed.
+    int maxW_;
+    /// Fallback depth range, in world space coordinates
+    float viewFrustum_min_, viewFrustum_max_;
+    /// Side length, in voxels, of the blocks that Fuse allocates at once and that the raycast steps over where nothing is allocated:
+    /// 8 or 16, the engines have a specialization for each (see ITMSceneReconstructionEngine.cu and ITMVisualisationEngine.cu).
+    /// The voxels are stored in voxel blocks of SDF_BLOCK_SIZE, a block of 16 is made of 2x2x2 of them.
+    /// Larger blocks need fewer allocation requests and longer steps through empty space, but allocate more voxels around the surface.
+    int blockSize_;
+
+    /// Side length of a voxel block (SDF_BLOCK_SIZE voxels), in world space coordinates
+    CPU_AND_GPU float voxelBlockSize() const {
+        return voxelSize_ * SDF_BLOCK_SIZE;
+    }
+
+    /// Number of voxel blocks along each axis of a block of blockSize_ voxels
+    CPU_AND_GPU int voxelBlocksPerBlock() const {
+        return blockSize_ / SDF_BLOCK_SIZE;
+    }
+
+    /// defaultVoxelSize, defaultMu etc.
+    static ITMSceneParams defaults() {
+        ITMSceneParams p = {defaultVoxelSize, defaultMu, defaultMu / 2.f, defaultMaxW, defaultViewFrustum_min, defaultViewFrustum_max, defaultBlockSize};
+        return p;
+    }
+
+    /// The defaults, with mu and t_shell scaled to keep their ratio to the voxel size
+    static ITMSceneParams forVoxelSize(const float voxelSize) {
+        ITMSceneParams p = defaults();
+        p.mu_ *= voxelSize / p.voxelSize_;
+        p.t_shell_ *= voxelSize / p.voxelSize_;
+        p.voxelSize_ = voxelSize;
+        return p;
+    }
+
+    /// Asserts what the engines rely on
+    void check() const {
+        assert(voxelSize_ > 0);
+        assert(mu_ > voxelSize_ * 2);
+        assert(t_shell_ < mu_);
+        assert(maxW_ > 0 && maxW_ <= 255); // stored in uchar weights
+        assert(viewFrustum_min_ > 0 && viewFrustum_min_ < viewFrustum_max_);
+        assert(blockSize_ == 8 || blockSize_ == 16);
+        assert(blockSize_ % SDF_BLOCK_SIZE == 0);
+    }
+};
@@ -17,10 +17,6 @@
 #include "ITMCalibIO.h"
 #include "cameraimage.h"
 
-class ITMView;
-#ifndef ITMVIEW_ // AVOID "MULTIPLE DEFINITION"
-extern __managed__ ITMView * currentView; 
-#endif
 /** \brief
 	Represents a single "view", i.e. RGB and depth images along
 	with all intrinsic, relative and extrinsic calibration information
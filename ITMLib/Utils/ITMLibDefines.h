@@ -9,6 +9,8 @@
 // Voxel Hashing definition and helper functions
 //////////////////////////////////////////////////////////////////////////
 
+/// Side length of a voxel block, in voxels: the unit in which the voxels are stored, hashed and dumped.
+/// Fuse and the raycast work on blocks of ITMSceneParams::blockSize_ voxels, chosen per scene at runtime, a multiple of this.
 #define SDF_BLOCK_SIZE 8
 #define SDF_BLOCK_SIZE3 (SDF_BLOCK_SIZE * SDF_BLOCK_SIZE * SDF_BLOCK_SIZE)
 
@@ -21,6 +23,10 @@
 #define SDF_HASH_MASK (SDF_BUCKET_NUM-1)// Used for get hashing value of the bucket index, "x & (uint)SDF_HASH_MASK" is the same as "x % SDF_BUCKET_NUM"
 #define SDF_EXCESS_LIST_SIZE 0x20000	// Size of excess list, used to handle collisions. Also max offset (unsigned short) value.
 
+// The voxel block hash of a Scene starts out this small and grows up to SDF_BUCKET_NUM buckets and any excess list size as needed
+#define SDF_INITIAL_BUCKET_NUM 0x4000	// must be 2^n
+#define SDF_INITIAL_EXCESS_LIST_SIZE 0x1000
+
 #define SDF_GLOBAL_BLOCK_NUM (SDF_BUCKET_NUM+SDF_EXCESS_LIST_SIZE)	// Number of globally stored blocks == size of ordered + unordered part of hash table
 
 
@@ -91,24 +97,75 @@ struct ITMHashEntry
     }
 };
 
+/// Which voxel type ITMVoxel is, chosen at compile time:
+/// 1: ITMVoxel_s_rgb, with colour and albedo (12 bytes).
+/// 0: ITMVoxel_s, only SDF and depth weight (4 bytes), for depth-only reconstruction.
+/// Colour integration, colour rendering and lighting estimation need colour (renderColour falls back to grey shading).
+#ifndef VOXEL_HAS_COLOR
+#define VOXEL_HAS_COLOR 1
+#endif
+
+class ITMVoxelSoARef;
+
+/** \brief
+    Stores the signed distance of a single voxel in the volume, without colour
+*/
+class ITMVoxel_s
+{
+private:
+    // signed distance
+    short sdf;  // saving storage
+    friend class ITMVoxelSoARef;
+public:
+    static const bool hasColorInformation = false;
+
+    /** Value of the truncated signed distance transformation, in [-1, 1] (scaled by truncation mu when storing) */
+    CPU_AND_GPU void setSDF_initialValue() { sdf = 32767; }
+    CPU_AND_GPU float getSDF() const { return decodeSDF(sdf); }
+    CPU_AND_GPU void setSDF(float x) { sdf = encodeSDF(x); }
+
+    /// Conversion between the stored and the [-1, 1] signed distance, also used by ITMVoxelSoARef
+    static CPU_AND_GPU float decodeSDF(short sdf) { return (float)(sdf) / 32767.0f; }
+    static CPU_AND_GPU short encodeSDF(float x) {
+        assert(x >= -1 && x <= 1);
+        return (short)((x)* 32767.0f);
+    }
+
+    /** Number of fused observations that make up @p sdf. */
+    uchar w_depth;
+
+    GPU_ONLY ITMVoxel_s()
+    {
+        setSDF_initialValue();
+        w_depth = 0;
+    }
+};
+
 // #define USE_FLOAT_SDF_STORAGE // uses 4 instead of 2 bytes
 /** \brief
     Stores the information of a single voxel in the volume
 */
-class ITMVoxel
+class ITMVoxel_s_rgb
 {   
 private:
     // signed distance
     short sdf;  // saving storage
+    friend class ITMVoxelSoARef;
 public:
     /** Value of the truncated signed distance transformation, in [-1, 1] (scaled by truncation mu when storing) */
 	CPU_AND_GPU void setSDF_initialValue() { sdf = 32767; }
-    CPU_AND_GPU float getSDF() const { return (float)(sdf) / 32767.0f; }
-    CPU_AND_GPU void setSDF(float x) {
+    CPU_AND_GPU float getSDF() const { return decodeSDF(sdf); }
+    CPU_AND_GPU void setSDF(float x) { sdf = encodeSDF(x); }
+
+    /// Conversion between the stored and the [-1, 1] signed distance, also used by ITMVoxelSoARef
+    static CPU_AND_GPU float decodeSDF(short sdf) { return (float)(sdf) / 32767.0f; }
+    static CPU_AND_GPU short encodeSDF(float x) {
         assert(x >= -1 && x <= 1);
-        sdf = (short)((x)* 32767.0f);
+        return (short)((x)* 32767.0f);
     }
 
+    static const bool hasColorInformation = true;
+
 	/** Number of fused observations that make up @p sdf. */
 	uchar w_depth;
 
@@ -139,7 +196,7 @@ public:
     }
 
     // NOTE not used inially when memory is just allocated and reinterpreted, but used on each allocation
-    GPU_ONLY ITMVoxel()
+    GPU_ONLY ITMVoxel_s_rgb()
 	{
         setSDF_initialValue();
 		w_depth = 0;
@@ -151,22 +208,211 @@ public:
 	}
 };
 
+static_assert(sizeof(ITMVoxel_s) == 4, "depth-only voxel should be 4 bytes");
+static_assert(sizeof(ITMVoxel_s_rgb) == 12, "colour voxel should be 12 bytes");
+
+#if VOXEL_HAS_COLOR
+typedef ITMVoxel_s_rgb ITMVoxel;
+#else
+typedef ITMVoxel_s ITMVoxel;
+#endif
+
+/// Memory layout of ITMVoxelBlock, chosen at compile time:
+/// 0: array of ITMVoxel structs.
+/// 1: structure of arrays, one contiguous plane of SDF_BLOCK_SIZE3 values per voxel field, so that
+/// reading only the SDF (as raycasting does) does not load the other fields, and threads working on consecutive voxels
+/// access consecutive addresses.
+/// Either way voxels are accessed through ITMVoxelBlock::getVoxel, which returns an ITMVoxelPtr.
+#ifndef VOXEL_BLOCK_SOA
+#define VOXEL_BLOCK_SOA 0
+#endif
+
+/// Index of the voxel at localPos within its block
+CPU_AND_GPU inline int voxelLocalId(const Vector3i& localPos) {
+    assert(localPos.x >= 0 && localPos.x < SDF_BLOCK_SIZE);
+    assert(localPos.y >= 0 && localPos.y < SDF_BLOCK_SIZE);
+    assert(localPos.z >= 0 && localPos.z < SDF_BLOCK_SIZE);
+    return localPos.x + localPos.y * SDF_BLOCK_SIZE + localPos.z * SDF_BLOCK_SIZE * SDF_BLOCK_SIZE;
+}
+
+#if VOXEL_BLOCK_SOA
+struct ITMVoxelBlock;
+
+/**
+Reference to one voxel of an ITMVoxelBlock in structure of arrays layout.
+Has the interface of ITMVoxel; reading or writing a field touches only that field's plane.
+Assigning an ITMVoxel (or another reference) writes all fields, like assigning through an ITMVoxel&.
+*/
+class ITMVoxelSoARef {
+public:
+    CPU_AND_GPU ITMVoxelSoARef(ITMVoxelBlock* const block, const int i) : block(block), i(i) {}
+    CPU_AND_GPU ITMVoxelSoARef(const ITMVoxelSoARef& o) : block(o.block), i(o.i) {}
+
+    CPU_AND_GPU float getSDF() const;
+    CPU_AND_GPU void setSDF(float x) const;
+    CPU_AND_GPU void setSDF_initialValue() const { setSDF(1.f); }
+
+    CPU_AND_GPU uchar getWDepth() const;
+    CPU_AND_GPU void setWDepth(uchar w) const;
+    __declspec(property(get = getWDepth, put = setWDepth)) uchar w_depth;
+
+#if VOXEL_HAS_COLOR
+    CPU_AND_GPU Vector3u getClr() const;
+    CPU_AND_GPU void setClr(Vector3u c) const;
+    __declspec(property(get = getClr, put = setClr)) Vector3u clr;
+
+    CPU_AND_GPU uchar getWColor() const;
+    CPU_AND_GPU void setWColor(uchar w) const;
+    __declspec(property(get = getWColor, put = setWColor)) uchar w_color;
+
+    CPU_AND_GPU float getLuminanceAlbedo() const;
+    CPU_AND_GPU void setLuminanceAlbedo(float a) const;
+    __declspec(property(get = getLuminanceAlbedo, put = setLuminanceAlbedo)) float luminanceAlbedo;
+
+    GPU_ONLY float intensity() const { return ((ITMVoxel)*this).intensity(); }
+#endif
+
+    GPU_ONLY operator ITMVoxel() const;
+    CPU_AND_GPU const ITMVoxelSoARef& operator=(const ITMVoxel& v) const;
+    CPU_AND_GPU const ITMVoxelSoARef& operator=(const ITMVoxelSoARef& o) const {
+        return *this = (ITMVoxel)o;
+    }
+
+private:
+    friend class ITMVoxelSoAPtr;
+    ITMVoxelBlock* block;
+    int i;
+};
+
+/// Pointer-like handle to an ITMVoxelSoARef, NULL when block is NULL
+class ITMVoxelSoAPtr {
+public:
+    CPU_AND_GPU ITMVoxelSoAPtr(ITMVoxelBlock* const block = NULL, const int i = 0) : ref(block, i) {}
+    CPU_AND_GPU ITMVoxelSoAPtr(const ITMVoxelSoAPtr& o) : ref(o.ref) {}
+    CPU_AND_GPU ITMVoxelSoAPtr& operator=(const ITMVoxelSoAPtr& o) {
+        ref.block = o.ref.block; // rebind, does not copy voxels
+        ref.i = o.ref.i;
+        return *this;
+    }
+
+    CPU_AND_GPU const ITMVoxelSoARef* operator->() const { return &ref; }
+    CPU_AND_GPU const ITMVoxelSoARef& operator*() const { return ref; }
+    CPU_AND_GPU explicit operator bool() const { return ref.block != NULL; }
+    CPU_AND_GPU bool operator==(const ITMVoxelSoAPtr& o) const { return ref.block == o.ref.block && (!ref.block || ref.i == o.ref.i); }
+    CPU_AND_GPU bool operator!=(const ITMVoxelSoAPtr& o) const { return !(*this == o); }
+
+private:
+    ITMVoxelSoARef ref;
+};
+
+typedef ITMVoxelSoAPtr ITMVoxelPtr;
+/// Parameter type for functions updating a voxel in place
+typedef ITMVoxelSoARef ITMVoxelRef;
+
+struct ITMVoxelBlock {
+    GPU_ONLY void resetVoxels() {
+        for (int i = 0; i < SDF_BLOCK_SIZE3; i++) ITMVoxelSoARef(this, i) = ITMVoxel();
+    }
+
+    CPU_AND_GPU ITMVoxelPtr getVoxel(Vector3i localPos) {
+        return ITMVoxelPtr(this, voxelLocalId(localPos));
+    }
+
+    /// Copies voxel i of from to voxel i of this
+    CPU_AND_GPU void copyVoxel(const int i, const ITMVoxelBlock& from) {
+        sdf[i] = from.sdf[i];
+        w_depth[i] = from.w_depth[i];
+#if VOXEL_HAS_COLOR
+        clr[i] = from.clr[i];
+        w_color[i] = from.w_color[i];
+        luminanceAlbedo[i] = from.luminanceAlbedo[i];
+#endif
+    }
+
+    CPU_AND_GPU VoxelBlockPos getPos() const {
+        return pos_;
+    }
+
+    __declspec(property(get = getPos)) VoxelBlockPos pos;
+
+    /// Initialize pos and reset data
+    GPU_ONLY void reinit(VoxelBlockPos pos) {
+        pos_ = pos;
+        resetVoxels();
+    }
+
+//private:
+    /// pos is Mutable, 
+    /// because this voxel block might represent any part of space
+    VoxelBlockPos pos_;
+
+    // planes, indexed by voxelLocalId
+    short sdf[SDF_BLOCK_SIZE3];
+    uchar w_depth[SDF_BLOCK_SIZE3];
+#if VOXEL_HAS_COLOR
+    Vector3u clr[SDF_BLOCK_SIZE3];
+    uchar w_color[SDF_BLOCK_SIZE3];
+    float luminanceAlbedo[SDF_BLOCK_SIZE3];
+#endif
+};
+
+CPU_AND_GPU inline float ITMVoxelSoARef::getSDF() const { return ITMVoxel::decodeSDF(block->sdf[i]); }
+CPU_AND_GPU inline void ITMVoxelSoARef::setSDF(float x) const { block->sdf[i] = ITMVoxel::encodeSDF(x); }
+CPU_AND_GPU inline uchar ITMVoxelSoARef::getWDepth() const { return block->w_depth[i]; }
+CPU_AND_GPU inline void ITMVoxelSoARef::setWDepth(uchar w) const { block->w_depth[i] = w; }
+#if VOXEL_HAS_COLOR
+CPU_AND_GPU inline Vector3u ITMVoxelSoARef::getClr() const { return block->clr[i]; }
+CPU_AND_GPU inline void ITMVoxelSoARef::setClr(Vector3u c) const { block->clr[i] = c; }
+CPU_AND_GPU inline uchar ITMVoxelSoARef::getWColor() const { return block->w_color[i]; }
+CPU_AND_GPU inline void ITMVoxelSoARef::setWColor(uchar w) const { block->w_color[i] = w; }
+CPU_AND_GPU inline float ITMVoxelSoARef::getLuminanceAlbedo() const { return block->luminanceAlbedo[i]; }
+CPU_AND_GPU inline void ITMVoxelSoARef::setLuminanceAlbedo(float a) const { block->luminanceAlbedo[i] = a; }
+#endif
+
+GPU_ONLY inline ITMVoxelSoARef::operator ITMVoxel() const {
+    ITMVoxel v;
+    v.sdf = block->sdf[i];
+    v.w_depth = block->w_depth[i];
+#if VOXEL_HAS_COLOR
+    v.clr = block->clr[i];
+    v.w_color = block->w_color[i];
+    v.luminanceAlbedo = block->luminanceAlbedo[i];
+#endif
+    return v;
+}
+
+CPU_AND_GPU inline const ITMVoxelSoARef& ITMVoxelSoARef::operator=(const ITMVoxel& v) const {
+    block->sdf[i] = v.sdf;
+    block->w_depth[i] = v.w_depth;
+#if VOXEL_HAS_COLOR
+    block->clr[i] = v.clr;
+    block->w_color[i] = v.w_color;
+    block->luminanceAlbedo[i] = v.luminanceAlbedo;
+#endif
+    return *this;
+}
+
+#else
+
+typedef ITMVoxel* ITMVoxelPtr;
+/// Parameter type for functions updating a voxel in place
+typedef ITMVoxel& ITMVoxelRef;
+
 struct ITMVoxelBlock {
     GPU_ONLY void resetVoxels() {
         for (auto& i : blockVoxels) i = ITMVoxel();
     }
     /// compute voxelLocalId to access blockVoxels
-    GPU_ONLY ITMVoxel* getVoxel(Vector3i localPos) {
-        assert(localPos.x >= 0 && localPos.x < SDF_BLOCK_SIZE);
-        assert(localPos.y >= 0 && localPos.y < SDF_BLOCK_SIZE);
-        assert(localPos.z >= 0 && localPos.z < SDF_BLOCK_SIZE);
+    CPU_AND_GPU ITMVoxelPtr getVoxel(Vector3i localPos) {
+        return &blockVoxels[voxelLocalId(localPos)];
+    }
 
-        return &blockVoxels[
-            localPos.x + localPos.y * SDF_BLOCK_SIZE + localPos.z * SDF_BLOCK_SIZE * SDF_BLOCK_SIZE
-        ];
+    /// Copies voxel i of from to voxel i of this
+    CPU_AND_GPU void copyVoxel(const int i, const ITMVoxelBlock& from) {
+        blockVoxels[i] = from.blockVoxels[i];
     }
 
-    GPU_ONLY VoxelBlockPos getPos() const {
+    CPU_AND_GPU VoxelBlockPos getPos() const {
         return pos_;
     }
 
@@ -187,6 +433,7 @@ struct ITMVoxelBlock {
 
     ITMVoxel blockVoxels[SDF_BLOCK_SIZE3];
 };
+#endif
 
 
 /// The tracker iteration type used to define the tracking iteration regime
@@ -220,11 +467,8 @@ enum TrackerIterationType
 
 #include "CoordinateSystem.h"
 
-/// (0,0,0) is the lower corner of the first voxel block, (1,1,1) its upper corner,
-/// corresponding to (voxelBlockSize, voxelBlockSize, voxelBlockSize) in world coordinates.
-extern __managed__ CoordinateSystem* voxelBlockCoordinates;
-
-/// (0,0,0) is the lower corner of the voxel, (1,1,1) its upper corner,
-/// corresponding to (voxelSize, voxelSize, voxelSize) in world coordinates.
-extern __managed__ CoordinateSystem* voxelCoordinates;
-extern void initCoordinateSystems();
+/// The voxel block coordinates for the given voxel size: (0,0,0) is the lower corner of the first voxel block, (1,1,1) its upper corner.
+/// And the voxel coordinates: (0,0,0) is the lower corner of the voxel, (1,1,1) its upper corner,
+/// corresponding to (voxelSize_, voxelSize_, voxelSize_) in world coordinates.
+/// Created on first use, scenes with the same voxel size share them (see Scene::voxelCoordinateSystem). Thread safe.
+extern void getVoxelCoordinateSystems(float voxelSize_, CoordinateSystem*& voxelBlockCoordinates_, CoordinateSystem*& voxelCoordinates_);
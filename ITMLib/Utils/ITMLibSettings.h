@@ -8,48 +8,55 @@
 /// For ITMDepthTracker: ICP iteration termination threshold
 #define depthTrackerTerminationThreshold 1e-3f
 /** @} */
-/** \brief
-Encodes the width of the band of the truncated
-signed distance transform that is actually stored
-in the volume. This is again usually specified in
-meters (world coordinates). 
-Note that thus, the resulting width in voxels is @ref mu
-divided by @ref voxelSize (times two -> on both sides of the surface).
-Also, a voxel storing the value 1 has world-space-distance mu from the surface.
-
-Must be greater than voxelSize.
-
-TODO define from voxelSize
-*/
-#define mu 0.02f
-
-/**
-Size of the thin shell region for volumetric refinement-from-shading computation.
-Must be smaller than mu and should be bigger than voxelSize
-
-In world space coordinates (meters).
-*/
-#define t_shell (mu/2.f)
-
-/** \brief
-Up to @ref maxW observations per voxel are averaged.
-Beyond that a sliding average is computed.
-*/
-#define maxW 100
-/// Size of a voxel, usually given in meters.
-/// In world space coordinates. 
-#define voxelSize 0.005f
-#define oneOverVoxelSize (1.0f / voxelSize)
-/// In world space coordinates.
-#define voxelBlockSize (voxelSize*SDF_BLOCK_SIZE)
-#define oneOverVoxelBlockWorldspaceSize (1.0f / (voxelBlockSize))
-/** @{ */
-/** \brief
-Fallback parameters: consider only parts of the
-scene from @p viewFrustum_min in front of the camera
-to a distance of @p viewFrustum_max (world-space distance). Usually the
-actual depth range should be determined
-automatically by a ITMLib::Engine::ITMVisualisationEngine.
-*/
-#define viewFrustum_min 0.2f
-#define viewFrustum_max 3.0f
+/// Defaults of ITMSceneParams, see there. Each Scene has its own.
+#define defaultMu 0.02f
+#define defaultMaxW 100
+#define defaultVoxelSize 0.005f
+#define defaultViewFrustum_min 0.2f
+#define defaultViewFrustum_max 3.0f
+#define defaultBlockSize 8
+
+#include "ITMSceneParams.h"
+
+/// Every that many frames, ITMMainEngine::ProcessFrame stores the voxel blocks in Morton order, see Scene::relayoutVoxelBlocks.
+/// 0 disables this.
+#define voxelBlockRelayoutInterval 0
+
+/// ITMMainEngine::ProcessFrame swaps out the voxel blocks not seen for more than that many frames, see Scene::swapOutUnseenVoxelBlocks.
+/// 0 disables this.
+#define voxelBlockSwapOutFrames 0
+
+/// Number of swapped out voxel blocks kept in host memory, more go to disk, see VoxelBlockStore.
+#define hostVoxelBlockCapacity 0x20000
+
+/// ITMMainEngine::ProcessFrame compresses the uniform voxel blocks not seen for more than that many frames, see Scene::compressUniformVoxelBlocks.
+/// 0 disables this.
+#define uniformVoxelBlockCompressionFrames 0
+
+/// Number of distinct values the uniform voxel blocks of a Scene can have, at most 256.
+#define uniformVoxelBlockPaletteSize 64
+
+/// Number of resolution levels of the scene of ITMMainEngine, see Scene::createMultiResolution. 1 disables this.
+#define multiResolutionLevels 1
+
+/// Depth below which the finest level of a multi-resolution scene is used, in world space coordinates.
+/// Each further level takes twice that range.
+#define multiResolutionFirstLevelMaxDepth 1.5f
+
+/// ITMMainEngine::ProcessFrame drops the voxel blocks farther than that from the camera along any axis (world space coordinates),
+/// see Scene::crop, so that the scene follows a moving camera in bounded memory. 0 disables this.
+#define rollingWindowRadius 0.f
+
+/// 1: ITMMainEngine::ProcessFrame fuses on the cpu (FuseOnCPU) instead of the gpu (Fuse).
+#define fuseOnCPU 0
+
+/// How the allocation pass of Fuse finds the voxel blocks in the truncation band of a depth sample:
+/// 0 walks through them exactly, each once (Scene::forEachVoxelBlockOnSegment),
+/// n > 0 samples the band n times per block length (ITMSceneParams::blockSize_), as before with 2, which visits most blocks more than once.
+/// Build with ALLOCATION_SAMPLES_PER_BLOCK=2 to compare, see benchmarkAllocationRequests.
+#ifndef ALLOCATION_SAMPLES_PER_BLOCK
+#define ALLOCATION_SAMPLES_PER_BLOCK 0
+#endif
+
+/// Number of voxel blocks a VoxelBlockPool maps at once, must be 2^n.
+#define voxelBlockPoolChunkSize 0x1000
@@ -6,6 +6,8 @@
 #include "Scene.h"
 #include "itmrepresentationaccess.h" 
 #include "constructAndSolve.h"
+
+#if VOXEL_HAS_COLOR // lighting is estimated from the colour of the voxels
 /*
 
 #include "matrix.h"
@@ -23,6 +25,10 @@ struct ConstructLightingModelEquationRow {
     // Amount of columns, should be small
     static const unsigned int m = LightingModel::b2;
 
+    /// whose voxels are the rows
+    Scene* scene;
+    ITMSceneParams params;
+
     /*not really needed */
     struct ExtraData {
         // User specified payload to be summed up alongside:
@@ -44,12 +50,11 @@ struct ConstructLightingModelEquationRow {
     /// should be executed with (blockIdx.x/2) == valid localVBA index (0 ignored) 
     /// annd blockIdx.y,z from 0 to 1 (parts of one block)
     /// and threadIdx <==> voxel localPos / 2..
-    static GPU_ONLY bool generate(const uint i, VectorX<float, m>& out_ai, float& out_bi/*[1]*/, ExtraData& extra_count /*not really needed */) {
+    GPU_ONLY bool generate(const uint i, VectorX<float, m>& out_ai, float& out_bi/*[1]*/, ExtraData& extra_count /*not really needed */) const {
         const uint blockSequenceId = blockIdx.x/2;
         if (blockSequenceId == 0) return false; // unused
-        assert(blockSequenceId < SDF_LOCAL_BLOCK_NUM);
 
-        assert(blockSequenceId < Scene::getCurrentScene()->voxelBlockHash->getLowestFreeSequenceNumber());
+        assert(blockSequenceId < scene->voxelBlockHash->getLowestFreeSequenceNumber());
 
         assert(threadIdx.x < SDF_BLOCK_SIZE / 2 && 
             threadIdx.y < SDF_BLOCK_SIZE / 2 &&
@@ -67,9 +72,10 @@ struct ConstructLightingModelEquationRow {
             localPos.y < SDF_BLOCK_SIZE &&
             localPos.z < SDF_BLOCK_SIZE );
 
-        ITMVoxelBlock* voxelBlock = Scene::getCurrentScene()->getVoxelBlockForSequenceNumber(blockSequenceId);
+        ITMVoxelBlock* voxelBlock = scene->getVoxelBlockForSequenceNumber(blockSequenceId);
+        if (voxelBlock->pos == INVALID_VOXEL_BLOCK_POS) return false; // removed
 
-        const ITMVoxel* voxel = voxelBlock->getVoxel(localPos);
+        const ITMVoxelPtr voxel = voxelBlock->getVoxel(localPos);
         const Vector3i globalPos = (voxelBlock->pos.toInt() * SDF_BLOCK_SIZE + localPos);
         /*
         const Vector3i globalPos = vb->pos.toInt() * SDF_BLOCK_SIZE;
@@ -82,15 +88,17 @@ struct ConstructLightingModelEquationRow {
         .toFloat();
         Vector3f worldPos = CoordinateSystems::global()->convert(globalPos);
         */
-        const float worldSpaceDistanceToSurface = abs(voxel->getSDF() * mu);
-        assert(worldSpaceDistanceToSurface <= mu);
+        const float worldSpaceDistanceToSurface = abs(voxel->getSDF() * params.mu_);
+        assert(worldSpaceDistanceToSurface <= params.mu_);
 
         // Is this voxel within the truncation band? Otherwise discard this term (as unreliable for lighting calculation)
-        if (worldSpaceDistanceToSurface > t_shell) return false;
+        if (worldSpaceDistanceToSurface > params.t_shell_) return false;
 
         // return if we cannot compute the normal
         bool found = true;
-        const Vector3f normal = computeSingleNormalFromSDFByForwardDifference(globalPos, found);
+        VoxelBlockCache cache(scene);
+        cache.insert(voxelBlock); // most of the neighbours are in here
+        const Vector3f normal = computeSingleNormalFromSDFByForwardDifference(globalPos, found, cache);
         if (!found) return false;
         assert(abs(length(normal) - 1) < 0.01);
 
@@ -112,11 +120,11 @@ struct ConstructLightingModelEquationRow {
 
 // todo should we really discard the existing lighting model the next time? maybe we could use it as an initialization
 // when solving
-LightingModel estimateLightingModel() {
-    assert(Scene::getCurrentScene());
+LightingModel estimateLightingModel(Scene* const scene) {
+    assert(scene);
     // Maximum number of entries
 
-    const int validBlockNum = Scene::getCurrentScene()->voxelBlockHash->getLowestFreeSequenceNumber();
+    const int validBlockNum = scene->voxelBlockHash->getLowestFreeSequenceNumber();
 
     auto gridDim = dim3(validBlockNum * 2, 2, 2); 
     auto blockDim = dim3(SDF_BLOCK_SIZE / 2, SDF_BLOCK_SIZE / 2, SDF_BLOCK_SIZE / 2); // cannot use full SDF_BLOCK_SIZE: too much shared data (in reduction)
@@ -125,7 +133,8 @@ LightingModel estimateLightingModel() {
     assert(n == volume(gridDim) * volume(blockDim));
 
     ConstructLightingModelEquationRow::ExtraData extra_count;
-    auto l_harmonicCoefficients = constructAndSolve<ConstructLightingModelEquationRow>(n, gridDim, blockDim, extra_count);
+    const ConstructLightingModelEquationRow constructor = {scene, scene->params};
+    auto l_harmonicCoefficients = constructAndSolve(constructor, n, gridDim, blockDim, extra_count);
     assert(extra_count.count <= n); // sanity check
     assert(l_harmonicCoefficients.size() == LightingModel::b2);
 
@@ -137,6 +146,7 @@ LightingModel estimateLightingModel() {
     return lightingModel;
 }
 
-void estimateLightingModel_() {
-    estimateLightingModel();
-}
\ No newline at end of file
+void estimateLightingModel_(Scene* const scene) {
+    estimateLightingModel(scene);
+}
+#endif
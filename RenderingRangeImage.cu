@@ -1,20 +1,23 @@
 #include "itmlibdefines.h"
 #include "itmpose.h"
-
-static __managed__ Matrix4f pose_global_to_eye;
-static __managed__ Vector4f intrinsics;
-static __managed__ Vector2i imgSize;
-static __managed__ ITMFloatImage* zmins;
-static __managed__ ITMFloatImage* zmaxs;
+#include "scene.h"
 
 class RenderingRangeImage {
 public:
-    void build(ITMPose pose, Vector4f intrinsics, Vector2i imgSize);
+    RenderingRangeImage() : zmins(0), zmaxs(0) {}
+    ~RenderingRangeImage() {
+        delete zmins;
+        delete zmaxs;
+    }
+    /// Of the allocated voxel blocks of scene, seen with the given camera
+    void build(Scene* scene, ITMPose pose, Vector4f intrinsics, Vector2i imgSize);
 
 private:
     void save(std::string baseFilename);
     // TODO combine into one image
-
+    ITMFloatImage* zmins;
+    ITMFloatImage* zmaxs;
+    Vector2i imgSize;
 };
 
 #include "fileutils.h"
@@ -82,25 +85,28 @@ void RenderingRangeImage::save(std::string baseFilename) {
 }
 #include "itmpixelutils.h"
 struct InitZ {
-    forEachPixelNoImage_process() {
-        zmins->GetData()[locId] = viewFrustum_min;
-        zmaxs->GetData()[locId] = viewFrustum_max;
+    ITMFloatImage* zmins;
+    ITMFloatImage* zmaxs;
+    ITMSceneParams params;
+
+    forEachPixelNoImage_process_member() {
+        zmins->GetData()[locId] = params.viewFrustum_min_;
+        zmaxs->GetData()[locId] = params.viewFrustum_max_;
     }
 };
 
-#include "scene.h"
-
 GPU_ONLY inline bool ProjectSingleBlock(
     const THREADPTR(Vector3s) & blockPos,
     
     const THREADPTR(Matrix4f) & pose, const THREADPTR(Vector4f) & intrinsics, const THREADPTR(Vector2i) & imgSize, 
+    const ITMSceneParams& params,
     
     THREADPTR(Vector2i) & upperLeft, THREADPTR(Vector2i) & lowerRight, THREADPTR(Vector2f) & zRange
     )
 {
     upperLeft = imgSize;
     lowerRight = Vector2i(-1, -1);
-    zRange = Vector2f(viewFrustum_max, viewFrustum_min);
+    zRange = Vector2f(params.viewFrustum_max_, params.viewFrustum_min_);
     for (int corner = 0; corner < 8; ++corner)
     {
         // project all 8 corners down to 2D image
@@ -108,7 +114,7 @@ GPU_ONLY inline bool ProjectSingleBlock(
         tmp.x += (corner & 1) ? 1 : 0;
         tmp.y += (corner & 2) ? 1 : 0;
         tmp.z += (corner & 4) ? 1 : 0;
-        Vector4f pt3d(TO_FLOAT3(tmp) * (float)SDF_BLOCK_SIZE * voxelSize, 1.0f);
+        Vector4f pt3d(TO_FLOAT3(tmp) * (float)SDF_BLOCK_SIZE * params.voxelSize_, 1.0f);
         pt3d = pose * pt3d;
         if (pt3d.z < 1e-6) continue;
 
@@ -133,20 +139,27 @@ GPU_ONLY inline bool ProjectSingleBlock(
     if (upperLeft.x > lowerRight.x) return false;
     if (upperLeft.y > lowerRight.y) return false;
     //if (zRange.y <= VERY_CLOSE) return false; never seems to happen
-    if (zRange.x < viewFrustum_min) zRange.x = viewFrustum_min;
-    if (zRange.y < viewFrustum_min) return false;
+    if (zRange.x < params.viewFrustum_min_) zRange.x = params.viewFrustum_min_;
+    if (zRange.y < params.viewFrustum_min_) return false;
 
     return true;
 }
 
 struct DetermineBlockExtents {
-    doForEachAllocatedVoxelBlock_process() {
+    Matrix4f pose_global_to_eye;
+    Vector4f intrinsics;
+    Vector2i imgSize;
+    ITMFloatImage* zmins;
+    ITMFloatImage* zmaxs;
+    ITMSceneParams params;
+
+    doForEachAllocatedVoxelBlock_process_member() {
 
         THREADPTR(Vector2i) upperLeft;
         THREADPTR(Vector2i) lowerRight;
         THREADPTR(Vector2f) zRange;
         if (!ProjectSingleBlock(voxelBlock->pos,
-            ::pose_global_to_eye, ::intrinsics, ::imgSize,
+            pose_global_to_eye, intrinsics, imgSize, params,
             upperLeft, lowerRight, zRange
             ))
             return;
@@ -175,32 +188,34 @@ struct DetermineBlockExtents {
         }
     }
 };
-void RenderingRangeImage::build(ITMPose pose, Vector4f intrinsics, Vector2i imgSize) {
-    ::pose_global_to_eye = pose.GetM();
-    ::intrinsics = intrinsics;
-    ::imgSize = imgSize;
+void RenderingRangeImage::build(Scene* const scene, ITMPose pose, Vector4f intrinsics, Vector2i imgSize) {
+    assert(scene);
+    this->imgSize = imgSize;
+    delete zmins;
+    delete zmaxs;
     zmins = new ITMFloatImage(imgSize);
     zmaxs = new ITMFloatImage(imgSize);
     assert(imgSize.area() > 1);
-    forEachPixelNoImage<InitZ>(imgSize);
+    const InitZ initZ = {zmins, zmaxs, scene->params};
+    forEachPixelNoImage(imgSize, initZ);
     cudaDeviceSynchronize();
-    assert(zmins->GetData()[0] == viewFrustum_min);
-    assert(zmaxs->GetData()[0] == viewFrustum_max);
+    assert(zmins->GetData()[0] == scene->params.viewFrustum_min_);
+    assert(zmaxs->GetData()[0] == scene->params.viewFrustum_max_);
 
-    Scene::getCurrentScene()->doForEachAllocatedVoxelBlock<DetermineBlockExtents>();
+    const DetermineBlockExtents determineBlockExtents = {pose.GetM(), intrinsics, imgSize, zmins, zmaxs, scene->params};
+    scene->doForEachAllocatedVoxelBlock(determineBlockExtents);
     /*
     // HACK to make save show something
-    zmins->GetData()[0] = viewFrustum_max;
-    zmaxs->GetData()[0] = viewFrustum_min;
+    zmins->GetData()[0] = scene->params.viewFrustum_max_;
+    zmaxs->GetData()[0] = scene->params.viewFrustum_min_;
     */
 
     save("RenderingRangeImage");
 }
 int main() {
     auto scene = new Scene();
-    CURRENT_SCENE_SCOPE(scene);
     scene->restore("scenedump.dump");
 
     RenderingRangeImage r;
-    r.build(ITMPose(), ITMIntrinsics().projectionParamsSimple.all, Vector2i(640, 480));
+    r.build(scene, ITMPose(), ITMIntrinsics().projectionParamsSimple.all, Vector2i(640, 480));
 }
\ No newline at end of file
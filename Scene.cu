@@ -1,62 +1,159 @@
 #include "Scene.h"
+#include <float.h>
 
-//__device__ Scene* currentScene;
-//__host__
-__managed__ Scene* currentScene = 0; // TODO use __const__ memory, since this value is not changeable from gpu!
+// see VoxelBlockCache in ITMRepresentationAccess.h
+__managed__ unsigned long long voxelBlockCacheHits = 0, voxelBlockCacheMisses = 0;
 
-CPU_AND_GPU Scene* Scene::getCurrentScene() {
-    return currentScene;
-}
+// performAllocations -- private:
+__device__ void Scene::AllocateVB::allocate(VoxelBlockPos pos, int sequenceId) {
+    assert(scene);
 
-void Scene::setCurrentScene(Scene* s) {
-    cudaDeviceSynchronize(); // want to write managed currentScene 
-    currentScene = s;
+    assert(sequenceId < scene->localVBA->getMaxBlocks()); // see Scene()
+
+    // the block might not have storage yet, it is initialized by finishAllocations
+    scene->lastSeenFrame[sequenceId] = scene->frame;
+    const uint i = atomicAdd(scene->allocatedCount, 1);
+    scene->allocatedSequenceNumbers[i] = sequenceId;
+    scene->allocatedPositions[i] = pos;
 }
 
+__device__ void Scene::AllocateVB::deallocate(VoxelBlockPos pos, int sequenceId) {
+    assert(scene);
+    assert(scene->localVBA->get(sequenceId)->pos_ == pos);
 
-// performAllocations -- private:
-__managed__ ITMVoxelBlock* currentLocalVBA = 0; //!< used for passing localVBA to allocate, called when doing voxel allocations by HashMap
-__device__ void Scene::AllocateVB::allocate(VoxelBlockPos pos, int sequenceId) {
-    assert(currentLocalVBA);
-
-    currentLocalVBA[sequenceId].reinit(pos);
+    scene->localVBA->get(sequenceId)->pos_ = INVALID_VOXEL_BLOCK_POS; // skipped by doForEachAllocatedVoxel(Block)
 }
 
 void Scene::performAllocations() {
-    assert(!currentLocalVBA);
-    currentLocalVBA = localVBA;
     voxelBlockHash->performAllocations(); // will call Scene::AllocateVB::allocate for all outstanding allocations
-    currentLocalVBA = 0;
+    finishAllocations();
+}
+
+void Scene::performRemovals() {
+    invalidateHostVoxelBlocks();
+    voxelBlockHash->performRemovals(); // will call Scene::AllocateVB::deallocate for all outstanding removals
+}
+
+void Scene::removeVoxelBlocks(const VoxelBlockPos* const positions, const uint count) {
+    if (count > 0) invalidateHostVoxelBlocks();
+    voxelBlockHash->removeKeys(positions, count);
+}
+
+HashMapStatistics Scene::getStatistics() {
+    return voxelBlockHash->getStatistics();
+}
+
+void Scene::resetStatistics() {
+    voxelBlockHash->resetRequestCounters();
+}
+
+uint Scene::performAllocationsCompletely() {
+    const uint rounds = voxelBlockHash->performAllocationsCompletely();
+    finishAllocations();
+    return rounds;
 }
 //
 
-Scene::Scene() {
-    initCoordinateSystems();
-    assert(mu > voxelSize * 2);
-    voxelBlockHash = new HashMap<Z3Hasher, AllocateVB>(SDF_EXCESS_LIST_SIZE);
-    cudaSafeCall(cudaMalloc(&localVBA, sizeof(ITMVoxelBlock) *SDF_LOCAL_BLOCK_NUM));
+static KERNEL initializeVoxelBlocks(VoxelBlockPool* const localVBA, const uint* const sequenceNumbers, const VoxelBlockPos* const positions, const uint count) {
+    const uint i = blockIdx.x * blockDim.x + threadIdx.x;
+    if (i >= count) return;
+    localVBA->get(sequenceNumbers[i])->reinit(positions[i]);
 }
 
-Scene::~Scene() {
-    delete voxelBlockHash;
-    cudaFree(localVBA);
+/// one thread block per allocated voxel block, one thread per voxel: fills the block from the palette if it was compressed
+static KERNEL decompressUniformVoxelBlocks(Scene* const scene, const uint* const sequenceNumbers, const VoxelBlockPos* const positions) {
+    const VoxelBlockPos pos = positions[blockIdx.x];
+    const uint s = scene->uniformVoxelBlocks->getSequenceNumber(pos);
+    if (s == 0) return;
+    const int i = voxelLocalId(Vector3i(threadIdx_xyz));
+    scene->localVBA->get(sequenceNumbers[blockIdx.x])->copyVoxel(i, scene->palette[scene->uniformPaletteIndices[s]]);
+    if (i == 0) scene->uniformVoxelBlocks->requestRemoval(pos);
 }
 
+void Scene::finishAllocations() {
+    cudaSafeCall(cudaDeviceSynchronize());
+    checkPalette(); // before decompressing from it
+    const uint n = voxelBlockHash->getLowestFreeSequenceNumber();
+    assert(n <= localVBA->getMaxBlocks()); // see Scene()
+    localVBA->reserve(n);
+
+    const uint count = *allocatedCount;
+    if (count > 0)
+        LAUNCH_KERNEL(initializeVoxelBlocks, (uint)ceil(count / 256.), 256, localVBA, allocatedSequenceNumbers, allocatedPositions, count);
+
+    if (count > 0 && uniformVoxelBlocks->countAllocatedEntries() > 0) {
+        LAUNCH_KERNEL(decompressUniformVoxelBlocks, count, dim3(SDF_BLOCK_SIZE, SDF_BLOCK_SIZE, SDF_BLOCK_SIZE), this, allocatedSequenceNumbers, allocatedPositions);
+        uniformVoxelBlocks->performRemovals();
+    }
+    swapIn();
+    copyAllocatedVoxelBlocksToHost(count);
+}
+
+Scene::Scene(const ITMSceneParams& params, const uint maxVoxelBlocks) : params(params) {
+    params.check();
+    getVoxelCoordinateSystems(params.voxelSize_, voxelBlockCoordinateSystem, voxelCoordinateSystem);
+    voxelBlockHash = new VoxelBlockHashMap(SDF_INITIAL_EXCESS_LIST_SIZE, SDF_INITIAL_BUCKET_NUM, AllocateVB(this));
+    localVBA = new VoxelBlockPool(maxVoxelBlocks);
+
+    frame = 0;
+    cudaSafeCall(cudaMalloc(&lastSeenFrame, sizeof(uint) * maxVoxelBlocks));
+    cudaSafeCall(cudaMemset(lastSeenFrame, 0, sizeof(uint) * maxVoxelBlocks));
+    // at most maxVoxelBlocks distinct sequence numbers are allocated between two finishAllocations
+    cudaSafeCall(cudaMalloc(&allocatedSequenceNumbers, sizeof(uint) * maxVoxelBlocks));
+    cudaSafeCall(cudaMalloc(&allocatedPositions, sizeof(VoxelBlockPos) * maxVoxelBlocks));
+    cudaSafeCall(cudaMallocManaged(&allocatedCount, sizeof(uint)));
+    cudaSafeCall(cudaDeviceSynchronize());
+    *allocatedCount = 0;
+    swappedOutVoxelBlocks = new VoxelBlockStore(hostVoxelBlockCapacity,
+        "voxelblocks" + std::to_string((unsigned long long)this) + ".swap");
+
+    uniformVoxelBlocks = new UniformVoxelBlockHashMap(SDF_INITIAL_EXCESS_LIST_SIZE, SDF_INITIAL_BUCKET_NUM);
+    uniformPaletteIndicesCapacity = SDF_INITIAL_BUCKET_NUM;
+    cudaSafeCall(cudaMalloc(&uniformPaletteIndices, uniformPaletteIndicesCapacity));
+    cudaSafeCall(cudaMalloc(&uniformPositions, uniformPaletteIndicesCapacity * sizeof(VoxelBlockPos)));
+    cudaSafeCall(cudaMalloc(&palette, sizeof(ITMVoxelBlock) * uniformVoxelBlockPaletteSize));
+    paletteSize = 0;
+    hostVoxelBlockCount = 0;
+
+    coarser = NULL;
+    level = 0;
+    levelDepthRange = Vector2f(0, FLT_MAX);
+}
+
+Scene* Scene::createMultiResolution(const ITMSceneParams& params, const uint levels, const float firstLevelMaxDepth, const uint maxVoxelBlocks) {
+    assert(levels >= 1);
+    assert(firstLevelMaxDepth > 0);
+    Scene* const finest = new Scene(params, maxVoxelBlocks);
+    Scene* s = finest;
+    for (uint l = 1; l < levels; l++) {
+        s->levelDepthRange.y = firstLevelMaxDepth * (1 << (l - 1));
+        ITMSceneParams levelParams = ITMSceneParams::forVoxelSize(params.voxelSize_ * (1 << l));
+        levelParams.blockSize_ = params.blockSize_;
+        s->coarser = new Scene(levelParams, maxVoxelBlocks);
+        s->coarser->level = l;
+        s->coarser->levelDepthRange.x = s->levelDepthRange.y;
+        s = s->coarser;
+    }
+    return finest;
+}
 
-static GPU_ONLY inline VoxelBlockPos pointToVoxelBlockPos(
-    const THREADPTR(Vector3i) & point //!< [in] in voxel coordinates
-    ) {
-    // "The 3D voxel block location is obtained by dividing the voxel coordinates with the block size along each axis."
-    VoxelBlockPos blockPos;
-    // if SDF_BLOCK_SIZE == 8, then -3 should go to block -1, so we need to adjust negative values 
-    // (C's quotient-remainder division gives -3/8 == 0)
-    blockPos.x = ((point.x < 0) ? point.x - SDF_BLOCK_SIZE + 1 : point.x) / SDF_BLOCK_SIZE;
-    blockPos.y = ((point.y < 0) ? point.y - SDF_BLOCK_SIZE + 1 : point.y) / SDF_BLOCK_SIZE;
-    blockPos.z = ((point.z < 0) ? point.z - SDF_BLOCK_SIZE + 1 : point.z) / SDF_BLOCK_SIZE;
-    return blockPos;
+Scene::~Scene() {
+    delete coarser;
+    delete voxelBlockHash;
+    delete localVBA;
+    cudaFree(lastSeenFrame);
+    cudaFree(allocatedSequenceNumbers);
+    cudaFree(allocatedPositions);
+    cudaFree(allocatedCount);
+    delete swappedOutVoxelBlocks;
+    delete uniformVoxelBlocks;
+    cudaFree(uniformPaletteIndices);
+    cudaFree(uniformPositions);
+    cudaFree(palette);
 }
 
-GPU_ONLY ITMVoxel* Scene::getVoxel(Vector3i point) {
+
+GPU_ONLY ITMVoxelPtr Scene::getVoxel(Vector3i point) {
     VoxelBlockPos blockPos = pointToVoxelBlockPos(point);
 
     ITMVoxelBlock* b = getVoxelBlock(blockPos);
@@ -67,136 +164,776 @@ GPU_ONLY ITMVoxel* Scene::getVoxel(Vector3i point) {
 }
 
 GPU_ONLY ITMVoxelBlock* Scene::getVoxelBlockForSequenceNumber(unsigned int sequenceNumber) {
-    assert(sequenceNumber < SDF_LOCAL_BLOCK_NUM);
     assert(sequenceNumber < voxelBlockHash->getLowestFreeSequenceNumber());
-    return &localVBA[sequenceNumber];
+    return localVBA->get(sequenceNumber);
 }
 
-/// Returns NULL if the voxel block is not allocated
 GPU_ONLY ITMVoxelBlock* Scene::getVoxelBlock(VoxelBlockPos pos) {
     int sequenceNumber = voxelBlockHash->getSequenceNumber(pos); // returns 0 if pos is not allocated
-    if (sequenceNumber == 0) return NULL;
-    return &localVBA[sequenceNumber];
+    if (sequenceNumber == 0) {
+        if (paletteSize == 0) return NULL; // nothing compressed
+        const uint s = uniformVoxelBlocks->getSequenceNumber(pos);
+        return s == 0 ? NULL : &palette[uniformPaletteIndices[s]];
+    }
+    return localVBA->get(sequenceNumber);
 }
 
 GPU_ONLY void Scene::requestVoxelBlockAllocation(VoxelBlockPos pos) {
     voxelBlockHash->requestAllocation(pos);
 }
 
+static KERNEL sequenceNumbersToVoxelBlocks(VoxelBlockPool* const localVBA, const uint* const sequenceNumbers, const uint count, ITMVoxelBlock** const out) {
+    const uint i = blockIdx.x * blockDim.x + threadIdx.x;
+    if (i >= count) return;
+    out[i] = sequenceNumbers[i] == 0 ? NULL : localVBA->get(sequenceNumbers[i]);
+}
+
+void Scene::getVoxelBlocks(const VoxelBlockPos* const positions, const uint count, ITMVoxelBlock** const out) {
+    if (count == 0) return;
+    uint* sequenceNumbers;
+    cudaSafeCall(cudaMalloc(&sequenceNumbers, count * sizeof(uint)));
+    voxelBlockHash->getSequenceNumbers(positions, count, sequenceNumbers);
+    LAUNCH_KERNEL(sequenceNumbersToVoxelBlocks, (uint)ceil(count / 256.), 256, localVBA, sequenceNumbers, count, out);
+    cudaFree(sequenceNumbers);
+}
+
+GPU_ONLY void Scene::requestVoxelBlockRemoval(VoxelBlockPos pos) {
+    voxelBlockHash->requestRemoval(pos);
+}
+
+/// --- swapping ---
+
+GPU_ONLY void Scene::markVoxelBlockSeen(VoxelBlockPos pos) {
+    const uint sequenceNumber = voxelBlockHash->getSequenceNumber(pos);
+    if (sequenceNumber) lastSeenFrame[sequenceNumber] = frame;
+}
+
+/// Appends the sequence numbers of blocks not seen after frame - maxUnseenFrames to out
+static KERNEL collectUnseenVoxelBlocks(Scene* const scene, const uint n, const uint maxUnseenFrames, uint* const out, uint* const count) {
+    const uint i = blockIdx.x * blockDim.x + threadIdx.x;
+    if (i == 0 || i >= n) return;
+    if (scene->localVBA->get(i)->pos_ == INVALID_VOXEL_BLOCK_POS) return; // removed
+    if (scene->frame - scene->lastSeenFrame[i] <= maxUnseenFrames) return;
+    out[atomicAdd(count, 1)] = i;
+}
+
+/// one thread block per voxel block, one thread per voxel: to[j] = from[sequenceNumbers[j]]
+static KERNEL gatherVoxelBlocks(VoxelBlockPool* const from, const uint* const sequenceNumbers, ITMVoxelBlock* const to) {
+    const ITMVoxelBlock& source = *from->get(sequenceNumbers[blockIdx.x]);
+    const int i = voxelLocalId(Vector3i(threadIdx_xyz));
+    to[blockIdx.x].copyVoxel(i, source);
+    if (i == 0) to[blockIdx.x].pos_ = source.pos_;
+}
+
+/// one thread block per voxel block, one thread per voxel: to[sequenceNumbers[j]] = from[j]
+static KERNEL scatterVoxelBlocks(const ITMVoxelBlock* const from, const uint* const sequenceNumbers, VoxelBlockPool* const to) {
+    ITMVoxelBlock& target = *to->get(sequenceNumbers[blockIdx.x]);
+    const int i = voxelLocalId(Vector3i(threadIdx_xyz));
+    assert(target.pos_ == from[blockIdx.x].pos_);
+    target.copyVoxel(i, from[blockIdx.x]);
+}
+
+static KERNEL voxelBlockPositions(VoxelBlockPool* const localVBA, const uint* const sequenceNumbers, const uint count, VoxelBlockPos* const out) {
+    const uint i = blockIdx.x * blockDim.x + threadIdx.x;
+    if (i >= count) return;
+    out[i] = localVBA->get(sequenceNumbers[i])->pos_;
+}
+
+void Scene::swapOutUnseenVoxelBlocks(const uint maxUnseenFrames) {
+    const uint n = voxelBlockHash->getLowestFreeSequenceNumber();
+    uint* sequenceNumbers;
+    cudaSafeCall(cudaMalloc(&sequenceNumbers, n * sizeof(uint)));
+    cudaSafeCall(cudaDeviceSynchronize());
+    *allocatedCount = 0; // reused as counter
+    LAUNCH_KERNEL(collectUnseenVoxelBlocks, (uint)ceil(n / 256.), 256, this, n, maxUnseenFrames, sequenceNumbers, allocatedCount);
+    const uint count = *allocatedCount;
+    *allocatedCount = 0;
+
+    if (count > 0) {
+        ITMVoxelBlock* blocks;
+        cudaSafeCall(cudaMalloc(&blocks, count * sizeof(ITMVoxelBlock)));
+        LAUNCH_KERNEL(gatherVoxelBlocks, count, dim3(SDF_BLOCK_SIZE, SDF_BLOCK_SIZE, SDF_BLOCK_SIZE), localVBA, sequenceNumbers, blocks);
+
+        std::vector<unsigned char> cpu_blocks(count * sizeof(ITMVoxelBlock));
+        cudaSafeCall(cudaMemcpy(cpu_blocks.data(), blocks, count * sizeof(ITMVoxelBlock), cudaMemcpyDeviceToHost));
+        for (uint j = 0; j < count; j++)
+            swappedOutVoxelBlocks->put(reinterpret_cast<const ITMVoxelBlock*>(cpu_blocks.data())[j]);
+
+        VoxelBlockPos* positions;
+        cudaSafeCall(cudaMalloc(&positions, count * sizeof(VoxelBlockPos)));
+        LAUNCH_KERNEL(voxelBlockPositions, (uint)ceil(count / 256.), 256, localVBA, sequenceNumbers, count, positions);
+        removeVoxelBlocks(positions, count);
+        cudaFree(positions);
+        cudaFree(blocks);
+    }
+    cudaFree(sequenceNumbers);
+}
+
+void Scene::nextFrame() {
+    frame++;
+}
+
+void Scene::swapIn() {
+    cudaSafeCall(cudaDeviceSynchronize());
+    const uint count = *allocatedCount;
+    *allocatedCount = 0;
+    if (count == 0 || swappedOutVoxelBlocks->size() == 0) return;
+
+    // which of the new blocks were swapped out?
+    std::vector<VoxelBlockPos> cpu_positions(count);
+    std::vector<uint> cpu_sequenceNumbers(count);
+    cudaSafeCall(cudaMemcpy(cpu_positions.data(), allocatedPositions, count * sizeof(VoxelBlockPos), cudaMemcpyDeviceToHost));
+    cudaSafeCall(cudaMemcpy(cpu_sequenceNumbers.data(), allocatedSequenceNumbers, count * sizeof(uint), cudaMemcpyDeviceToHost));
+
+    std::vector<unsigned char> cpu_blocks;
+    std::vector<uint> targets;
+    for (uint j = 0; j < count; j++) {
+        if (!swappedOutVoxelBlocks->contains(cpu_positions[j])) continue;
+        cpu_blocks.resize((targets.size() + 1) * sizeof(ITMVoxelBlock));
+        swappedOutVoxelBlocks->take(cpu_positions[j], reinterpret_cast<ITMVoxelBlock*>(cpu_blocks.data())[targets.size()]);
+        targets.push_back(cpu_sequenceNumbers[j]);
+    }
+    if (targets.empty()) return;
+
+    ITMVoxelBlock* blocks;
+    uint* sequenceNumbers;
+    cudaSafeCall(cudaMalloc(&blocks, targets.size() * sizeof(ITMVoxelBlock)));
+    cudaSafeCall(cudaMalloc(&sequenceNumbers, targets.size() * sizeof(uint)));
+    cudaSafeCall(cudaMemcpy(blocks, cpu_blocks.data(), targets.size() * sizeof(ITMVoxelBlock), cudaMemcpyHostToDevice));
+    cudaSafeCall(cudaMemcpy(sequenceNumbers, targets.data(), targets.size() * sizeof(uint), cudaMemcpyHostToDevice));
+    LAUNCH_KERNEL(scatterVoxelBlocks, (uint)targets.size(), dim3(SDF_BLOCK_SIZE, SDF_BLOCK_SIZE, SDF_BLOCK_SIZE), blocks, sequenceNumbers, localVBA);
+    cudaFree(sequenceNumbers);
+    cudaFree(blocks);
+}
+
+/// --- host copy of the voxel blocks, see doForEachAllocatedVoxelOnCPU ---
+
+ITMVoxelBlock* Scene::updateHostVoxelBlocks() {
+    const uint n = voxelBlockHash->getLowestFreeSequenceNumber();
+    if (hostVoxelBlockCount != n) { // invalid, copyAllocatedVoxelBlocksToHost keeps it at n otherwise
+        hostVoxelBlocks.resize(n * sizeof(ITMVoxelBlock)); // no ITMVoxel constructors on the host
+        localVBA->copyTo(0, n, reinterpret_cast<ITMVoxelBlock*>(hostVoxelBlocks.data()), cudaMemcpyDeviceToHost);
+        hostVoxelBlockCount = n;
+    }
+    return reinterpret_cast<ITMVoxelBlock*>(hostVoxelBlocks.data());
+}
+
+void Scene::copyAllocatedVoxelBlocksToHost(const uint count) {
+    if (hostVoxelBlockCount == 0) return;
+    const uint n = voxelBlockHash->getLowestFreeSequenceNumber();
+    hostVoxelBlocks.resize(n * sizeof(ITMVoxelBlock)); // the blocks beyond hostVoxelBlockCount are all newly allocated
+    hostVoxelBlockCount = n;
+    if (count == 0) return;
+
+    ITMVoxelBlock* blocks;
+    cudaSafeCall(cudaMalloc(&blocks, count * sizeof(ITMVoxelBlock)));
+    LAUNCH_KERNEL(gatherVoxelBlocks, count, dim3(SDF_BLOCK_SIZE, SDF_BLOCK_SIZE, SDF_BLOCK_SIZE), localVBA, allocatedSequenceNumbers, blocks);
+
+    std::vector<unsigned char> cpu_blocks(count * sizeof(ITMVoxelBlock));
+    std::vector<uint> cpu_sequenceNumbers(count);
+    cudaSafeCall(cudaMemcpy(cpu_blocks.data(), blocks, count * sizeof(ITMVoxelBlock), cudaMemcpyDeviceToHost));
+    cudaSafeCall(cudaMemcpy(cpu_sequenceNumbers.data(), allocatedSequenceNumbers, count * sizeof(uint), cudaMemcpyDeviceToHost));
+    cudaFree(blocks);
+
+    ITMVoxelBlock* const hostBlocks = reinterpret_cast<ITMVoxelBlock*>(hostVoxelBlocks.data());
+    for (uint j = 0; j < count; j++)
+        memcpy(&hostBlocks[cpu_sequenceNumbers[j]], &cpu_blocks[j * sizeof(ITMVoxelBlock)], sizeof(ITMVoxelBlock));
+}
+
+void Scene::copyHostVoxelBlocksToDevice(const std::vector<uint>& sequenceNumbers) {
+    const uint count = (uint)sequenceNumbers.size();
+    if (count == 0) return;
+    assert(hostVoxelBlockCount == voxelBlockHash->getLowestFreeSequenceNumber());
+
+    const ITMVoxelBlock* const hostBlocks = reinterpret_cast<const ITMVoxelBlock*>(hostVoxelBlocks.data());
+    std::vector<unsigned char> cpu_blocks(count * sizeof(ITMVoxelBlock));
+    for (uint j = 0; j < count; j++)
+        memcpy(&cpu_blocks[j * sizeof(ITMVoxelBlock)], &hostBlocks[sequenceNumbers[j]], sizeof(ITMVoxelBlock));
+
+    ITMVoxelBlock* blocks;
+    uint* gpu_sequenceNumbers;
+    cudaSafeCall(cudaMalloc(&blocks, count * sizeof(ITMVoxelBlock)));
+    cudaSafeCall(cudaMalloc(&gpu_sequenceNumbers, count * sizeof(uint)));
+    cudaSafeCall(cudaMemcpy(blocks, cpu_blocks.data(), count * sizeof(ITMVoxelBlock), cudaMemcpyHostToDevice));
+    cudaSafeCall(cudaMemcpy(gpu_sequenceNumbers, sequenceNumbers.data(), count * sizeof(uint), cudaMemcpyHostToDevice));
+    LAUNCH_KERNEL(scatterVoxelBlocks, count, dim3(SDF_BLOCK_SIZE, SDF_BLOCK_SIZE, SDF_BLOCK_SIZE), blocks, gpu_sequenceNumbers, localVBA);
+    cudaFree(gpu_sequenceNumbers);
+    cudaFree(blocks);
+}
+
+uint Scene::countSwappedOutVoxelBlocks() {
+    return (uint)swappedOutVoxelBlocks->size();
+}
+
+/// --- uniform block compression ---
+static_assert(uniformVoxelBlockPaletteSize >= 1 && uniformVoxelBlockPaletteSize <= 256, "palette indices are uchars");
+
+static CPU_AND_GPU bool sameVoxel(const ITMVoxel& a, const ITMVoxel& b) {
+    return a.getSDF() == b.getSDF() && a.w_depth == b.w_depth
+#if VOXEL_HAS_COLOR
+        && a.clr == b.clr && a.w_color == b.w_color && a.luminanceAlbedo == b.luminanceAlbedo
+#endif
+        ;
+}
+
+/// one thread block per sequence number, one thread per voxel:
+/// appends the sequence numbers and values of the uniform blocks not seen after frame - minUnseenFrames
+static KERNEL findUniformVoxelBlocks(Scene* const scene, const uint minUnseenFrames, uint* const sequenceNumbers, ITMVoxel* const values, uint* const count) {
+    const uint s = blockIdx.x;
+    if (s == 0) return;
+    ITMVoxelBlock* const b = scene->localVBA->get(s);
+    if (b->pos_ == INVALID_VOXEL_BLOCK_POS) return; // removed
+    if (scene->frame - scene->lastSeenFrame[s] <= minUnseenFrames) return;
+
+    const Vector3i localPos(threadIdx_xyz);
+    const ITMVoxel first = *b->getVoxel(Vector3i(0, 0, 0));
+    const bool uniform = __syncthreads_and(sameVoxel(*b->getVoxel(localPos), first));
+    if (!uniform || voxelLocalId(localPos) != 0) return;
+
+    const uint j = atomicAdd(count, 1);
+    sequenceNumbers[j] = s;
+    values[j] = first;
+}
+
+/// one thread block per new palette entry, one thread per voxel
+static KERNEL fillPalette(ITMVoxelBlock* const palette, const uint* const entries, const ITMVoxel* const values, const uint* const valueIndices) {
+    ITMVoxelBlock& b = palette[entries[blockIdx.x]];
+    *b.getVoxel(Vector3i(threadIdx_xyz)) = values[valueIndices[blockIdx.x]];
+    if (voxelLocalId(Vector3i(threadIdx_xyz)) == 0) b.pos_ = INVALID_VOXEL_BLOCK_POS;
+}
+
+static KERNEL requestUniformVoxelBlocks(Scene::UniformVoxelBlockHashMap* const hashMap, const VoxelBlockPos* const positions, const uint count) {
+    const uint j = blockIdx.x * blockDim.x + threadIdx.x;
+    if (j >= count) return;
+    hashMap->requestAllocation(positions[j]);
+}
+
+static KERNEL setUniformPaletteIndices(Scene* const scene, const uint* const sequenceNumbers, const uchar* const indices, const VoxelBlockPos* const positions, const uint count) {
+    const uint j = blockIdx.x * blockDim.x + threadIdx.x;
+    if (j >= count) return;
+    assert(sequenceNumbers[j]);
+    scene->uniformPaletteIndices[sequenceNumbers[j]] = indices[j];
+    scene->uniformPositions[sequenceNumbers[j]] = positions[j];
+}
+
+void Scene::compressUniformVoxelBlocks(const uint minUnseenFrames) {
+    checkPalette();
+    const uint n = voxelBlockHash->getLowestFreeSequenceNumber();
+    uint* sequenceNumbers;
+    ITMVoxel* values;
+    cudaSafeCall(cudaMalloc(&sequenceNumbers, n * sizeof(uint)));
+    cudaSafeCall(cudaMalloc(&values, n * sizeof(ITMVoxel)));
+    cudaSafeCall(cudaDeviceSynchronize());
+    *allocatedCount = 0; // reused as counter
+    LAUNCH_KERNEL(findUniformVoxelBlocks, n, dim3(SDF_BLOCK_SIZE, SDF_BLOCK_SIZE, SDF_BLOCK_SIZE), this, minUnseenFrames, sequenceNumbers, values, allocatedCount);
+    const uint found = *allocatedCount;
+    *allocatedCount = 0;
+
+    // assign palette entries on the host, there are only few distinct values
+    std::vector<unsigned char> cpu_values(found * sizeof(ITMVoxel));
+    std::vector<uint> cpu_sequenceNumbers(found);
+    cudaSafeCall(cudaMemcpy(cpu_values.data(), values, found * sizeof(ITMVoxel), cudaMemcpyDeviceToHost));
+    cudaSafeCall(cudaMemcpy(cpu_sequenceNumbers.data(), sequenceNumbers, found * sizeof(uint), cudaMemcpyDeviceToHost));
+
+    std::vector<uint> compressed, newEntries, newEntryValues;
+    std::vector<uchar> indices;
+    for (uint j = 0; j < found; j++) {
+        const ITMVoxel& value = reinterpret_cast<const ITMVoxel*>(cpu_values.data())[j];
+        uint e = 0;
+        while (e < paletteSize && !sameVoxel(reinterpret_cast<const ITMVoxel*>(paletteValues.data())[e], value)) e++;
+        if (e == paletteSize) {
+            if (paletteSize == uniformVoxelBlockPaletteSize) continue; // full
+            const unsigned char* const bytes = reinterpret_cast<const unsigned char*>(&value);
+            paletteValues.insert(paletteValues.end(), bytes, bytes + sizeof(ITMVoxel));
+            newEntries.push_back(paletteSize++);
+            newEntryValues.push_back(j);
+        }
+        compressed.push_back(cpu_sequenceNumbers[j]);
+        indices.push_back((uchar)e);
+    }
+    const uint count = (uint)compressed.size();
+
+    if (!newEntries.empty()) {
+        uint *gpu_entries, *gpu_entryValues;
+        cudaSafeCall(cudaMalloc(&gpu_entries, newEntries.size() * sizeof(uint)));
+        cudaSafeCall(cudaMalloc(&gpu_entryValues, newEntries.size() * sizeof(uint)));
+        cudaSafeCall(cudaMemcpy(gpu_entries, newEntries.data(), newEntries.size() * sizeof(uint), cudaMemcpyHostToDevice));
+        cudaSafeCall(cudaMemcpy(gpu_entryValues, newEntryValues.data(), newEntries.size() * sizeof(uint), cudaMemcpyHostToDevice));
+        LAUNCH_KERNEL(fillPalette, (uint)newEntries.size(), dim3(SDF_BLOCK_SIZE, SDF_BLOCK_SIZE, SDF_BLOCK_SIZE), palette, gpu_entries, values, gpu_entryValues);
+        cudaFree(gpu_entries);
+        cudaFree(gpu_entryValues);
+    }
+
+    if (count > 0) {
+        uint *gpu_compressed, *uniformSequenceNumbers;
+        uchar* gpu_indices;
+        VoxelBlockPos* positions;
+        cudaSafeCall(cudaMalloc(&gpu_compressed, count * sizeof(uint)));
+        cudaSafeCall(cudaMalloc(&uniformSequenceNumbers, count * sizeof(uint)));
+        cudaSafeCall(cudaMalloc(&gpu_indices, count * sizeof(uchar)));
+        cudaSafeCall(cudaMalloc(&positions, count * sizeof(VoxelBlockPos)));
+        cudaSafeCall(cudaMemcpy(gpu_compressed, compressed.data(), count * sizeof(uint), cudaMemcpyHostToDevice));
+        cudaSafeCall(cudaMemcpy(gpu_indices, indices.data(), count * sizeof(uchar), cudaMemcpyHostToDevice));
+        LAUNCH_KERNEL(voxelBlockPositions, (uint)ceil(count / 256.), 256, localVBA, gpu_compressed, count, positions);
+
+        // tag, then free the blocks
+        LAUNCH_KERNEL(requestUniformVoxelBlocks, (uint)ceil(count / 256.), 256, uniformVoxelBlocks, positions, count);
+        uniformVoxelBlocks->performAllocationsCompletely();
+        reserveUniformPaletteIndices(uniformVoxelBlocks->getLowestFreeSequenceNumber());
+        uniformVoxelBlocks->getSequenceNumbers(positions, count, uniformSequenceNumbers);
+        LAUNCH_KERNEL(setUniformPaletteIndices, (uint)ceil(count / 256.), 256, this, uniformSequenceNumbers, gpu_indices, positions, count);
+        removeVoxelBlocks(positions, count);
+
+        cudaFree(gpu_compressed);
+        cudaFree(uniformSequenceNumbers);
+        cudaFree(gpu_indices);
+        cudaFree(positions);
+    }
+    cudaFree(sequenceNumbers);
+    cudaFree(values);
+}
+
+void Scene::reserveUniformPaletteIndices(const uint capacity) {
+    if (capacity <= uniformPaletteIndicesCapacity) return;
+    uchar* bigger;
+    cudaSafeCall(cudaMalloc(&bigger, capacity * 2));
+    cudaSafeCall(cudaMemcpy(bigger, uniformPaletteIndices, uniformPaletteIndicesCapacity, cudaMemcpyDeviceToDevice));
+    cudaFree(uniformPaletteIndices);
+    uniformPaletteIndices = bigger;
+
+    VoxelBlockPos* biggerPositions;
+    cudaSafeCall(cudaMalloc(&biggerPositions, capacity * 2 * sizeof(VoxelBlockPos)));
+    cudaSafeCall(cudaMemcpy(biggerPositions, uniformPositions, uniformPaletteIndicesCapacity * sizeof(VoxelBlockPos), cudaMemcpyDeviceToDevice));
+    cudaFree(uniformPositions);
+    uniformPositions = biggerPositions;
+    uniformPaletteIndicesCapacity = capacity * 2;
+}
+
+/// one thread block per palette entry, one thread per voxel
+static KERNEL checkPaletteValues(ITMVoxelBlock* const palette, const ITMVoxel* const values) {
+    ITMVoxelBlock& b = palette[blockIdx.x];
+    assert(sameVoxel(*b.getVoxel(Vector3i(threadIdx_xyz)), values[blockIdx.x]));
+    assert(b.pos_ == INVALID_VOXEL_BLOCK_POS);
+}
+
+void Scene::checkPalette() {
+#ifdef _DEBUG
+    if (paletteSize == 0) return;
+    ITMVoxel* values;
+    cudaSafeCall(cudaMalloc(&values, paletteValues.size()));
+    cudaSafeCall(cudaMemcpy(values, paletteValues.data(), paletteValues.size(), cudaMemcpyHostToDevice));
+    LAUNCH_KERNEL(checkPaletteValues, paletteSize, dim3(SDF_BLOCK_SIZE, SDF_BLOCK_SIZE, SDF_BLOCK_SIZE), palette, values);
+    cudaFree(values);
+#endif
+}
+
+VoxelBlockCompressionStatistics Scene::getCompressionStatistics() {
+    VoxelBlockCompressionStatistics s;
+    s.uniformVoxelBlocks = uniformVoxelBlocks->countAllocatedEntries();
+    s.paletteSize = paletteSize;
+    s.uniformBytesSaved = (size_t)s.uniformVoxelBlocks * (sizeof(ITMVoxelBlock) - sizeof(uchar));
+    s.hostVoxelBlocks = (uint)swappedOutVoxelBlocks->sizeInHost();
+    s.hostBytesSaved = swappedOutVoxelBlocks->sizeInHost() * sizeof(ITMVoxelBlock) - swappedOutVoxelBlocks->getHostBytes();
+    return s;
+}
+
+/// --- reset and crop ---
+
+void Scene::reset() {
+    invalidateHostVoxelBlocks();
+    voxelBlockHash->clear();
+    uniformVoxelBlocks->clear();
+    swappedOutVoxelBlocks->clear();
+    paletteSize = 0;
+    paletteValues.clear();
+    cudaSafeCall(cudaDeviceSynchronize());
+    *allocatedCount = 0;
+
+    if (coarser) coarser->reset();
+}
+
+/// Whether none of the voxels of the block at pos lies in [boxMin, boxMax] (world space coordinates)
+static CPU_AND_GPU bool voxelBlockOutsideBox(const VoxelBlockPos& pos, const Vector3f& boxMin, const Vector3f& boxMax, const float voxelSize_) {
+    const Vector3f first = (pos.toInt() * SDF_BLOCK_SIZE).toFloat() * voxelSize_;
+    const Vector3f last = first + Vector3f((SDF_BLOCK_SIZE - 1) * voxelSize_);
+    return last.x < boxMin.x || last.y < boxMin.y || last.z < boxMin.z
+        || first.x > boxMax.x || first.y > boxMax.y || first.z > boxMax.z;
+}
+
+/// Appends the positions of the resident blocks outside the box to out
+static KERNEL collectVoxelBlocksOutsideBox(Scene* const scene, const uint n, const Vector3f boxMin, const Vector3f boxMax, VoxelBlockPos* const out, uint* const count) {
+    const uint i = blockIdx.x * blockDim.x + threadIdx.x;
+    if (i == 0 || i >= n) return;
+    const VoxelBlockPos pos = scene->localVBA->get(i)->pos_;
+    if (pos == INVALID_VOXEL_BLOCK_POS) return; // removed
+    if (!voxelBlockOutsideBox(pos, boxMin, boxMax, scene->params.voxelSize_)) return;
+    out[atomicAdd(count, 1)] = pos;
+}
+
+/// Appends the positions of the compressed blocks outside the box to out
+static KERNEL collectUniformVoxelBlocksOutsideBox(Scene* const scene, const uint n, const Vector3f boxMin, const Vector3f boxMax, VoxelBlockPos* const out, uint* const count) {
+    const uint i = blockIdx.x * blockDim.x + threadIdx.x;
+    if (i == 0 || i >= n) return;
+    const VoxelBlockPos pos = scene->uniformPositions[i];
+    if (scene->uniformVoxelBlocks->getSequenceNumber(pos) != i) return; // free
+    if (!voxelBlockOutsideBox(pos, boxMin, boxMax, scene->params.voxelSize_)) return;
+    out[atomicAdd(count, 1)] = pos;
+}
+
+void Scene::crop(const Vector3f& boxMin, const Vector3f& boxMax) {
+    assert(boxMin.x <= boxMax.x && boxMin.y <= boxMax.y && boxMin.z <= boxMax.z);
+    const uint n = voxelBlockHash->getLowestFreeSequenceNumber();
+    const uint uniformN = uniformVoxelBlocks->getLowestFreeSequenceNumber();
+    VoxelBlockPos* positions;
+    cudaSafeCall(cudaMalloc(&positions, MAX(n, uniformN) * sizeof(VoxelBlockPos)));
+    cudaSafeCall(cudaDeviceSynchronize());
+
+    *allocatedCount = 0; // reused as counter
+    LAUNCH_KERNEL(collectVoxelBlocksOutsideBox, (uint)ceil(n / 256.), 256, this, n, boxMin, boxMax, positions, allocatedCount);
+    removeVoxelBlocks(positions, *allocatedCount);
+
+    *allocatedCount = 0;
+    LAUNCH_KERNEL(collectUniformVoxelBlocksOutsideBox, (uint)ceil(uniformN / 256.), 256, this, uniformN, boxMin, boxMax, positions, allocatedCount);
+    uniformVoxelBlocks->removeKeys(positions, *allocatedCount);
+    *allocatedCount = 0;
+    cudaFree(positions);
+
+    const float voxelSize_ = params.voxelSize_;
+    swappedOutVoxelBlocks->removeIf([&](const VoxelBlockPos& pos) {
+        return voxelBlockOutsideBox(pos, boxMin, boxMax, voxelSize_);
+    });
+
+    if (coarser) coarser->crop(boxMin, boxMax);
+}
+
+/// --- Morton order re-layout ---
+#include <thrust/sort.h>
+#include <thrust/execution_policy.h>
+
+/// Removed blocks and the unused block 0 get the biggest key, they are dropped
+static KERNEL mortonCodes(VoxelBlockPool* const localVBA, const uint n, uint* const codes, uint* const sequenceNumbers) {
+    const uint i = blockIdx.x * blockDim.x + threadIdx.x;
+    if (i >= n) return;
+    sequenceNumbers[i] = i;
+    const bool unused = i == 0 || localVBA->get(i)->pos_ == INVALID_VOXEL_BLOCK_POS;
+    codes[i] = unused ? UINT_MAX : Scene::MortonHasher::code(localVBA->get(i)->pos_);
+}
+
+/// newSequenceNumbers[sortedSequenceNumbers[j]] = j + 1
+static KERNEL invertOrder(const uint* const sortedSequenceNumbers, const uint count, uint* const newSequenceNumbers) {
+    const uint j = blockIdx.x * blockDim.x + threadIdx.x;
+    if (j >= count) return;
+    newSequenceNumbers[sortedSequenceNumbers[j]] = j + 1;
+}
+
+/// out[j] = lastSeenFrame[sortedSequenceNumbers[j]]
+static KERNEL gatherLastSeenFrames(const uint* const lastSeenFrame, const uint* const sortedSequenceNumbers, const uint count, uint* const out) {
+    const uint j = blockIdx.x * blockDim.x + threadIdx.x;
+    if (j >= count) return;
+    out[j] = lastSeenFrame[sortedSequenceNumbers[j]];
+}
+
+void Scene::relayoutVoxelBlocks() {
+    const uint n = voxelBlockHash->getLowestFreeSequenceNumber();
+    const uint count = voxelBlockHash->countAllocatedEntries();
+    if (count == 0) return;
+    invalidateHostVoxelBlocks();
+
+    uint *codes, *sortedSequenceNumbers, *newSequenceNumbers, *sortedLastSeenFrames;
+    ITMVoxelBlock* sorted;
+    cudaSafeCall(cudaMalloc(&codes, n * sizeof(uint)));
+    cudaSafeCall(cudaMalloc(&sortedLastSeenFrames, count * sizeof(uint)));
+    cudaSafeCall(cudaMalloc(&sortedSequenceNumbers, n * sizeof(uint)));
+    cudaSafeCall(cudaMalloc(&newSequenceNumbers, n * sizeof(uint)));
+    cudaSafeCall(cudaMemset(newSequenceNumbers, 0, n * sizeof(uint))); // free sequence numbers stay unmapped
+    cudaSafeCall(cudaMalloc(&sorted, count * sizeof(ITMVoxelBlock)));
+
+    LAUNCH_KERNEL(mortonCodes, (uint)ceil(n / 256.), 256, localVBA, n, codes, sortedSequenceNumbers);
+    thrust::sort_by_key(thrust::device, codes, codes + n, sortedSequenceNumbers);
+    // the first count are the blocks in use
+    LAUNCH_KERNEL(invertOrder, (uint)ceil(count / 256.), 256, sortedSequenceNumbers, count, newSequenceNumbers);
+    LAUNCH_KERNEL(gatherVoxelBlocks, count, dim3(SDF_BLOCK_SIZE, SDF_BLOCK_SIZE, SDF_BLOCK_SIZE), localVBA, sortedSequenceNumbers, sorted);
+    LAUNCH_KERNEL(gatherLastSeenFrames, (uint)ceil(count / 256.), 256, lastSeenFrame, sortedSequenceNumbers, count, sortedLastSeenFrames);
+
+    localVBA->copyFrom(1, count, sorted, cudaMemcpyDeviceToDevice);
+    cudaSafeCall(cudaMemcpy(lastSeenFrame + 1, sortedLastSeenFrames, count * sizeof(uint), cudaMemcpyDeviceToDevice));
+    voxelBlockHash->remapSequenceNumbers(newSequenceNumbers);
+    assert(voxelBlockHash->getLowestFreeSequenceNumber() == count + 1);
+
+    cudaFree(codes);
+    cudaFree(sortedSequenceNumbers);
+    cudaFree(newSequenceNumbers);
+    cudaFree(sortedLastSeenFrames);
+    cudaFree(sorted);
+}
+
 /// --- dumping ---
 #include "fileutils.h"
 #include <stdio.h>
+#include <memory>
 int fileExists(TCHAR * file);
 
-void Scene::dump(std::string filename) {
-    FILE* file = fopen(filename.c_str(), "wb");
-    assert(file);
-    const int N = voxelBlockHash->getLowestFreeSequenceNumber();
-    fwrite(&N, sizeof(N), 1, file);
+/// Written in place of the voxel block count of the older format, which is always > 1
+static const int DUMP_WITH_HASH_MAP = -1;
 
-    auto cpu_localVBA = new MemoryBlock<ITMVoxelBlock>(N);
-    cudaMemcpy(cpu_localVBA->GetData(), localVBA, N*sizeof(ITMVoxelBlock), cudaMemcpyDeviceToHost); // this takes forever -- copy only N not all!
-    assert(cpu_localVBA->GetData()[1].pos_ != cpu_localVBA->GetData()[2].pos_);
+/// Dumps are read and written with freadChecked and fwriteChecked (HashMap.h): file errors throw std::runtime_error,
+/// a short read would restore a half initialized scene.
+typedef std::unique_ptr<FILE, int(*)(FILE*)> DumpFile;
+
+static DumpFile openDump(const std::string& filename, const char* const mode) {
+    FILE* const file = fopen(filename.c_str(), mode);
+    if (!file) throw std::runtime_error("Scene: cannot open " + filename + ": " + strerror(errno));
+    return DumpFile(file, fclose);
+}
+
+/// Closes file, which also writes what is still buffered
+static void closeDump(DumpFile& file, const std::string& filename) {
+    if (fclose(file.release()) != 0) throw std::runtime_error("Scene: cannot write " + filename + ": " + strerror(errno));
+}
+
+/// Appends the positions and palette indices of the compressed blocks to positions and indices
+static KERNEL collectUniformVoxelBlocks(Scene* const scene, const uint n, VoxelBlockPos* const positions, uchar* const indices, uint* const count) {
+    const uint i = blockIdx.x * blockDim.x + threadIdx.x;
+    if (i == 0 || i >= n) return;
+    const VoxelBlockPos pos = scene->uniformPositions[i];
+    if (scene->uniformVoxelBlocks->getSequenceNumber(pos) != i) return; // free
+    const uint j = atomicAdd(count, 1);
+    positions[j] = pos;
+    indices[j] = scene->uniformPaletteIndices[i];
+}
+
+void Scene::dump(std::string filename, bool withHashMap) {
+    checkPalette();
+    DumpFile dumpFile = openDump(filename, "wb"); // closed on errors too
+    FILE* const file = dumpFile.get();
+    const int allocatedN = voxelBlockHash->getLowestFreeSequenceNumber();
+
+    if (withHashMap) {
+        // sequence numbers stay as they are, removed blocks included
+        auto cpu_localVBA = new MemoryBlock<ITMVoxelBlock>(allocatedN);
+        localVBA->copyTo(0, allocatedN, cpu_localVBA->GetData(), cudaMemcpyDeviceToHost);
+        fwriteChecked(&DUMP_WITH_HASH_MAP, 1, file);
+        fwriteChecked(&allocatedN, 1, file);
+        fwriteChecked(cpu_localVBA->GetData(), allocatedN, file);
+        voxelBlockHash->write(file);
+        const int swappedOut = (int)swappedOutVoxelBlocks->size();
+        fwriteChecked(&swappedOut, 1, file);
+        swappedOutVoxelBlocks->forEach([&](const ITMVoxelBlock& b) { fwriteChecked(&b, 1, file); });
+
+        // the palette, then the hash map of compressed blocks and what its sequence numbers index
+        fwriteChecked(&paletteSize, 1, file);
+        auto cpu_palette = new MemoryBlock<ITMVoxelBlock>(MAX(paletteSize, 1u));
+        cudaSafeCall(cudaMemcpy(cpu_palette->GetData(), palette, paletteSize * sizeof(ITMVoxelBlock), cudaMemcpyDeviceToHost));
+        fwriteChecked(cpu_palette->GetData(), paletteSize, file);
+        delete cpu_palette;
+        fwriteChecked(paletteValues.data(), paletteValues.size(), file);
+        uniformVoxelBlocks->write(file);
+        const uint uniformN = uniformVoxelBlocks->getLowestFreeSequenceNumber();
+        std::vector<uchar> indices(uniformN);
+        std::vector<VoxelBlockPos> positions(uniformN);
+        cudaSafeCall(cudaMemcpy(indices.data(), uniformPaletteIndices, uniformN, cudaMemcpyDeviceToHost));
+        cudaSafeCall(cudaMemcpy(positions.data(), uniformPositions, uniformN * sizeof(VoxelBlockPos), cudaMemcpyDeviceToHost));
+        fwriteChecked(indices.data(), uniformN, file);
+        fwriteChecked(positions.data(), uniformN, file);
+        closeDump(dumpFile, filename);
+        delete cpu_localVBA;
+        return;
+    }
+
+    auto cpu_localVBA = new MemoryBlock<ITMVoxelBlock>(allocatedN);
+    localVBA->copyTo(0, allocatedN, cpu_localVBA->GetData(), cudaMemcpyDeviceToHost);
+
+    // skip removed blocks, restore expects consecutive sequence numbers
+    int N = 1;
+    for (int i = 1; i < allocatedN; i++) {
+        if (cpu_localVBA->GetData()[i].pos_ == INVALID_VOXEL_BLOCK_POS) continue;
+        if (i != N) cpu_localVBA->GetData()[N] = cpu_localVBA->GetData()[i];
+        N++;
+    }
+    // swapped out and compressed blocks follow as if they were allocated
+    const uint uniformN = uniformVoxelBlocks->getLowestFreeSequenceNumber();
+    VoxelBlockPos* compressedPositions;
+    uchar* compressedIndices;
+    cudaSafeCall(cudaMallocManaged(&compressedPositions, uniformN * sizeof(VoxelBlockPos)));
+    cudaSafeCall(cudaMallocManaged(&compressedIndices, uniformN));
+    cudaSafeCall(cudaDeviceSynchronize());
+    *allocatedCount = 0; // reused as counter
+    LAUNCH_KERNEL(collectUniformVoxelBlocks, (uint)ceil(uniformN / 256.), 256, this, uniformN, compressedPositions, compressedIndices, allocatedCount);
+    const int uniform = *allocatedCount;
+    *allocatedCount = 0;
+    auto cpu_palette = new MemoryBlock<ITMVoxelBlock>(MAX(paletteSize, 1u));
+    cudaSafeCall(cudaMemcpy(cpu_palette->GetData(), palette, paletteSize * sizeof(ITMVoxelBlock), cudaMemcpyDeviceToHost));
+
+    const int resident = N;
+    N += (int)swappedOutVoxelBlocks->size() + uniform;
+    fwriteChecked(&N, 1, file);
+    assert(resident <= 2 || cpu_localVBA->GetData()[1].pos_ != cpu_localVBA->GetData()[2].pos_);
     /*
     for (int i = 0; i < N; i++) { // dont care that 0 is actually never used
         fwrite(&cpu_localVBA->GetData()[i], sizeof(ITMVoxelBlock), 1, file);
     }*/
-    fwrite(cpu_localVBA->GetData(), sizeof(ITMVoxelBlock), N, file);
+    fwriteChecked(cpu_localVBA->GetData(), resident, file);
+    swappedOutVoxelBlocks->forEach([&](const ITMVoxelBlock& b) { fwriteChecked(&b, 1, file); });
+    for (int j = 0; j < uniform; j++) {
+        ITMVoxelBlock& b = cpu_palette->GetData()[compressedIndices[j]];
+        b.pos_ = compressedPositions[j];
+        fwriteChecked(&b, 1, file);
+    }
+    cudaFree(compressedPositions);
+    cudaFree(compressedIndices);
+    delete cpu_palette;
     // no need to write hashmap -- transparent to the application
 
-    fclose(file);
+    closeDump(dumpFile, filename);
     assert(fileExists((char*)filename.c_str()));
     assert(dump::fileSize(filename) == sizeof(int) + N*sizeof(ITMVoxelBlock));
 
     delete cpu_localVBA;
 }
 
-static __managed__ int counter = 0;
-static KERNEL requestAllocation(VoxelBlockPos vbp) {
-    Scene::requestCurrentSceneVoxelBlockAllocation(vbp);
-}
-
-static KERNEL countIfAllocated(VoxelBlockPos vbp) {
-    if (Scene::getCurrentSceneVoxel(vbp.toInt() * SDF_BLOCK_SIZE)) {
-        atomicAdd(&counter, 1);
+static KERNEL requestAllocation(Scene* const scene, const ITMVoxelBlock* const blocks, const int N, VoxelBlockPos* const positions) {
+    const int j = blockIdx.x * blockDim.x + threadIdx.x;
+    if (j >= N) return;
+    if (j == 0) { // block 0 is never used
+        positions[j] = INVALID_VOXEL_BLOCK_POS;
+        return;
     }
+    positions[j] = blocks[j].pos_;
+    scene->requestVoxelBlockAllocation(blocks[j].pos_);
 }
 
-static __managed__ char submittedVb_[sizeof(ITMVoxelBlock)];
-
-static KERNEL fill() {
-    ITMVoxelBlock& submittedVb = *(ITMVoxelBlock*)submittedVb_;
-    VoxelBlockPos p = submittedVb.pos;
-    printf("%d %d %d\n", xyz(p));
-    assert(p.x < 10000); // sanity
+/// one thread block per voxel block, one thread per voxel
+static KERNEL fill(const ITMVoxelBlock* const blocks, ITMVoxelBlock* const* const targets) {
+    const int j = blockIdx.x;
+    if (j == 0) return;
+    assert(targets[j]);
+    assert(blocks[j].pos_.x < 10000); // sanity
 
-    // assume threads run for each voxel
-    ITMVoxel* voxel = Scene::getCurrentSceneVoxel(
-        submittedVb.pos.toInt() * SDF_BLOCK_SIZE +
-        Vector3i(threadIdx_xyz));
-
-    assert(voxel);
-    ITMVoxel* svoxel = submittedVb.getVoxel(Vector3i(threadIdx_xyz));
-    *voxel = *svoxel; // copy state
+    const Vector3i localPos(threadIdx_xyz);
+    targets[j]->copyVoxel(voxelLocalId(localPos), blocks[j]); // copy state
 }
 
-KERNEL checkSdf(Vector3i voxelp, float expected_sdf) {
+KERNEL checkSdf(Scene* const scene, Vector3i voxelp, float expected_sdf) {
     assert(abs(
-        expected_sdf - Scene::getCurrentSceneVoxel(voxelp)->getSDF()
+        expected_sdf - scene->getVoxel(voxelp)->getSDF()
         ) < 0.0001);
 }
 void pauseit() {
     while (1);
     system("pause");
 }
-// works on the current scene, assumes scene is empty so far
+/// Each restored voxel block must be found at its own sequence number, one thread per sequence number
+static KERNEL checkRestoredVoxelBlocks(Scene* const scene, const int N, uint* const found) {
+    const int j = blockIdx.x * blockDim.x + threadIdx.x;
+    if (j <= 0 || j >= N) return;
+    const VoxelBlockPos pos = scene->localVBA->get(j)->pos_;
+    if (pos == INVALID_VOXEL_BLOCK_POS) return; // removed
+    assert(scene->voxelBlockHash->getSequenceNumber(pos) == j);
+    atomicAdd(found, 1);
+}
+
+// assumes scene is empty so far
 void Scene::restore(std::string filename) {
-    atexit(pauseit);
-    assert(getCurrentScene() == this);
     assert(voxelBlockHash->getLowestFreeSequenceNumber() == 1);
+    invalidateHostVoxelBlocks();
+    assert(swappedOutVoxelBlocks->size() == 0 && paletteSize == 0);
+
+    DumpFile dumpFile = openDump(filename, "rb"); // closed on errors too
+    FILE* const file = dumpFile.get();
+    int N; freadChecked(&N, 1, file);
+
+    if (N == DUMP_WITH_HASH_MAP) {
+        freadChecked(&N, 1, file);
+        if (N < 1 || N > localVBA->getMaxBlocks()) throw std::runtime_error("Scene: corrupt dump " + filename);
+        auto cpu_localVBA = new MemoryBlock<ITMVoxelBlock>(N);
+        freadChecked(cpu_localVBA->GetData(), N, file);
+        localVBA->reserve(N);
+        localVBA->copyFrom(0, N, cpu_localVBA->GetData(), cudaMemcpyHostToDevice);
+        delete cpu_localVBA;
+        voxelBlockHash->read(file);
+
+        int swappedOut = 0;
+        if (fread(&swappedOut, sizeof(swappedOut), 1, file) != 1) { // missing in dumps from before swapped out blocks were written
+            if (ferror(file)) fileError("Scene: cannot read", file);
+            swappedOut = 0;
+        }
+        if (swappedOut < 0) throw std::runtime_error("Scene: corrupt dump " + filename);
+        std::vector<unsigned char> block(sizeof(ITMVoxelBlock));
+        for (int i = 0; i < swappedOut; i++) {
+            freadChecked(block.data(), block.size(), file);
+            swappedOutVoxelBlocks->put(*reinterpret_cast<const ITMVoxelBlock*>(block.data()));
+        }
 
-    FILE* file = fopen(filename.c_str(), "rb");
-    assert(file);
-    int N; fread(&N, sizeof(N), 1, file);
-    assert(N > 1);
+        uint restoredPaletteSize;
+        const bool withPalette = fread(&restoredPaletteSize, sizeof(restoredPaletteSize), 1, file) == 1;
+        if (!withPalette && ferror(file)) fileError("Scene: cannot read", file);
+        if (withPalette) { // missing in dumps from before compressed blocks were written
+            if (restoredPaletteSize > uniformVoxelBlockPaletteSize) throw std::runtime_error("Scene: corrupt dump " + filename);
+            paletteSize = restoredPaletteSize;
+            auto cpu_palette = new MemoryBlock<ITMVoxelBlock>(MAX(paletteSize, 1u));
+            freadChecked(cpu_palette->GetData(), paletteSize, file);
+            cudaSafeCall(cudaMemcpy(palette, cpu_palette->GetData(), paletteSize * sizeof(ITMVoxelBlock), cudaMemcpyHostToDevice));
+            delete cpu_palette;
+            paletteValues.resize(paletteSize * sizeof(ITMVoxel));
+            freadChecked(paletteValues.data(), paletteValues.size(), file);
+
+            uniformVoxelBlocks->read(file);
+            const uint uniformN = uniformVoxelBlocks->getLowestFreeSequenceNumber();
+            reserveUniformPaletteIndices(uniformN);
+            std::vector<uchar> indices(uniformN);
+            std::vector<VoxelBlockPos> positions(uniformN);
+            freadChecked(indices.data(), uniformN, file);
+            freadChecked(positions.data(), uniformN, file);
+            cudaSafeCall(cudaMemcpy(uniformPaletteIndices, indices.data(), uniformN, cudaMemcpyHostToDevice));
+            cudaSafeCall(cudaMemcpy(uniformPositions, positions.data(), uniformN * sizeof(VoxelBlockPos), cudaMemcpyHostToDevice));
+        }
+        dumpFile.reset();
+        assert(voxelBlockHash->getLowestFreeSequenceNumber() == N);
+
+        // validate: the table must hold exactly the blocks that are not removed
+        uint* found;
+        cudaSafeCall(cudaMallocManaged(&found, sizeof(uint)));
+        cudaSafeCall(cudaDeviceSynchronize());
+        *found = 0;
+        LAUNCH_KERNEL(checkRestoredVoxelBlocks, (int)ceil(N / 256.), 256, this, N, found);
+        assert(*found == voxelBlockHash->countAllocatedEntries());
+        cudaFree(found);
+        return;
+    }
+
+    // older format: replay the allocations
+    atexit(pauseit);
+    if (N <= 1) throw std::runtime_error("Scene: corrupt dump " + filename);
     auto cpu_localVBA = new MemoryBlock<ITMVoxelBlock>(N); // allocate only N not SDF_LOCAL_BLOCK_NUM, takes forever (many constructors)
-    fread(cpu_localVBA->GetData(), sizeof(ITMVoxelBlock), N, file);
-    fclose(file);
+    freadChecked(cpu_localVBA->GetData(), N, file);
+    dumpFile.reset();
     
     assert(cpu_localVBA->GetData()[1].pos_ != cpu_localVBA->GetData()[2].pos_);
 
     // allocate
-    do {
-        for (int j = 1; j < N; j++) {
-            cudaDeviceSynchronize();
-            requestAllocation << <1, 1 >> >(cpu_localVBA->GetData()[j].pos_);
-        cudaDeviceSynchronize();
-        }
-        Scene::performCurrentSceneAllocations();
-        cudaDeviceSynchronize();
-
-        counter = 0;
-        for (int j = 1; j < N; j++) {
-            cudaDeviceSynchronize();
-            countIfAllocated << <1, 1 >> >(cpu_localVBA->GetData()[j].pos_);
-            cudaDeviceSynchronize();
-        }
-        cudaDeviceSynchronize();
-    } while (counter != N-1);
+    ITMVoxelBlock* gpu_blocks;
+    VoxelBlockPos* positions;
+    cudaSafeCall(cudaMalloc(&gpu_blocks, N*sizeof(ITMVoxelBlock)));
+    cudaSafeCall(cudaMalloc(&positions, N*sizeof(VoxelBlockPos)));
+    cudaSafeCall(cudaMemcpy(gpu_blocks, cpu_localVBA->GetData(), N*sizeof(ITMVoxelBlock), cudaMemcpyHostToDevice));
+    LAUNCH_KERNEL(requestAllocation, (int)ceil(N / 256.), 256, this, gpu_blocks, N, positions);
+    performAllocationsCompletely();
+    assert(voxelBlockHash->getLowestFreeSequenceNumber() == N);
 
     // fill
-    for (int j = 1; j < N; j++) {
-        cudaDeviceSynchronize();
-        //submittedVb = cpu_localVBA->GetData()[j];
-        memcpy(submittedVb_, &cpu_localVBA->GetData()[j], sizeof(ITMVoxelBlock));
-        fill << <1, dim3(SDF_BLOCK_SIZE, SDF_BLOCK_SIZE, SDF_BLOCK_SIZE) >> >();
-    }
+    ITMVoxelBlock** targets;
+    cudaSafeCall(cudaMalloc(&targets, N*sizeof(ITMVoxelBlock*)));
+    getVoxelBlocks(positions, N, targets);
+    LAUNCH_KERNEL(fill, N, dim3(SDF_BLOCK_SIZE, SDF_BLOCK_SIZE, SDF_BLOCK_SIZE), gpu_blocks, targets);
+    cudaFree(targets);
+    cudaFree(positions);
+    cudaFree(gpu_blocks);
 
     // verify
     cudaDeviceSynchronize();
     Vector3i voxelp = cpu_localVBA->GetData()[1].pos_.toInt() * SDF_BLOCK_SIZE;
-    float sdf = cpu_localVBA->GetData()[1].blockVoxels[0].getSDF();
-    checkSdf << <1, 1 >> >(voxelp, sdf);
+    float sdf = cpu_localVBA->GetData()[1].getVoxel(Vector3i(0, 0, 0))->getSDF();
+    checkSdf << <1, 1 >> >(this, voxelp, sdf);
 
     // done
 
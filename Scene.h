@@ -2,20 +2,46 @@
 #include "itmlibdefines.h"
 #include "cudadefines.h"
 #include "hashmap.h"
+#include "OpenAddressingHashMap.h"
 #include "coordinateSystem.h"
+#include "VoxelBlockStore.h"
+#include "VoxelBlockPool.h"
+#include "CPUParallel.h"
+#include <float.h>
+
+/// Storage used for the voxel block hash of Scene: HashMap (excess lists) or OpenAddressingHashMap.
+/// Both take the same template arguments.
+#ifndef VOXEL_BLOCK_HASH_MAP
+#define VOXEL_BLOCK_HASH_MAP HashMap
+#endif
+
+/// Hash function used for the voxel block hash of Scene: Scene::Z3Hasher or Scene::MortonHasher
+#ifndef VOXEL_BLOCK_HASHER
+#define VOXEL_BLOCK_HASHER Z3Hasher
+#endif
 
 // see doForEachAllocatedVoxel for T
-#define doForEachAllocatedVoxel_process() static GPU_ONLY void process(const ITMVoxelBlock* vb, ITMVoxel* const v, const Vector3i localPos, const Vector3i globalPos, const Point globalPoint)
+#define doForEachAllocatedVoxel_process() static GPU_ONLY void process(const ITMVoxelBlock* vb, const ITMVoxelPtr v, const Vector3i localPos, const Vector3i globalPos, const Point globalPoint)
+// the same for T that can also run on the CPU, see Scene::doForEachAllocatedVoxelOnCPU
+#define doForEachAllocatedVoxel_process_CPU_AND_GPU() static CPU_AND_GPU void process(const ITMVoxelBlock* vb, const ITMVoxelPtr v, const Vector3i localPos, const Vector3i globalPos, const Point globalPoint)
+// the same for T that carry their arguments (plain old data, copied to the device) instead of reading globals
+#define doForEachAllocatedVoxel_process_member() GPU_ONLY void process(const ITMVoxelBlock* vb, const ITMVoxelPtr v, const Vector3i localPos, const Vector3i globalPos, const Point globalPoint) const
+#define doForEachAllocatedVoxel_process_member_CPU_AND_GPU() CPU_AND_GPU void process(const ITMVoxelBlock* vb, const ITMVoxelPtr v, const Vector3i localPos, const Vector3i globalPos, const Point globalPoint) const
 
 
 template<typename T>
 KERNEL doForEachAllocatedVoxel(
-    ITMVoxelBlock* localVBA,
-    int nextFreeSequenceId) {
-    int index = blockIdx.x;
+    VoxelBlockPool* localVBA,
+    int nextFreeSequenceId,
+    const uint* sequenceNumbers, // NULL: the sequence number is blockIdx.x
+    const float voxelSize_, // of the scene, which need not be the current one
+    const T t
+    ) {
+    int index = sequenceNumbers ? sequenceNumbers[blockIdx.x] : blockIdx.x;
     if (index <= 0 || index >= nextFreeSequenceId) return;
 
-    ITMVoxelBlock* vb = &localVBA[index];
+    ITMVoxelBlock* vb = localVBA->get(index);
+    if (vb->pos == INVALID_VOXEL_BLOCK_POS) return; // removed
     Vector3i localPos(threadIdx_xyz);
 
     // signature specified in doForEachAllocatedVoxel_process
@@ -25,9 +51,9 @@ KERNEL doForEachAllocatedVoxel(
     const Vector3i globalPos = vb->pos.toInt() * SDF_BLOCK_SIZE + localPos;
 
     // world-space coordinate position of current voxel
-    auto globalPoint = Point(CoordinateSystem::global(),globalPos.toFloat() * voxelSize);
+    auto globalPoint = Point(CoordinateSystem::global(),globalPos.toFloat() * voxelSize_);
          
-    T::process(
+    t.process(
         vb, 
         vb->getVoxel(localPos), 
         localPos,
@@ -37,135 +63,475 @@ KERNEL doForEachAllocatedVoxel(
 }
 
 #define doForEachAllocatedVoxelBlock_process() static GPU_ONLY void process(ITMVoxelBlock* voxelBlock)
+// the same for T that carry their arguments (plain old data, copied to the device) instead of reading globals
+#define doForEachAllocatedVoxelBlock_process_member() GPU_ONLY void process(ITMVoxelBlock* voxelBlock) const
 // see doForEachAllocatedVoxel for T
 template<typename T>
 KERNEL doForEachAllocatedVoxelBlock(
-    ITMVoxelBlock* localVBA,
-    int nextFreeSequenceId) {
-    int index = blockIdx.x * blockDim.x + threadIdx.x;
+    VoxelBlockPool* localVBA,
+    int nextFreeSequenceId,
+    const uint* sequenceNumbers, // NULL: the sequence number is the thread index
+    uint count,
+    const T t) {
+    const uint i = blockIdx.x * blockDim.x + threadIdx.x;
+    if (i >= count) return;
+    int index = sequenceNumbers ? sequenceNumbers[i] : i;
     if (index <= 0 || index >= nextFreeSequenceId) return;
 
-    ITMVoxelBlock* vb = &localVBA[index];
-    T::process(vb);
+    ITMVoxelBlock* vb = localVBA->get(index);
+    if (vb->pos == INVALID_VOXEL_BLOCK_POS) return; // removed
+    t.process(vb);
 }
 
 
+/// Memory saved by the compressed representations of voxel blocks, see Scene::getCompressionStatistics
+struct VoxelBlockCompressionStatistics {
+    /// Blocks replaced by a palette entry, see Scene::compressUniformVoxelBlocks
+    uint uniformVoxelBlocks;
+    /// Distinct values of those blocks. The palette takes uniformVoxelBlockPaletteSize blocks whether used or not.
+    uint paletteSize;
+    /// Device memory the uniform blocks would take as ordinary blocks, minus their palette indices
+    /// (not counting the hash table that finds them)
+    size_t uniformBytesSaved;
+
+    /// Swapped out blocks kept in host memory, see VoxelBlockStore
+    uint hostVoxelBlocks;
+    /// Host memory they would take uncompressed, minus what they take
+    size_t hostBytesSaved;
+
+    /// A single line JSON object with all the fields above
+    std::string toJSON() const {
+        std::ostringstream o;
+        o << "{"
+            << "\"uniformVoxelBlocks\":" << uniformVoxelBlocks
+            << ",\"paletteSize\":" << paletteSize
+            << ",\"uniformBytesSaved\":" << uniformBytesSaved
+            << ",\"hostVoxelBlocks\":" << hostVoxelBlocks
+            << ",\"hostBytesSaved\":" << hostBytesSaved
+            << "}";
+        return o.str();
+    }
+};
+
 /// Must be heap-allocated
 class Scene : public Managed {
 public:
     /// \returns NULL when the voxel was not found
-    GPU_ONLY ITMVoxel* getVoxel(Vector3i pos);
+    GPU_ONLY ITMVoxelPtr getVoxel(Vector3i pos);
 
     /// \returns a voxel block from the localVBA
     GPU_ONLY ITMVoxelBlock* getVoxelBlockForSequenceNumber(unsigned int sequenceNumber);
 
+    /// \returns NULL if the voxel block is not allocated.
+    /// For a block compressed by compressUniformVoxelBlocks, a palette block holding its value everywhere:
+    /// read only (shared by all blocks with that value, debug builds assert it is not written), and its pos is not pos.
+    /// Writers request the allocation of the block first, which decompresses it.
+    GPU_ONLY DEVICEPTR(ITMVoxelBlock*) getVoxelBlock(VoxelBlockPos pos);
+
+    /// The voxel block containing the voxel at point (in voxel coordinates)
+    static CPU_AND_GPU VoxelBlockPos pointToVoxelBlockPos(
+        const THREADPTR(Vector3i) & point //!< [in] in voxel coordinates
+        ) {
+        // "The 3D voxel block location is obtained by dividing the voxel coordinates with the block size along each axis."
+        VoxelBlockPos blockPos;
+        // if SDF_BLOCK_SIZE == 8, then -3 should go to block -1, so we need to adjust negative values 
+        // (C's quotient-remainder division gives -3/8 == 0)
+        blockPos.x = ((point.x < 0) ? point.x - SDF_BLOCK_SIZE + 1 : point.x) / SDF_BLOCK_SIZE;
+        blockPos.y = ((point.y < 0) ? point.y - SDF_BLOCK_SIZE + 1 : point.y) / SDF_BLOCK_SIZE;
+        blockPos.z = ((point.z < 0) ? point.z - SDF_BLOCK_SIZE + 1 : point.z) / SDF_BLOCK_SIZE;
+        return blockPos;
+    }
+
+    /**
+    Calls visit(blockPos) for each voxel block that the segment from start to end (in voxel block coordinates) passes through,
+    once each, in order from start to end. Consecutive blocks share a face.
+    This is a 3D DDA (Amanatides and Woo): from the block of start, it steps to the next block along the axis
+    whose block boundary the segment crosses first, until it reaches the block of end.
+    \returns the number of blocks visited
+    */
+#pragma hd_warning_disable
+    template<typename Visitor>
+    static CPU_AND_GPU uint forEachVoxelBlockOnSegment(const Vector3f& start, const Vector3f& end, const Visitor& visit) {
+        Vector3i block = start.toIntFloor();
+        const Vector3i last = end.toIntFloor();
+        Vector3i step;
+        // segment parameter (0 at start, 1 at end) of the next block boundary along each axis, and between two of them
+        Vector3f tMax, tDelta;
+        for (int a = 0; a < 3; a++) {
+            const float d = end[a] - start[a];
+            step[a] = d > 0 ? 1 : -1;
+            tDelta[a] = d != 0 ? 1.f / fabs(d) : FLT_MAX;
+            tMax[a] = d == 0 ? FLT_MAX : (d > 0 ? block[a] + 1 - start[a] : start[a] - block[a]) * tDelta[a];
+        }
+
+        const int steps = abs(last.x - block.x) + abs(last.y - block.y) + abs(last.z - block.z);
+        visit(VoxelBlockPos(block.x, block.y, block.z));
+        for (int i = 0; i < steps; i++) {
+            // only axes where last is not reached yet, so that rounding cannot lead past it
+            int a = -1;
+            for (int b = 0; b < 3; b++)
+                if (block[b] != last[b] && (a < 0 || tMax[b] < tMax[a])) a = b;
+            block[a] += step[a];
+            tMax[a] += tDelta[a];
+            visit(VoxelBlockPos(block.x, block.y, block.z));
+        }
+        return steps + 1;
+    }
+
+    /// Looks up count voxel blocks at once, out[i] is NULL when positions[i] is not allocated.
+    /// positions and out must be in device memory.
+    /// Prefer this over many getVoxel calls when the positions are known up front (see HashMap::getSequenceNumbers).
+    void getVoxelBlocks(const VoxelBlockPos* const positions, const uint count, ITMVoxelBlock** const out);
+
     /// Returns NULL if the voxel block is not allocated
     GPU_ONLY void requestVoxelBlockAllocation(VoxelBlockPos pos);
     void performAllocations();
-
-    Scene();
+    /// Allocates all requested voxel blocks, see HashMap::performAllocationsCompletely
+    /// \returns the number of allocation rounds that were needed
+    uint performAllocationsCompletely();
+
+    /// Removed voxel blocks stay in localVBA with pos == INVALID_VOXEL_BLOCK_POS until their sequence number is reused.
+    /// Does nothing if the voxel block is not allocated.
+    GPU_ONLY void requestVoxelBlockRemoval(VoxelBlockPos pos);
+    void performRemovals();
+    /// Removes count voxel blocks whose positions are given in device memory
+    void removeVoxelBlocks(const VoxelBlockPos* const positions, const uint count);
+
+    /// Records that the voxel block at pos (if allocated) is seen in the current frame, see swapOutUnseenVoxelBlocks
+    GPU_ONLY void markVoxelBlockSeen(VoxelBlockPos pos);
+    /// Starts the next frame for markVoxelBlockSeen. Call once per frame.
+    void nextFrame();
+
+    /**
+    Moves the voxel blocks that were not seen (markVoxelBlockSeen) or allocated in the last maxUnseenFrames frames
+    out of localVBA to the host (and from there to disk, see VoxelBlockStore).
+
+    Swapped out blocks come back with their content when their allocation is requested again
+    (performAllocations(Completely)). Until then lookups do not find them. dump writes them, restore swaps them out again
+    (the older format restores them into localVBA).
+    */
+    void swapOutUnseenVoxelBlocks(uint maxUnseenFrames);
+    /// Number of voxel blocks on the host or on disk
+    uint countSwappedOutVoxelBlocks();
+
+    /**
+    Replaces the voxel blocks whose voxels all have the same value, and that were not seen or allocated in the last
+    minUnseenFrames frames, by an index into a palette of up to uniformVoxelBlockPaletteSize such values.
+    Their sequence numbers (and thus their memory in localVBA) are reused by later allocations.
+
+    getVoxel and getVoxelBlock still find the voxels of such blocks, read only.
+    When the allocation of a compressed block is requested, it is decompressed, so writers (which allocate first) see an ordinary block.
+    Blocks whose value is not in the palette when it is full stay as they are. dump writes them compressed
+    (the older format writes them decompressed, and restore puts them into localVBA).
+    */
+    void compressUniformVoxelBlocks(uint minUnseenFrames);
+    /// Cheap enough to query every frame
+    VoxelBlockCompressionStatistics getCompressionStatistics();
+
+    /// Occupancy of the voxel block hash and its collided/dropped allocation requests, see HashMap::getStatistics.
+    /// Cheap enough to query every frame, HashMapStatistics::toJSON for logging.
+    HashMapStatistics getStatistics();
+
+    /// Renumbers the voxel blocks such that they are stored in Morton (Z-)order of their positions in localVBA,
+    /// so that blocks which are close in space are close in memory. Also compacts away removed blocks.
+    /// Invalidates all ITMVoxelBlock pointers and sequence numbers obtained before.
+    /// See voxelBlockRelayoutInterval.
+    void relayoutVoxelBlocks();
+    /// Restart counting collided and dropped allocation requests, e.g. once per frame
+    void resetStatistics();
+
+    /// At most maxVoxelBlocks voxel blocks can be allocated at the same time (hard cap, exceeding it fails an assertion).
+    /// Memory for them is mapped as the scene grows, see VoxelBlockPool.
+    Scene(const ITMSceneParams& params = ITMSceneParams::defaults(), uint maxVoxelBlocks = SDF_LOCAL_BLOCK_NUM);
+    /// Deletes the coarser levels too
     virtual ~Scene();
 
-    void dump(std::string filename);
+    /**
+    A scene of levels levels, where the voxels of each level are twice as large as those of the one before
+    (ITMSceneParams::forVoxelSize, so mu doubles too, with the blockSize_ of params). The finest level, with params, is returned, the others follow through coarser.
+
+    Fuse allocates the blocks for a depth sample in one level only, by its depth:
+    level 0 takes depths below firstLevelMaxDepth, level l up to firstLevelMaxDepth * 2^l, the last level everything beyond.
+    Far geometry, where the sensor noise is larger anyway, thus takes fewer and larger voxels.
+    readFromSDF_float_interpolated etc. read the finest level that has all the voxels they need.
+
+    levels = 1 gives an ordinary scene.
+    dump, restore, reset etc. work per level.
+    */
+    static Scene* createMultiResolution(const ITMSceneParams& params, uint levels, float firstLevelMaxDepth, uint maxVoxelBlocks = SDF_LOCAL_BLOCK_NUM);
+
+    /// Writes the voxel blocks and the voxel block hash, such that restore is a bulk copy, then the swapped out
+    /// and the compressed blocks.
+    /// withHashMap = false writes the older format with only the blocks, whose restore replays their allocation.
+    void dump(std::string filename, bool withHashMap = true);
+    /// Reads either format written by dump. The scene must be empty.
     void restore(std::string filename);
 
-    /*
-    void reset() {
-        // TODO implement
-        printf("Scene::reset not implemented\n");
-    }*/
-
-    /// T must have an operator(ITMVoxelBlock*, ITMVoxel*, Vector3i localPos)
+    /**
+    Removes all voxel blocks (resident, swapped out and compressed), so the scene is empty as after construction,
+    in this and the coarser levels.
+    Only clears the hash maps, whose size is independent of the number of voxels: the voxel blocks are not touched,
+    and the memory mapped for them stays for the next blocks allocated.
+    Invalidates all ITMVoxelBlock pointers and sequence numbers obtained before.
+    */
+    void reset();
+
+    /**
+    Removes the voxel blocks none of whose voxels lie in the box [boxMin, boxMax] (world space coordinates),
+    resident, swapped out and compressed ones, in this and the coarser levels.
+    Costs about as much as one pass over the allocated blocks' positions.
+    Cropping to a box around the camera after each frame keeps memory bounded while the camera moves,
+    see rollingWindowRadius.
+    */
+    void crop(const Vector3f& boxMin, const Vector3f& boxMax);
+
+    /// T must have an operator(ITMVoxelBlock*, ITMVoxelPtr, Vector3i localPos)
     /// where localPos will run from 0,0,0 to (SDF_BLOCK_SIZE-1)^3
     /// runs threadblock per voxel block and thread per thread
+    /// Launches one threadblock per sequence number in use (getLowestFreeSequenceNumber), so the cost follows the size of the scene.
+    /// t is passed to the kernel, for T with a member process (doForEachAllocatedVoxel_process_member(_CPU_AND_GPU)).
     template<typename T>
-    void doForEachAllocatedVoxel() {
+    void doForEachAllocatedVoxel(const T& t = T()) {
+        invalidateHostVoxelBlocks();
         LAUNCH_KERNEL(
             ::doForEachAllocatedVoxel<T>,
-            SDF_LOCAL_BLOCK_NUM,
+            voxelBlockHash->getLowestFreeSequenceNumber(),
             dim3(SDF_BLOCK_SIZE, SDF_BLOCK_SIZE, SDF_BLOCK_SIZE),
             localVBA,
-            voxelBlockHash->getLowestFreeSequenceNumber()
+            voxelBlockHash->getLowestFreeSequenceNumber(),
+            (const uint*)NULL,
+            params.voxelSize_,
+            t
             );
     }
 
-    /// T must have an operator(ITMVoxelBlock*)
+    /// Like doForEachAllocatedVoxel, but only for the count voxel blocks whose sequence numbers are listed
+    /// in sequenceNumbers (device memory), e.g. a compacted list of the visible blocks. 0 and removed blocks are skipped.
     template<typename T>
-    void doForEachAllocatedVoxelBlock() {
+    void doForEachAllocatedVoxel(const uint* const sequenceNumbers, const uint count, const T& t = T()) {
+        if (count == 0) return;
+        invalidateHostVoxelBlocks();
+        LAUNCH_KERNEL(
+            ::doForEachAllocatedVoxel<T>,
+            count,
+            dim3(SDF_BLOCK_SIZE, SDF_BLOCK_SIZE, SDF_BLOCK_SIZE),
+            localVBA,
+            voxelBlockHash->getLowestFreeSequenceNumber(),
+            sequenceNumbers,
+            params.voxelSize_,
+            t
+            );
+    }
+
+    /**
+    CPU backend of doForEachAllocatedVoxel: calls T::process for all voxels of the blocks in use
+    on cpuThreadCount() threads (a voxel block per task, with work stealing), on a host copy of the blocks.
+    T must be declared with doForEachAllocatedVoxel_process_CPU_AND_GPU or doForEachAllocatedVoxel_process_member_CPU_AND_GPU.
 
+    The host copy is kept between calls: only the blocks allocated since the last call are copied to the host
+    (all of them after invalidateHostVoxelBlocks), and only the blocks process changed are copied back.
+    */
+    template<typename T>
+    void doForEachAllocatedVoxelOnCPU(const T& t = T()) {
+        const uint n = voxelBlockHash->getLowestFreeSequenceNumber();
+        ITMVoxelBlock* const blocks = updateHostVoxelBlocks();
+        std::vector<uchar> changed(n, 0);
+
+        CoordinateSystem* const global = CoordinateSystem::global(); // created on first use, not thread safe
+        const float voxelSize_ = params.voxelSize_;
+        parallelForWorkStealing(n, [blocks, global, voxelSize_, t, &changed](uint index) {
+            if (index == 0) return;
+            ITMVoxelBlock* const vb = &blocks[index];
+            if (vb->pos_ == INVALID_VOXEL_BLOCK_POS) return; // removed
+
+            unsigned char before[sizeof(ITMVoxelBlock)]; // no ITMVoxel constructors on the host
+            memcpy(before, vb, sizeof(ITMVoxelBlock));
+            for (int z = 0; z < SDF_BLOCK_SIZE; z++)
+                for (int y = 0; y < SDF_BLOCK_SIZE; y++)
+                    for (int x = 0; x < SDF_BLOCK_SIZE; x++) {
+                        const Vector3i localPos(x, y, z);
+                        const Vector3i globalPos = vb->pos_.toInt() * SDF_BLOCK_SIZE + localPos;
+                        t.process(vb, vb->getVoxel(localPos), localPos, globalPos, Point(global, globalPos.toFloat() * voxelSize_));
+                    }
+            changed[index] = memcmp(before, vb, sizeof(ITMVoxelBlock)) != 0;
+        });
+
+        std::vector<uint> sequenceNumbers;
+        for (uint i = 0; i < n; i++) if (changed[i]) sequenceNumbers.push_back(i);
+        copyHostVoxelBlocksToDevice(sequenceNumbers);
+    }
+
+    /// Drops the host copy of the voxel blocks that doForEachAllocatedVoxelOnCPU keeps, such that its next call copies all of them.
+    /// The Scene calls this whenever it changes blocks on the device other than by allocating them.
+    /// Kernels that write voxels through getVoxel or getVoxelBlock must call it too.
+    void invalidateHostVoxelBlocks() {
+        hostVoxelBlockCount = 0;
+    }
+
+    /// T must have an operator(ITMVoxelBlock*)
+    /// t is passed to the kernel, for T with a member process (doForEachAllocatedVoxelBlock_process_member).
+    template<typename T>
+    void doForEachAllocatedVoxelBlock(const T& t = T()) {
+        invalidateHostVoxelBlocks();
+        const uint n = voxelBlockHash->getLowestFreeSequenceNumber();
         dim3 blockSize(256);
-        dim3 gridSize((int)ceil((float)SDF_LOCAL_BLOCK_NUM / (float)blockSize.x));
+        dim3 gridSize((int)ceil((float)n / (float)blockSize.x));
         LAUNCH_KERNEL(
             ::doForEachAllocatedVoxelBlock<T>,
             gridSize,
             blockSize,
             localVBA,
-            voxelBlockHash->getLowestFreeSequenceNumber()
+            n,
+            (const uint*)NULL,
+            n,
+            t
             );
     }
 
-    static GPU_ONLY ITMVoxel* getCurrentSceneVoxel(Vector3i pos) {
-        assert(getCurrentScene());
-        return getCurrentScene()->getVoxel(pos);
-    }
-    static GPU_ONLY void requestCurrentSceneVoxelBlockAllocation(VoxelBlockPos pos) {
-        assert(getCurrentScene());
-        return getCurrentScene()->requestVoxelBlockAllocation(pos);
-    }
-
-    static void Scene::performCurrentSceneAllocations() {
-        assert(getCurrentScene());
-        getCurrentScene()->performAllocations();
+    /// Like doForEachAllocatedVoxelBlock, but only for the count voxel blocks listed in sequenceNumbers (device memory)
+    template<typename T>
+    void doForEachAllocatedVoxelBlock(const uint* const sequenceNumbers, const uint count, const T& t = T()) {
+        if (count == 0) return;
+        invalidateHostVoxelBlocks();
+        dim3 blockSize(256);
+        dim3 gridSize((int)ceil((float)count / (float)blockSize.x));
+        LAUNCH_KERNEL(
+            ::doForEachAllocatedVoxelBlock<T>,
+            gridSize,
+            blockSize,
+            localVBA,
+            voxelBlockHash->getLowestFreeSequenceNumber(),
+            sequenceNumbers,
+            count,
+            t
+            );
     }
 
-
     /** !private! But has to be placed in public for HashMap to access it - unless we make that a friend */
     struct Z3Hasher {
         typedef VoxelBlockPos KeyType;
         static const uint BUCKET_NUM = SDF_BUCKET_NUM; // Number of Hash Bucket, must be 2^n (otherwise we have to use % instead of & below)
 
-        static GPU_ONLY uint hash(const VoxelBlockPos& blockPos) {
+        static CPU_AND_GPU uint hash(const VoxelBlockPos& blockPos) {
             return (((uint)blockPos.x * 73856093u) ^ ((uint)blockPos.y * 19349669u) ^ ((uint)blockPos.z * 83492791u))
                 &
                 (uint)(BUCKET_NUM - 1);
         }
     };
 
-    /** !private! But has to be placed in public for HashMap to access it - unless we make that a friend*/
-    struct AllocateVB {
-        static __device__ void allocate(VoxelBlockPos pos, int sequenceId);
-    };
+    /** !private! But has to be placed in public for HashMap to access it - unless we make that a friend
+    Alternative to Z3Hasher, see VOXEL_BLOCK_HASHER: the lowest bits of the Morton code of the position,
+    such that blocks which are close in space mostly end up in nearby buckets.
+    Positions whose coordinates differ by multiples of 2^(log2(BUCKET_NUM)/3) blocks collide.
+    */
+    struct MortonHasher {
+        typedef VoxelBlockPos KeyType;
+        static const uint BUCKET_NUM = SDF_BUCKET_NUM; // Number of Hash Bucket, must be 2^n
 
-    // Scene is mostly fixed. // TODO prefer using a scoping construct that lives together with the call stack!
-    // Having it globally accessible heavily reduces having
-    // to pass parameters.
-    static CPU_AND_GPU Scene* getCurrentScene();
-
-    /// Change current scene for the current block/scope
-    class CurrentSceneScope {
-    public:
-        CurrentSceneScope(Scene* const newCurrentScene) : 
-            oldCurrentScene(Scene::getCurrentScene()) {
-            Scene::setCurrentScene(newCurrentScene);
+        /// Interleaves the lowest 10 bits of x, y and z: ... z1 y1 x1 z0 y0 x0
+        static CPU_AND_GPU uint code(const VoxelBlockPos& blockPos) {
+            return spread((uint)blockPos.x) | (spread((uint)blockPos.y) << 1) | (spread((uint)blockPos.z) << 2);
         }
-        ~CurrentSceneScope() {
-            Scene::setCurrentScene(oldCurrentScene);
+
+        static CPU_AND_GPU uint hash(const VoxelBlockPos& blockPos) {
+            return code(blockPos) & (uint)(BUCKET_NUM - 1);
         }
 
     private:
-        Scene* const oldCurrentScene;
+        /// Moves bit i of the lowest 10 bits of x to bit 3i
+        static CPU_AND_GPU uint spread(uint x) {
+            x &= 0x3ff;
+            x = (x | (x << 16)) & 0x030000ff;
+            x = (x | (x << 8)) & 0x0300f00f;
+            x = (x | (x << 4)) & 0x030c30c3;
+            x = (x | (x << 2)) & 0x09249249;
+            return x;
+        }
     };
-#define CURRENT_SCENE_SCOPE(s) Scene::CurrentSceneScope currentSceneScope(s);
-private:
 
-    static void setCurrentScene(Scene* s);
+    /** !private! But has to be placed in public for HashMap to access it - unless we make that a friend*/
+    /// Passed to voxelBlockHash by the Scene constructor, so that concurrent allocations in different scenes don't interfere.
+    struct AllocateVB {
+        Scene* scene;
 
-    GPU_ONLY DEVICEPTR(ITMVoxelBlock*) getVoxelBlock(VoxelBlockPos pos);
+        AllocateVB(Scene* const scene = 0) : scene(scene) {}
+        __device__ void allocate(VoxelBlockPos pos, int sequenceId);
+        __device__ void deallocate(VoxelBlockPos pos, int sequenceId);
+    };
+
+    /** !private! Sequence numbers of uniformVoxelBlocks index uniformPaletteIndices, which the Scene fills itself */
+    struct KeepUniformVB {
+        static __device__ void allocate(VoxelBlockPos pos, int sequenceId) {}
+        static __device__ void deallocate(VoxelBlockPos pos, int sequenceId) {}
+    };
+
+    /// Voxel size, truncation band etc. of this scene.
+    /// The engines and their kernels read them from here.
+    const ITMSceneParams params;
+    /// Voxel block and voxel coordinates of this scene, see getVoxelCoordinateSystems. Shared by the scenes with the same voxel size.
+    CoordinateSystem* voxelBlockCoordinateSystem;
+    CoordinateSystem* voxelCoordinateSystem;
+
+    /// The next coarser level of a multi-resolution scene (see createMultiResolution), NULL for the coarsest. Owned.
+    Scene* coarser;
+    /// 0 for the finest level
+    uint level;
+    /// Fuse allocates blocks in this level for the depth samples in [x, y), in world space coordinates
+    Vector2f levelDepthRange;
+
+private:
+    /// Maps storage for and initializes the blocks allocated by the last allocation pass, decompressing uniform ones,
+    /// then calls swapIn
+    void finishAllocations();
+    /// Restores the newly allocated blocks that were swapped out
+    void swapIn();
+    /// Grows uniformPaletteIndices and uniformPositions to hold at least capacity entries, keeping their content
+    void reserveUniformPaletteIndices(uint capacity);
+    /// In debug builds, asserts that the palette still holds paletteValues, i.e. nothing wrote to a compressed block
+    /// through getVoxel or getVoxelBlock
+    void checkPalette();
+    /// Copies all blocks to hostVoxelBlocks unless it is up to date, \returns it
+    ITMVoxelBlock* updateHostVoxelBlocks();
+    /// Copies the count blocks allocated by the last allocation pass to hostVoxelBlocks, unless it is invalid
+    void copyAllocatedVoxelBlocksToHost(uint count);
+    /// Copies the blocks of hostVoxelBlocks with the given sequence numbers to the device
+    void copyHostVoxelBlocksToDevice(const std::vector<uint>& sequenceNumbers);
 
      public: // these two could be private where it not for testing/debugging
-    DEVICEPTR(ITMVoxelBlock*) localVBA;
+    VoxelBlockPool* localVBA;
    
     /// Gives indices into localVBA for allocated voxel blocks
-    HashMap<Z3Hasher, AllocateVB>* voxelBlockHash;
+    typedef VOXEL_BLOCK_HASH_MAP<VOXEL_BLOCK_HASHER, AllocateVB> VoxelBlockHashMap;
+    VoxelBlockHashMap* voxelBlockHash;
+
+    /// Counted by swapOutUnseenVoxelBlocks
+    uint frame;
+    /// Indexed by sequence number, like localVBA
+    DEVICEPTR(uint*) lastSeenFrame;
+    /// Sequence numbers and positions allocated since the last finishAllocations, *allocatedCount many
+    DEVICEPTR(uint*) allocatedSequenceNumbers;
+    DEVICEPTR(VoxelBlockPos*) allocatedPositions;
+    uint* allocatedCount; // managed
+
+    VoxelBlockStore* swappedOutVoxelBlocks;
+
+    /// Blocks compressed by compressUniformVoxelBlocks
+    typedef VOXEL_BLOCK_HASH_MAP<VOXEL_BLOCK_HASHER, KeepUniformVB> UniformVoxelBlockHashMap;
+    UniformVoxelBlockHashMap* uniformVoxelBlocks;
+    /// Indexed by sequence number of uniformVoxelBlocks, uniformPaletteIndicesCapacity many
+    DEVICEPTR(uchar*) uniformPaletteIndices;
+    /// The same for the positions of the compressed blocks (stale for free sequence numbers), used by crop
+    DEVICEPTR(VoxelBlockPos*) uniformPositions;
+    uint uniformPaletteIndicesCapacity;
+    /// uniformVoxelBlockPaletteSize blocks, the first paletteSize of which hold one value in all voxels
+    DEVICEPTR(ITMVoxelBlock*) palette;
+    uint paletteSize;
+    /// Host copy of the values of palette, paletteSize ITMVoxels
+    std::vector<unsigned char> paletteValues;
+
+    /// Host copy of the blocks with sequence numbers below hostVoxelBlockCount, kept by doForEachAllocatedVoxelOnCPU.
+    /// hostVoxelBlockCount is 0 when it is invalid, see invalidateHostVoxelBlocks
+    std::vector<unsigned char> hostVoxelBlocks;
+    uint hostVoxelBlockCount;
 
 };
@@ -58,10 +58,10 @@ static void render(void)
                 continue;
             }
 
-            auto z = rr.z*voxelSize; // convert raycastResult to world coordinates
+            auto z = rr.z*defaultVoxelSize; // convert raycastResult to world coordinates
 
-            z = viewFrustum_max*(z - viewFrustum_min) / 
-                (z*(viewFrustum_max - viewFrustum_min))
+            z = defaultViewFrustum_max*(z - defaultViewFrustum_min) / 
+                (z*(defaultViewFrustum_max - defaultViewFrustum_min))
                 
                 + 0.01 // a little bias to move it away
                 ;// (z - viewFrustum_min) / (viewFrustum_max - viewFrustum_min); // scale z to 0-1 according to 
@@ -130,8 +130,8 @@ static void render(void)
     float cy = intrin.projectionParamsSimple.py;
     float width = W;
     float height = H;
-    float zmin = viewFrustum_min;
-    float zmax = viewFrustum_max;
+    float zmin = defaultViewFrustum_min;
+    float zmax = defaultViewFrustum_max;
 
     float columnMajorProjectionMatrix[16] = {
         // col1
@@ -168,7 +168,7 @@ glColor4f(0,1,1, 1);
     for (int i = 0; i < depth->dataSize; i++) {
         auto rr = depth->GetData()[i];
         if (rr.w != 1.0) continue; // raycast hit nothing
-        rr = rr*voxelSize; // convert raycastResult to world coordinates
+        rr = rr*defaultVoxelSize; // convert raycastResult to world coordinates
 
         glVertex3f(rr.x, rr.y, rr.z);
     }
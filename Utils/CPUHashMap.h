@@ -0,0 +1,256 @@
+#pragma once
+#include <atomic>
+#include <string.h>
+#include "PlatformIndependence.h"
+#include "MyAssert.h"
+#include "CPUParallel.h"
+
+typedef unsigned char uchar;
+typedef unsigned int uint;
+
+struct VoidCPUSequenceIdAllocationCallback {
+    template<typename T>
+    static void allocate(T, int sequenceId) {}
+};
+
+/**
+Implements the same
+
+key -> sequence#
+
+mapping as HashMap, but in host memory, for machines without a cuda device.
+Keys for which allocation is requested get assigned unique, consecutive unsigned integer numbers
+starting at 1.
+
+Stores at most Hasher::BUCKET_NUM + EXCESS_NUM - 1 entries.
+
+The contract is the same as for HashMap:
+After a series of requestAllocation(key) calls, performAllocations() must be called to make getSequenceNumber(key)
+return a unique nonzero value for key.
+At most one entry will be allocated per hash(key) in one requestAllocation(key) -> performAllocations() cycle.
+
+Threading:
+requestAllocation and getSequenceNumber may be called concurrently from any number of threads.
+performAllocations must not run concurrently with anything else, it distributes its work over all cores itself.
+
+Implementation: Same layout as HashMap (see HashMap.png), but the request flags and the
+counters for sequence numbers and excess list entries are std::atomic.
+Additionally, the indices of all requested entries are collected, such that performAllocations only has to visit those
+instead of the whole table.
+*/
+template<
+    typename Hasher, //!< must have static CPU_AND_GPU function uint Hasher::hash(const KeyType&) which generates values from 0 to Hasher::BUCKET_NUM-1
+    typename SequenceIdAllocationCallback = VoidCPUSequenceIdAllocationCallback //!< must have static host callable void allocate(KeyType k, int sequenceId) function
+>
+class CPUHashMap {
+public:
+    typedef typename Hasher::KeyType KeyType;
+
+private:
+    static const uint BUCKET_NUM = Hasher::BUCKET_NUM;
+    const uint EXCESS_NUM;
+    uint NUMBER_TOTAL_ENTRIES() const {
+        return (BUCKET_NUM + EXCESS_NUM);
+    }
+
+    struct HashEntry {
+    public:
+        bool isAllocated() const {
+            return sequenceId != 0;
+        }
+        bool hasNextExcessList() const {
+            assert(isAllocated());
+            return nextInExcessList != 0;
+        }
+        uint getNextInExcessList() const {
+            assert(hasNextExcessList() && isAllocated());
+            return nextInExcessList;
+        }
+
+        bool hasKey(const KeyType& key) const {
+            assert(isAllocated());
+            return this->key == key;
+        }
+
+        void linkToExcessListEntry(const uint excessListId) {
+            assert(!hasNextExcessList() && isAllocated() && excessListId >= 1);
+            nextInExcessList = excessListId;
+        }
+
+        void allocate(const KeyType& key, const uint sequenceId) {
+            assert(!isAllocated() && nextInExcessList == 0);
+            assert(sequenceId > 0);
+            this->key = key;
+            this->sequenceId = sequenceId;
+
+            SequenceIdAllocationCallback::allocate(key, sequenceId);
+        }
+
+        uint getSequenceId() const {
+            assert(isAllocated());
+            return sequenceId;
+        }
+    private:
+        KeyType key;
+        /// any of 1 to lowestFreeExcessListEntry-1
+        /// 0 means this entry ends a list of excess entries
+        uint nextInExcessList;
+        /// any of 1 to lowestFreeSequenceNumber-1
+        /// 0 means this entry is not allocated
+        uint sequenceId;
+    };
+
+    /// 0 or 1, BUCKET_NUM + EXCESS_NUM many
+    std::atomic<uchar>* needsAllocation;
+    KeyType* naKey;
+
+    /// hashMap_then_excessList entries for which needsAllocation was set since the last performAllocations,
+    /// requestedEntriesCount many. Each entry occurs at most once, so BUCKET_NUM + EXCESS_NUM suffice.
+    uint* requestedEntries;
+    std::atomic<uint> requestedEntriesCount;
+
+    /// BUCKET_NUM + EXCESS_NUM many
+    /// Indexed by Hasher::hash() return value
+    // or BUCKET_NUM + HashEntry.nextInExcessList (which is any of 1 to lowestFreeExcessListEntry-1)
+    HashEntry* hashMap_then_excessList;
+
+    HashEntry& hashMap(const uint hash) {
+        assert(hash < BUCKET_NUM);
+        return hashMap_then_excessList[hash];
+    }
+    HashEntry& excessList(const uint excessListEntry) {
+        assert(excessListEntry >= 1 && excessListEntry < EXCESS_NUM);
+        return hashMap_then_excessList[BUCKET_NUM + excessListEntry];
+    }
+
+    /// Sequence numbers already used up. Starts at 1 (sequence number 0 is used to signify non-allocated)
+    std::atomic<uint> lowestFreeSequenceNumber;
+
+    /// Excess list slots already used up. Starts at 1 (one safeguard entry)
+    std::atomic<uint> lowestFreeExcessListEntry;
+
+    /// Follows the excess list starting at hashMap[Hasher::hash(key)]
+    /// until either hashEntry.key == key, returning true
+    /// or until hashEntry does not exist or hashEntry.key != key but there is no further entry, returns false in that case.
+    bool findEntry(const KeyType& key,//!< [in]
+        HashEntry& hashEntry, //!< [out]
+        uint& hashMap_then_excessList_entry //!< [out]
+        ) {
+        hashMap_then_excessList_entry = Hasher::hash(key);
+        assert(hashMap_then_excessList_entry < BUCKET_NUM);
+        hashEntry = hashMap(hashMap_then_excessList_entry);
+
+        if (!hashEntry.isAllocated()) return false;
+        if (hashEntry.hasKey(key)) return true;
+
+        // try excess list
+        int safe = 0;
+        while (hashEntry.hasNextExcessList()) {
+            hashEntry = excessList(hashMap_then_excessList_entry = hashEntry.getNextInExcessList());
+            hashMap_then_excessList_entry += BUCKET_NUM; // the hashMap_then_excessList_entry must include the offset by BUCKET_NUM
+            if (hashEntry.hasKey(key)) return true;
+            if (safe++ > 100) assert(false);
+        }
+        return false;
+    }
+
+    void allocate(HashEntry& hashEntry, const KeyType & key) {
+        hashEntry.allocate(key, lowestFreeSequenceNumber.fetch_add(1));
+    }
+
+    void performAllocation(const uint hashMap_then_excessList_entry) {
+        assert(hashMap_then_excessList_entry < NUMBER_TOTAL_ENTRIES());
+        assert(needsAllocation[hashMap_then_excessList_entry]);
+        assert(hashMap_then_excessList_entry != BUCKET_NUM); // never allocate guard
+
+        needsAllocation[hashMap_then_excessList_entry] = 0;
+        const KeyType key = naKey[hashMap_then_excessList_entry];
+
+        // Allocate in place if not allocated
+        HashEntry& hashEntry = hashMap_then_excessList[hashMap_then_excessList_entry];
+
+        if (!hashEntry.isAllocated()) {
+            allocate(hashEntry, key);
+            return;
+        }
+
+        // If existing, allocate new and link parent to child
+        const uint excessListId = lowestFreeExcessListEntry.fetch_add(1);
+        HashEntry& newHashEntry = excessList(excessListId);
+        assert(!newHashEntry.isAllocated());
+        hashEntry.linkToExcessListEntry(excessListId);
+
+        allocate(newHashEntry, key);
+    }
+
+public:
+    CPUHashMap(const uint EXCESS_NUM //<! must be at least one
+        ) : EXCESS_NUM(EXCESS_NUM) {
+        assert(EXCESS_NUM >= 1);
+        needsAllocation = new std::atomic<uchar>[NUMBER_TOTAL_ENTRIES()];
+        naKey = new KeyType[NUMBER_TOTAL_ENTRIES()];
+        requestedEntries = new uint[NUMBER_TOTAL_ENTRIES()];
+        hashMap_then_excessList = new HashEntry[NUMBER_TOTAL_ENTRIES()];
+
+        memset(hashMap_then_excessList, 0, sizeof(HashEntry) * NUMBER_TOTAL_ENTRIES());
+        for (uint i = 0; i < NUMBER_TOTAL_ENTRIES(); i++) needsAllocation[i] = 0;
+
+        requestedEntriesCount = 0;
+        lowestFreeSequenceNumber = lowestFreeExcessListEntry = 1;
+    }
+
+    virtual ~CPUHashMap() {
+        delete[] needsAllocation;
+        delete[] naKey;
+        delete[] requestedEntries;
+        delete[] hashMap_then_excessList;
+    }
+
+    uint getLowestFreeSequenceNumber() const {
+        return lowestFreeSequenceNumber;
+    }
+
+    /**
+    Requests allocation for a specific key.
+    Only one request can be made per hash(key) before performAllocations must be called.
+    Further requests will be ignored.
+    */
+    void requestAllocation(const KeyType& key) {
+        HashEntry hashEntry; uint hashMap_then_excessList_entry;
+
+        bool alreadyExists = findEntry(key, hashEntry, hashMap_then_excessList_entry);
+        if (alreadyExists) return;
+
+        assert(hashMap_then_excessList_entry != BUCKET_NUM &&
+            hashMap_then_excessList_entry < NUMBER_TOTAL_ENTRIES());
+
+        // only the first request for this entry gets through
+        uchar notRequested = 0;
+        if (!needsAllocation[hashMap_then_excessList_entry].compare_exchange_strong(notRequested, 1)) return;
+
+        naKey[hashMap_then_excessList_entry] = key;
+        requestedEntries[requestedEntriesCount.fetch_add(1)] = hashMap_then_excessList_entry;
+    }
+
+    /**
+    Allocates entries that requested allocation. Allocates at most one entry per hash(key).
+    Further requests can allocate colliding entries.
+
+    Runs on all cores.
+    */
+    void performAllocations() {
+        const uint n = requestedEntriesCount;
+        assert(n <= NUMBER_TOTAL_ENTRIES());
+        parallelFor(n, [this](uint i) {
+            performAllocation(requestedEntries[i]);
+        });
+        requestedEntriesCount = 0;
+    }
+
+    /// \returns 0 if the key is not allocated
+    uint getSequenceNumber(const KeyType& key) {
+        HashEntry hashEntry; uint _;
+        if (!findEntry(key, hashEntry, _)) return 0;
+        return hashEntry.getSequenceId();
+    }
+};
@@ -0,0 +1,98 @@
+#pragma once
+
+#include <thread>
+#include <vector>
+#include <algorithm>
+#include <atomic>
+#include <memory>
+
+/// Number of threads used by the cpu implementations (e.g. CPUHashMap).
+/// One per hardware thread.
+inline unsigned int cpuThreadCount() {
+    const unsigned int n = std::thread::hardware_concurrency();
+    return n == 0 ? 1 : n;
+}
+
+/** apply
+f(i)
+for all i from 0 to n-1, distributed over cpuThreadCount() threads.
+
+Each thread handles one contiguous range of indices.
+Returns when all f(i) have returned.
+*/
+template<typename F>
+void parallelFor(const unsigned int n, F f) {
+    if (n == 0) return;
+    const unsigned int threadCount = std::min(cpuThreadCount(), n);
+    const unsigned int perThread = (n + threadCount - 1) / threadCount;
+
+    std::vector<std::thread> threads;
+    threads.reserve(threadCount);
+    for (unsigned int t = 0; t < threadCount; t++) {
+        const unsigned int begin = t * perThread;
+        const unsigned int end = std::min(n, begin + perThread);
+        threads.push_back(std::thread([=, &f]() {
+            for (unsigned int i = begin; i < end; i++) f(i);
+        }));
+    }
+    for (auto& t : threads) t.join();
+}
+
+/** apply
+f(i)
+for all i from 0 to n-1, distributed over cpuThreadCount() threads, with work stealing.
+
+Like parallelFor, each thread starts with one contiguous range of indices, which it works through
+grain (at least 1) indices at a time from the front. A thread that is done steals the back half of the biggest range left,
+so threads whose indices are cheap help those whose indices are expensive.
+For loops whose iterations differ in cost, e.g. over image rows or voxel blocks.
+Returns when all f(i) have returned.
+*/
+template<typename F>
+void parallelForWorkStealing(const unsigned int n, F f, const unsigned int grain = 1) {
+    if (n == 0 || grain == 0) return;
+    const unsigned int threadCount = std::min(cpuThreadCount(), n);
+    const unsigned int perThread = (n + threadCount - 1) / threadCount;
+
+    // begin << 32 | end of the indices a thread has left, changed only by compare and swap
+    typedef unsigned long long Range;
+    auto range = [](const unsigned int begin, const unsigned int end) { return (Range)begin << 32 | end; };
+    const std::unique_ptr<std::atomic<Range>[]> ranges(new std::atomic<Range>[threadCount]);
+    for (unsigned int t = 0; t < threadCount; t++)
+        ranges[t] = range(std::min(n, t * perThread), std::min(n, (t + 1) * perThread));
+
+    auto work = [&](const unsigned int t) {
+        while (true) {
+            // take from the front of the own range
+            Range r = ranges[t];
+            const unsigned int begin = (unsigned int)(r >> 32), end = (unsigned int)r;
+            if (begin < end) {
+                const unsigned int taken = std::min(end, begin + grain);
+                if (!ranges[t].compare_exchange_weak(r, range(taken, end))) continue;
+                for (unsigned int i = begin; i < taken; i++) f(i);
+                continue;
+            }
+
+            // steal the back half of the biggest range, the own one is empty so no one steals from it meanwhile
+            unsigned int victim = t, biggest = 1;
+            for (unsigned int v = 0; v < threadCount; v++) {
+                const Range vr = ranges[v];
+                const unsigned int size = (unsigned int)vr - (unsigned int)(vr >> 32);
+                if (size > biggest) { victim = v; biggest = size; }
+            }
+            if (victim == t) return; // nothing worth stealing left, the owners finish
+            Range vr = ranges[victim];
+            const unsigned int vbegin = (unsigned int)(vr >> 32), vend = (unsigned int)vr;
+            if (vend <= vbegin + 1) continue;
+            const unsigned int middle = vbegin + (vend - vbegin) / 2;
+            if (ranges[victim].compare_exchange_strong(vr, range(vbegin, middle)))
+                ranges[t] = range(middle, vend);
+        }
+    };
+
+    std::vector<std::thread> threads;
+    threads.reserve(threadCount - 1);
+    for (unsigned int t = 1; t < threadCount; t++) threads.push_back(std::thread(work, t));
+    work(0);
+    for (auto& t : threads) t.join();
+}
@@ -1,20 +1,76 @@
-#pragma once 
+#pragma once
 #include "CUDADefines.h"
 #include "ITMMath.h"
 #include "MemoryBlock.h"
 #include "ITMCUDAUtils.h"
+#include "HashMapBatchedLookup.h"
+#include "HashMapStatistics.h"
+#include <algorithm>
+#include <vector>
+#include <stdexcept>
+#include <string>
+#include <stdio.h>
+#include <errno.h>
+#include <string.h>
 
 // Forward declarations
 template<typename Hasher, typename AllocCallback> class HashMap;
 template<typename Hasher, typename AllocCallback>
 KERNEL performAllocationKernel(typename HashMap<Hasher, AllocCallback>* hashMap);
+template<typename Hasher, typename AllocCallback>
+KERNEL rerequestAllocationKernel(typename HashMap<Hasher, AllocCallback>* hashMap, const uint count);
+template<typename Hasher, typename AllocCallback>
+KERNEL performRemovalKernel(typename HashMap<Hasher, AllocCallback>* hashMap);
+template<typename Hasher, typename AllocCallback>
+KERNEL requestRemovalKernel(typename HashMap<Hasher, AllocCallback>* hashMap, const typename Hasher::KeyType* keys, const uint count);
+template<typename Hasher, typename AllocCallback>
+KERNEL migrationKernel(typename HashMap<Hasher, AllocCallback>* hashMap, const uint firstBucket, const uint endBucket);
+template<typename Hasher, typename AllocCallback>
+KERNEL collectStatisticsKernel(typename HashMap<Hasher, AllocCallback>* hashMap, HashMapStatistics* statistics, const bool old);
+template<typename Hasher, typename AllocCallback>
+KERNEL remapSequenceNumbersKernel(typename HashMap<Hasher, AllocCallback>* hashMap, const uint* newSequenceNumbers);
 
 #define hprintf(...) //printf(__VA_ARGS__) // enable for verbose radio debug messages
 
 struct VoidSequenceIdAllocationCallback {
     template<typename T>
     static __device__ void allocate(T, int sequenceId) {}
+    template<typename T>
+    static __device__ void deallocate(T, int sequenceId) {}
 };
+/**
+File access of HashMap::write and read, and of the scene dumps that contain them.
+Throws std::runtime_error when not all of the data could be written or read, since continuing would
+store or restore a partial table.
+*/
+static void fileError(const char* const what, FILE* const file) {
+    throw std::runtime_error(std::string(what) + ": " + (ferror(file) ? strerror(errno) : "unexpected end of file"));
+}
+
+/// Writes count elements of host memory p to file
+template<typename T> static void fwriteChecked(const T* const p, const size_t count, FILE* const file) {
+    if (fwrite(p, sizeof(T), count, file) != count) fileError("cannot write", file);
+}
+
+/// Reads count elements from file to host memory p
+template<typename T> static void freadChecked(T* const p, const size_t count, FILE* const file) {
+    if (fread(p, sizeof(T), count, file) != count) fileError("cannot read", file);
+}
+
+/// Writes count elements of device memory p to file, used by HashMap::write
+template<typename T> static void fwriteDevice(const T* const p, const uint count, FILE* const file) {
+    std::vector<T> host(count);
+    cudaSafeCall(cudaMemcpy(host.data(), p, sizeof(T) * count, cudaMemcpyDeviceToHost));
+    fwriteChecked(host.data(), count, file);
+}
+
+/// Reads count elements from file to device memory p, used by HashMap::read
+template<typename T> static void freadDevice(T* const p, const uint count, FILE* const file) {
+    std::vector<T> host(count);
+    freadChecked(host.data(), count, file);
+    cudaSafeCall(cudaMemcpy(p, host.data(), sizeof(T) * count, cudaMemcpyHostToDevice));
+}
+
 /**
 Implements a
 
@@ -23,32 +79,52 @@ key -> sequence#
 mapping on the GPU, where keys for which allocation is requested get assigned unique, consecutive unsigned integer numbers
 starting at 1.
 
-Stores at most Hasher::BUCKET_NUM + EXCESS_NUM - 1 entries.
+Starts out with initialBucketNum buckets and EXCESS_NUM - 1 excess list entries
+and grows when needed, up to Hasher::BUCKET_NUM buckets and an excess list of any size.
 
 After a series of requestAllocation(key) calls, performAllocations() must be called to make getSequenceId(key)
 return a unique nonzero value for key.
 Allocation is not guaranteed in only one requestAllocation(key) -> performAllocations() cycle:
-At most one entry will be allocated per hash(key) in one such cycle.
+At most one entry will be allocated per bucket in one such cycle, and requests that find the excess list full
+are dropped (the excess list is bigger in the next cycle).
+Use performAllocationsCompletely() instead to allocate all requested keys at once.
+
+Keys can be removed again with requestRemoval(key) -> performRemovals() (or removeKeys).
+Their sequence numbers and excess list entries are recycled by later allocations, so
+getLowestFreeSequenceNumber() stays bounded by the largest number of keys ever stored at the same time.
+Sequence numbers below getLowestFreeSequenceNumber() are thus not necessarily in use.
+Removals must not be performed while allocation requests are outstanding.
 
 Note: As this reads from global memory it might be advisable to cache results,
 especially when it is expected that the same entry is accessed multiple times from the same thread.
 TODO Can we provide this functionality from here? Maybe force the creation of some object including a cache to access this.
 */
-/* Implementation: See HashMap.png */
+/* Implementation: See HashMap.png
+
+Growing:
+When there are more entries than buckets or more than 3/4 of the excess list are in use (or it ran full),
+a bigger Table is allocated and becomes the one new entries go to.
+The entries of the old table are moved over incrementally, MIGRATION_STEP old buckets at the end of every
+performAllocations, so no single frame pays for rehashing everything.
+Until then, keys in old buckets >= migratedBuckets are looked up in both tables. Sequence numbers do not change.
+
+The new bucket of a key is hash(key) & (bucketNum - 1). Since bucketNum at most doubles, it is congruent to the old bucket
+modulo the old bucketNum, so the thread migrating an old bucket is the only one writing to its new buckets.
+*/
 template<
-    typename Hasher, //!< must have static __device__ function uint Hasher::hash(const KeyType&) which generates values from 0 to Hasher::BUCKET_NUM-1 
-    typename SequenceIdAllocationCallback = VoidSequenceIdAllocationCallback //!< must have static __device__ void  allocate(KeyType k, int sequenceId) function
+    typename Hasher, //!< must have static __device__ function uint Hasher::hash(const KeyType&) which generates values from 0 to Hasher::BUCKET_NUM-1
+    typename SequenceIdAllocationCallback = VoidSequenceIdAllocationCallback //!< must have __device__ void allocate(KeyType k, int sequenceId) and deallocate(KeyType k, int sequenceId) functions, called on the instance passed to the constructor
 >
 class HashMap : public Managed {
 public:
     typedef Hasher::KeyType KeyType;
 
+    /// Number of old buckets moved to the new table per performAllocations while growing
+    static const uint MIGRATION_STEP = 0x8000;
+
 private:
+    /// Maximum number of buckets, must be 2^n
     static const uint BUCKET_NUM = Hasher::BUCKET_NUM;
-    const uint EXCESS_NUM;
-    CPU_AND_GPU uint NUMBER_TOTAL_ENTRIES() const {
-        return (BUCKET_NUM + EXCESS_NUM);
-    }
 
     struct HashEntry {
     public:
@@ -82,8 +158,6 @@ private:
             this->key = key;
             this->sequenceId = sequenceId;
 
-            SequenceIdAllocationCallback::allocate(key, sequenceId);
-
             hprintf("allocated %d\n", sequenceId);
         }
 
@@ -91,6 +165,44 @@ private:
             assert(isAllocated());
             return sequenceId;
         }
+
+        GPU_ONLY KeyType getKey() {
+            assert(isAllocated());
+            return key;
+        }
+
+        /// Skip the next entry in the excess list, which must be removedEntry
+        GPU_ONLY void unlinkExcessListEntry(HashEntry& removedEntry) {
+            assert(hasNextExcessList() && removedEntry.isAllocated());
+            nextInExcessList = removedEntry.nextInExcessList;
+        }
+
+        /// clear() must follow
+        GPU_ONLY void deallocate() {
+            assert(isAllocated());
+
+            hprintf("deallocated %d\n", sequenceId);
+        }
+
+        /// Make this unused again, after deallocate() or after the data was moved elsewhere
+        GPU_ONLY void clear() {
+            sequenceId = 0;
+            nextInExcessList = 0;
+        }
+
+        /// Replace the sequence number s by newSequenceNumbers[s], without notifying the callback
+        GPU_ONLY void remapSequenceId(const uint* const newSequenceNumbers) {
+            if (!isAllocated()) return;
+            sequenceId = newSequenceNumbers[sequenceId];
+            assert(sequenceId > 0);
+        }
+
+        /// Give key and sequence number to the unused target, without notifying the callback (used when growing)
+        GPU_ONLY void moveTo(HashEntry& target) {
+            assert(isAllocated() && !target.isAllocated() && target.nextInExcessList == 0);
+            target.key = key;
+            target.sequenceId = sequenceId;
+        }
     private:
         KeyType key;
         /// any of 1 to lowestFreeExcessListEntry-1
@@ -101,83 +213,375 @@ private:
         uint sequenceId;
     };
 
-public:
-    /// 0 or 1, BUCKET_NUM + EXCESS_NUM many
-    GPU(uchar*) needsAllocation;
-    GPU(KeyType*) naKey;
-private:
-    /// BUCKET_NUM + EXCESS_NUM many
-    /// Indexed by Hasher::hash() return value
-    // or BUCKET_NUM + HashEntry.nextInExcessList (which is any of 1 to lowestFreeExcessListEntry-1)
-    GPU(HashEntry*) hashMap_then_excessList;
+    /** Allocate a block of CUDA memory and memset it to 0 */
+    template<typename T> static void zeroMalloc(T*& p, const uint count = 1) {
+        cudaSafeCall(cudaMalloc(&p, sizeof(T) * count));
+        cudaSafeCall(cudaMemset(p, 0, sizeof(T) * count));
+    }
 
+    /** Replace a block of CUDA memory by a bigger, zeroed one, keeping the first keep elements */
+    template<typename T> static void zeroRealloc(T*& p, const uint keep, const uint count) {
+        assert(keep <= count);
+        T* q;
+        zeroMalloc(q, count);
+        cudaSafeCall(cudaMemcpy(q, p, sizeof(T) * keep, cudaMemcpyDeviceToDevice));
+        cudaFree(p);
+        p = q;
+    }
 
-    GPU_ONLY HashEntry& hashMap(const uint hash) {
-        assert(hash < BUCKET_NUM);
-        return hashMap_then_excessList[hash];
+    /// Free lists are only pushed to in performRemovalKernel and only popped from in performAllocationKernel and migrationKernel,
+    /// so push and pop never race.
+    GPU_ONLY static uint pop(uint* const freeList, int* const freeCount, uint* const lowestFree) {
+        const int i = atomicSub(freeCount, 1);
+        if (i > 0) return freeList[i - 1];
+        return atomicAdd(lowestFree, 1);
     }
-    GPU_ONLY HashEntry& excessList(const uint excessListEntry) {
-        assert(excessListEntry >= 1 && excessListEntry < EXCESS_NUM);
-        return hashMap_then_excessList[BUCKET_NUM + excessListEntry];
+    GPU_ONLY static void push(uint* const freeList, int* const freeCount, const uint x) {
+        freeList[atomicAdd(freeCount, 1)] = x;
+    }
+
+    /// Values of Table::needsAllocation
+    static const uint NOT_REQUESTED = 0;
+    static const uint REQUESTED = 1;
+    /// Taken by requestAllocation, but naKey is not written yet
+    static const uint REQUEST_WRITING = 2;
+
+    /// Reads a key that another thread might just have written, bypassing the (incoherent) L1 cache
+    GPU_ONLY static KeyType loadVolatile(const KeyType* const p) {
+        KeyType key;
+        const volatile uchar* const from = reinterpret_cast<const volatile uchar*>(p);
+        uchar* const to = reinterpret_cast<uchar*>(&key);
+        for (uint i = 0; i < sizeof(KeyType); i++) to[i] = from[i];
+        return key;
+    }
+
+    /**
+    The buckets and the excess list, i.e. the storage of the HashMap at one size.
+    While growing there are two of these.
+    */
+    struct Table {
+        /// 2^n, at most BUCKET_NUM
+        uint bucketNum;
+        /// Excess list entry 0 is never used (safeguard), so there are excessNum - 1 usable ones
+        uint excessNum;
+        CPU_AND_GPU uint NUMBER_TOTAL_ENTRIES() const {
+            return (bucketNum + excessNum);
+        }
+
+        /// NOT_REQUESTED or REQUESTED (REQUEST_WRITING only during requestAllocation), NUMBER_TOTAL_ENTRIES() many
+        GPU(uint*) needsAllocation;
+        GPU(KeyType*) naKey;
+
+        /// 0 or 1, NUMBER_TOTAL_ENTRIES() many
+        GPU(uchar*) needsRemoval;
+
+        /// NUMBER_TOTAL_ENTRIES() many
+        /// Indexed by bucket(key)
+        // or bucketNum + HashEntry.nextInExcessList (which is any of 1 to lowestFreeExcessListEntry-1)
+        GPU(HashEntry*) hashMap_then_excessList;
+
+        /// Excess list slots already used up. Starts at 1 (one safeguard entry)
+        GPU(uint*) lowestFreeExcessListEntry;
+
+        /// Excess list slots below lowestFreeExcessListEntry that are free again. excessNum many.
+        GPU(uint*) freeExcessListEntries;
+        /// Signed like freeSequenceNumberCount, clamped to 0 after each allocation kernel.
+        GPU(int*) freeExcessListEntryCount;
+
+        /// Excess list entries that new allocations can still take in the current performAllocationKernel.
+        /// Goes negative when more are requested, which signals that the excess list ran full.
+        GPU(int*) excessListEntriesLeft;
+
+        /// Excess list entries kept free for the entries of the old table that still have to be moved here.
+        uint reservedExcessListEntries;
+
+        GPU_ONLY uint bucket(const KeyType& key) const {
+            const uint hash = Hasher::hash(key);
+            assert(hash < BUCKET_NUM);
+            return hash & (bucketNum - 1);
+        }
+
+        GPU_ONLY HashEntry& hashMap(const uint bucket) {
+            assert(bucket < bucketNum);
+            return hashMap_then_excessList[bucket];
+        }
+        GPU_ONLY HashEntry& excessList(const uint excessListEntry) {
+            assert(excessListEntry >= 1 && excessListEntry < excessNum);
+            return hashMap_then_excessList[bucketNum + excessListEntry];
+        }
+        GPU_ONLY HashEntry& entry(const uint hashMap_then_excessList_entry) {
+            assert(hashMap_then_excessList_entry < NUMBER_TOTAL_ENTRIES());
+            return hashMap_then_excessList[hashMap_then_excessList_entry];
+        }
+
+        /// Follows the excess list starting at hashMap[bucket(key)]
+        /// until either hashEntry.key == key, returning true
+        /// or until hashEntry does not exist or hashEntry.key != key but there is no further entry, returns false in that case.
+        GPU_ONLY bool findEntry(const KeyType& key,//!< [in]
+            HashEntry& hashEntry, //!< [out]
+            uint& hashMap_then_excessList_entry //!< [out]
+            ) {
+            hashMap_then_excessList_entry = bucket(key);
+            hprintf("%d %d\n", hashMap_then_excessList_entry, bucketNum);
+            hashEntry = hashMap(hashMap_then_excessList_entry);
+
+            if (!hashEntry.isAllocated()) return false;
+            if (hashEntry.hasKey(key)) return true;
+
+            // try excess list
+            int safe = 0;
+            while (hashEntry.hasNextExcessList()) {
+                hashEntry = excessList(hashMap_then_excessList_entry = hashEntry.getNextInExcessList());
+                hashMap_then_excessList_entry += bucketNum; // the hashMap_then_excessList_entry must include the offset by bucketNum
+                if (hashEntry.hasKey(key)) return true;
+                if (safe++ > 100) assert(false);
+            }
+            return false;
+        }
+
+        GPU_ONLY uint takeExcessListEntry() {
+            const uint excessListId = pop(freeExcessListEntries, freeExcessListEntryCount, lowestFreeExcessListEntry);
+            assert(excessListId >= 1 && excessListId < excessNum);
+            return excessListId;
+        }
+
+        /// Appends the entry e of the old table to the list of its bucket
+        GPU_ONLY void insert(HashEntry& e) {
+            HashEntry* tail = &hashMap(bucket(e.getKey()));
+            if (!tail->isAllocated()) {
+                e.moveTo(*tail);
+                return;
+            }
+            int safe = 0;
+            while (tail->hasNextExcessList()) {
+                tail = &excessList(tail->getNextInExcessList());
+                if (safe++ > 100) assert(false);
+            }
+            const uint excessListId = takeExcessListEntry(); // one of the reserved ones
+            e.moveTo(excessList(excessListId));
+            tail->linkToExcessListEntry(excessListId);
+        }
+
+        /// Excess list entries in use
+        uint countUsedExcessListEntries() const {
+            cudaDeviceSynchronize(); // want to read managed counters
+            return *lowestFreeExcessListEntry - 1 - *freeExcessListEntryCount;
+        }
+
+        void allocate(const uint bucketNum, const uint excessNum) {
+            assert(bucketNum >= 1 && bucketNum <= BUCKET_NUM && (bucketNum & (bucketNum - 1)) == 0);
+            assert(excessNum >= 1);
+            this->bucketNum = bucketNum;
+            this->excessNum = excessNum;
+            zeroMalloc(needsAllocation, NUMBER_TOTAL_ENTRIES());
+            zeroMalloc(naKey, NUMBER_TOTAL_ENTRIES()); // TODO zeroing not necessary
+            zeroMalloc(needsRemoval, NUMBER_TOTAL_ENTRIES());
+            zeroMalloc(hashMap_then_excessList, NUMBER_TOTAL_ENTRIES());
+            zeroMalloc(freeExcessListEntries, excessNum);
+
+            cudaMallocManaged(&lowestFreeExcessListEntry, sizeof(uint));
+            cudaMallocManaged(&freeExcessListEntryCount, sizeof(int));
+            cudaMallocManaged(&excessListEntriesLeft, sizeof(int));
+
+            cudaDeviceSynchronize();
+            *lowestFreeExcessListEntry = 1;
+            *freeExcessListEntryCount = *excessListEntriesLeft = 0;
+            reservedExcessListEntries = 0;
+        }
+
+        /// Makes all entries unused again, as after allocate
+        void clear() {
+            cudaSafeCall(cudaMemset(needsAllocation, 0, sizeof(uint) * NUMBER_TOTAL_ENTRIES()));
+            cudaSafeCall(cudaMemset(needsRemoval, 0, sizeof(uchar) * NUMBER_TOTAL_ENTRIES()));
+            cudaSafeCall(cudaMemset(hashMap_then_excessList, 0, sizeof(HashEntry) * NUMBER_TOTAL_ENTRIES()));
+
+            cudaSafeCall(cudaDeviceSynchronize());
+            *lowestFreeExcessListEntry = 1;
+            *freeExcessListEntryCount = *excessListEntriesLeft = 0;
+            reservedExcessListEntries = 0;
+        }
+
+        void free() {
+            cudaFree(needsAllocation);
+            cudaFree(naKey);
+            cudaFree(needsRemoval);
+            cudaFree(hashMap_then_excessList);
+            cudaFree(freeExcessListEntries);
+            cudaFree(lowestFreeExcessListEntry);
+            cudaFree(freeExcessListEntryCount);
+            cudaFree(excessListEntriesLeft);
+        }
+    };
+
+    /// Notified of every allocation and removal, lives in managed memory with this
+    SequenceIdAllocationCallback callback;
+
+    /// Where new entries are allocated
+    Table table;
+
+    /// While growing (migrating), the table entries are moved away from. Buckets below migratedBuckets are empty.
+    Table oldTable;
+    bool migrating;
+    uint migratedBuckets;
+    /// Number of entries moved by the last migrationKernel
+    GPU(uint*) migratedEntries;
+
+    /// Requests that could not be recorded in needsAllocation/naKey because another key
+    /// already requested the same entry, or that found the excess list full. Used by performAllocationsCompletely.
+    /// requestsCapacity many, the first *deferredRequestsCount are valid.
+    GPU(KeyType*) deferredRequests;
+    /// Can exceed requestsCapacity, in which case the excess requests were lost.
+    GPU(uint*) deferredRequestsCount;
+    /// Deferred requests of the previous round, resubmitted by rerequestAllocationKernel
+    GPU(KeyType*) rerequests;
+    /// Size of deferredRequests, rerequests and freeSequenceNumbers: at least the number of entries both tables can hold
+    uint requestsCapacity;
+
+    GPU_ONLY void deferRequest(const KeyType& key) {
+        const uint i = atomicAdd(deferredRequestsCount, 1);
+        if (i < requestsCapacity) deferredRequests[i] = key;
     }
 
+    /// See HashMapStatistics
+    GPU(uint*) collidedRequests;
+    GPU(uint*) droppedRequests;
 
     /// Sequence numbers already used up. Starts at 1 (sequence number 0 is used to signify non-allocated)
     GPU(uint*) lowestFreeSequenceNumber;
 
-    /// Excess list slots already used up. Starts at 1 (one safeguard entry)
-    GPU(uint*) lowestFreeExcessListEntry;
+    /// Sequence numbers below lowestFreeSequenceNumber that are free again.
+    /// requestsCapacity many, the first *freeSequenceNumberCount are valid.
+    GPU(uint*) freeSequenceNumbers;
+    /// Signed: goes negative during an allocation kernel when more sequence numbers are taken than were available.
+    /// Clamped to 0 afterwards.
+    GPU(int*) freeSequenceNumberCount;
 
-    /// Follows the excess list starting at hashMap[Hasher::hash(key)]
-    /// until either hashEntry.key == key, returning true
-    /// or until hashEntry does not exist or hashEntry.key != key but there is no further entry, returns false in that case.
-    GPU_ONLY bool findEntry(const KeyType& key,//!< [in]
+    /// Looks for key in the part of the old table that was not migrated yet
+    GPU_ONLY bool findOldEntry(const KeyType& key,//!< [in]
         HashEntry& hashEntry, //!< [out]
         uint& hashMap_then_excessList_entry //!< [out]
         ) {
-        hashMap_then_excessList_entry = Hasher::hash(key);
-        hprintf("%d %d\n", hashMap_then_excessList_entry, BUCKET_NUM);
-        assert(hashMap_then_excessList_entry < BUCKET_NUM);
-        hashEntry = hashMap(hashMap_then_excessList_entry);
+        if (!migrating || oldTable.bucket(key) < migratedBuckets) return false;
+        return oldTable.findEntry(key, hashEntry, hashMap_then_excessList_entry);
+    }
 
-        if (!hashEntry.isAllocated()) return false;
-        if (hashEntry.hasKey(key)) return true;
+    GPU_ONLY void allocate(HashEntry& hashEntry, const KeyType & key) {
+        hashEntry.allocate(key, pop(freeSequenceNumbers, freeSequenceNumberCount, lowestFreeSequenceNumber));
+        callback.allocate(key, hashEntry.getSequenceId());
+    }
+
+    /// Removes all entries of the bucket of t that requested removal.
+    /// When the entry in the bucket itself is removed, the next entry of its excess list is moved there,
+    /// so excess lists stay as short as possible and the bucket is only empty when its list is.
+    GPU_ONLY void performRemoval(Table& t, const uint bucket) {
+        if (bucket >= t.bucketNum) return;
 
-        // try excess list
+        const uint NONE = 0; // 0 is never an excess list entry
+        uint prev = NONE;
+        uint current = bucket;
         int safe = 0;
-        while (hashEntry.hasNextExcessList()) {
-            hashEntry = excessList(hashMap_then_excessList_entry = hashEntry.getNextInExcessList());
-            hashMap_then_excessList_entry += BUCKET_NUM; // the hashMap_then_excessList_entry must include the offset by BUCKET_NUM
-            if (hashEntry.hasKey(key)) return true;
+        while (true) {
             if (safe++ > 100) assert(false);
-        }
-        return false;
-    }
+            HashEntry& currentEntry = t.entry(current);
+            if (!currentEntry.isAllocated()) {
+                assert(current == bucket);
+                return;
+            }
+            const uint next = currentEntry.hasNextExcessList() ? t.bucketNum + currentEntry.getNextInExcessList() : NONE;
 
-    /** Allocate a block of CUDA memory and memset it to 0 */
-    template<typename T> static void zeroMalloc(T*& p, const uint count = 1) {
-        cudaSafeCall(cudaMalloc(&p, sizeof(T) * count));
-        cudaSafeCall(cudaMemset(p, 0, sizeof(T) * count));
+            if (!t.needsRemoval[current]) {
+                prev = current;
+                current = next;
+                if (current == NONE) return;
+                continue;
+            }
+
+            t.needsRemoval[current] = 0;
+            currentEntry.deallocate();
+            callback.deallocate(currentEntry.getKey(), currentEntry.getSequenceId());
+            push(freeSequenceNumbers, freeSequenceNumberCount, currentEntry.getSequenceId());
+
+            if (prev == NONE) {
+                // in the bucket itself
+                if (next == NONE) {
+                    currentEntry.clear();
+                    return;
+                }
+                // move next entry here and look at it again
+                currentEntry = t.entry(next);
+                t.needsRemoval[current] = t.needsRemoval[next];
+                t.needsRemoval[next] = 0;
+                t.entry(next).clear();
+                push(t.freeExcessListEntries, t.freeExcessListEntryCount, next - t.bucketNum);
+                continue;
+            }
+
+            // in the excess list
+            t.entry(prev).unlinkExcessListEntry(currentEntry);
+            currentEntry.clear();
+            push(t.freeExcessListEntries, t.freeExcessListEntryCount, current - t.bucketNum);
+            current = next;
+            if (current == NONE) return;
+        }
     }
 
-    GPU_ONLY void allocate(HashEntry& hashEntry, const KeyType & key) {
-        hashEntry.allocate(key, atomicAdd(lowestFreeSequenceNumber, 1));
+    /// Moves all entries of the old bucket to table
+    GPU_ONLY void migrate(const uint oldBucket) {
+        HashEntry* e = &oldTable.hashMap(oldBucket);
+        if (!e->isAllocated()) return;
+        uint moved = 0;
+        int safe = 0;
+        while (true) {
+            table.insert(*e);
+            moved++;
+            if (!e->hasNextExcessList()) break;
+            e = &oldTable.excessList(e->getNextInExcessList());
+            if (safe++ > 100) assert(false);
+        }
+        atomicAdd(migratedEntries, moved);
     }
 
     friend KERNEL performAllocationKernel<Hasher, SequenceIdAllocationCallback>(typename HashMap<Hasher, SequenceIdAllocationCallback>* hashMap);
+    friend KERNEL rerequestAllocationKernel<Hasher, SequenceIdAllocationCallback>(typename HashMap<Hasher, SequenceIdAllocationCallback>* hashMap, const uint count);
+    friend KERNEL performRemovalKernel<Hasher, SequenceIdAllocationCallback>(typename HashMap<Hasher, SequenceIdAllocationCallback>* hashMap);
+    friend KERNEL migrationKernel<Hasher, SequenceIdAllocationCallback>(typename HashMap<Hasher, SequenceIdAllocationCallback>* hashMap, const uint firstBucket, const uint endBucket);
+    friend KERNEL collectStatisticsKernel<Hasher, SequenceIdAllocationCallback>(typename HashMap<Hasher, SequenceIdAllocationCallback>* hashMap, HashMapStatistics* statistics, const bool old);
+    friend KERNEL remapSequenceNumbersKernel<Hasher, SequenceIdAllocationCallback>(typename HashMap<Hasher, SequenceIdAllocationCallback>* hashMap, const uint* newSequenceNumbers);
+
+    /// Adds the list of the bucket of t to the chain length histogram.
+    /// Buckets of the old table that were already migrated (or are empty) are not counted.
+    GPU_ONLY void collectStatistics(Table& t, const uint bucket, HashMapStatistics* const statistics, const bool old) {
+        if (bucket >= t.bucketNum) return;
+        if (old && bucket < migratedBuckets) return;
+
+        uint length = 0;
+        HashEntry* e = &t.hashMap(bucket);
+        if (e->isAllocated()) {
+            length = 1;
+            while (e->hasNextExcessList()) {
+                e = &t.excessList(e->getNextInExcessList());
+                length++;
+            }
+        }
+        if (old && length == 0) return;
+
+        if (!old && length > 0) atomicAdd(&statistics->occupiedBuckets, 1);
+        atomicAdd(&statistics->chainLengthHistogram[MIN(length, HashMapStatistics::CHAIN_LENGTH_HISTOGRAM_SIZE - 1)], 1);
+        atomicMax(&statistics->maxChainLength, length);
+    }
 
     GPU_ONLY void performAllocation(const uint hashMap_then_excessList_entry) {
-        if (hashMap_then_excessList_entry >= NUMBER_TOTAL_ENTRIES()) return;
-        if (!needsAllocation[hashMap_then_excessList_entry]) return;
-        assert(hashMap_then_excessList_entry != BUCKET_NUM); // never allocate guard
+        if (hashMap_then_excessList_entry >= table.NUMBER_TOTAL_ENTRIES()) return;
+        if (table.needsAllocation[hashMap_then_excessList_entry] == NOT_REQUESTED) return;
+        assert(hashMap_then_excessList_entry != table.bucketNum); // never allocate guard
         hprintf("performAllocation %d\n", hashMap_then_excessList_entry);
 
 
-        needsAllocation[hashMap_then_excessList_entry] = false;
-        KeyType key = naKey[hashMap_then_excessList_entry];
+        table.needsAllocation[hashMap_then_excessList_entry] = NOT_REQUESTED;
+        KeyType key = table.naKey[hashMap_then_excessList_entry];
 
         // Allocate in place if not allocated
-        HashEntry& hashEntry = hashMap_then_excessList[hashMap_then_excessList_entry];
+        HashEntry& hashEntry = table.hashMap_then_excessList[hashMap_then_excessList_entry];
 
         if (!hashEntry.isAllocated()) {
             hprintf("not allocated\n", hashMap_then_excessList_entry);
@@ -188,8 +592,13 @@ private:
         hprintf("hashEntry %d\n", hashEntry.getSequenceId());
 
         // If existing, allocate new and link parent to child
-        uint excessListId = atomicAdd(lowestFreeExcessListEntry, 1);
-        HashEntry& newHashEntry = excessList(excessListId);
+        if (atomicSub(table.excessListEntriesLeft, 1) <= 0) {
+            // excess list full, try again after growing
+            deferRequest(key);
+            return;
+        }
+        uint excessListId = table.takeExcessListEntry();
+        HashEntry& newHashEntry = table.excessList(excessListId);
         assert(!newHashEntry.isAllocated());
         hashEntry.linkToExcessListEntry(excessListId);
         assert(hashEntry.getNextInExcessList() == excessListId);
@@ -200,7 +609,7 @@ private:
 #ifdef _DEBUG
         // should now find this entry:
         HashEntry e; uint _;
-        bool found = findEntry(key, e, _);
+        bool found = table.findEntry(key, e, _);
         assert(found && e.getSequenceId() > 0);
         hprintf("%d = findEntry(), e.seqId = %d\n", found, e.getSequenceId());
 #endif
@@ -208,37 +617,85 @@ private:
 
 
 public:
-    HashMap(const uint EXCESS_NUM //<! must be at least one
-        ) : EXCESS_NUM(EXCESS_NUM) {
+    HashMap(const uint EXCESS_NUM, //<! initial size of the excess list, must be at least one
+        const uint initialBucketNum = BUCKET_NUM, //<! must be 2^n and at most Hasher::BUCKET_NUM
+        const SequenceIdAllocationCallback& callback = SequenceIdAllocationCallback() //<! copied, anything it points to must outlive this
+        ) : callback(callback) {
         assert(EXCESS_NUM >= 1);
-        zeroMalloc(needsAllocation, NUMBER_TOTAL_ENTRIES());
-        zeroMalloc(naKey, NUMBER_TOTAL_ENTRIES()); // TODO zeroing not necessary
-        zeroMalloc(hashMap_then_excessList, NUMBER_TOTAL_ENTRIES());
+        table.allocate(initialBucketNum, EXCESS_NUM);
+        migrating = false;
+        migratedBuckets = 0;
+
+        requestsCapacity = table.NUMBER_TOTAL_ENTRIES();
+        zeroMalloc(deferredRequests, requestsCapacity);
+        zeroMalloc(rerequests, requestsCapacity);
+        zeroMalloc(freeSequenceNumbers, requestsCapacity);
 
         cudaMallocManaged(&lowestFreeSequenceNumber, sizeof(uint));
-        cudaMallocManaged(&lowestFreeExcessListEntry, sizeof(uint));
+        cudaMallocManaged(&deferredRequestsCount, sizeof(uint));
+        cudaMallocManaged(&freeSequenceNumberCount, sizeof(int));
+        cudaMallocManaged(&migratedEntries, sizeof(uint));
+        cudaMallocManaged(&collidedRequests, sizeof(uint));
+        cudaMallocManaged(&droppedRequests, sizeof(uint));
 
         cudaDeviceSynchronize();
-        *lowestFreeSequenceNumber = *lowestFreeExcessListEntry = 1;
+        *lowestFreeSequenceNumber = 1;
+        *deferredRequestsCount = *migratedEntries = 0;
+        *collidedRequests = *droppedRequests = 0;
+        *freeSequenceNumberCount = 0;
     }
 
     virtual ~HashMap() {
-        cudaFree(needsAllocation);
-        cudaFree(naKey);
-        cudaFree(hashMap_then_excessList);
+        table.free();
+        if (migrating) oldTable.free();
+        cudaFree(deferredRequests);
+        cudaFree(rerequests);
+        cudaFree(freeSequenceNumbers);
         cudaFree(lowestFreeSequenceNumber);
-        cudaFree(lowestFreeExcessListEntry);
+        cudaFree(deferredRequestsCount);
+        cudaFree(freeSequenceNumberCount);
+        cudaFree(migratedEntries);
+        cudaFree(collidedRequests);
+        cudaFree(droppedRequests);
     }
-    
+
     CPU_AND_GPU // could be CPU only if it where not for debugging (and dumping) - do we need it at all?
     uint getLowestFreeSequenceNumber() {
     return *lowestFreeSequenceNumber;
     }
-/*
+
+    /// Number of keys currently stored
     uint countAllocatedEntries() {
-    return getLowestFreeSequenceNumber() - 1;
+        cudaDeviceSynchronize(); // want to read managed counters
+        return getLowestFreeSequenceNumber() - 1 - *freeSequenceNumberCount;
+    }
+
+    /// Current number of buckets, at most Hasher::BUCKET_NUM
+    uint getBucketNum() const {
+        return table.bucketNum;
+    }
+
+    /// Current size of the excess list
+    uint getExcessNum() const {
+        return table.excessNum;
     }
+
+    /// Whether entries are still being moved to a bigger table
+    bool isGrowing() const {
+        return migrating;
+    }
+
+    /**
+    For testing: copies the outstanding allocation requests to the host, one per entry of the table new entries go to.
+    needsAllocation[i] is nonzero when entry i was requested for key naKey[i].
     */
+    void getAllocationRequests(std::vector<uint>& needsAllocation, std::vector<KeyType>& naKey) const {
+        const uint entries = table.NUMBER_TOTAL_ENTRIES();
+        needsAllocation.resize(entries);
+        naKey.resize(entries);
+        cudaSafeCall(cudaMemcpy(needsAllocation.data(), table.needsAllocation, sizeof(uint) * entries, cudaMemcpyDeviceToHost));
+        cudaSafeCall(cudaMemcpy(naKey.data(), table.naKey, sizeof(KeyType) * entries, cudaMemcpyDeviceToHost));
+    }
 
     /**
     Requests allocation for a specific key.
@@ -248,61 +705,433 @@ public:
     GPU_ONLY void requestAllocation(const KeyType& key) {
         hprintf("requestAllocation \n");
 
-        HashEntry hashEntry; uint hashMap_then_excessList_entry;
+        HashEntry hashEntry; uint hashMap_then_excessList_entry, _;
 
-        bool alreadyExists = findEntry(key, hashEntry, hashMap_then_excessList_entry);
+        bool alreadyExists = findOldEntry(key, hashEntry, _) || table.findEntry(key, hashEntry, hashMap_then_excessList_entry);
         if (alreadyExists) {
             hprintf("already exists\n");
             return;
         }
         hprintf("request goes to %d\n", hashMap_then_excessList_entry);
 
-        // not strictly necessary, ordering is random anyways
-        if (needsAllocation[hashMap_then_excessList_entry]) {
-            hprintf("already requested\n");
+        assert(hashMap_then_excessList_entry != table.bucketNum &&
+            hashMap_then_excessList_entry < table.NUMBER_TOTAL_ENTRIES());
+
+        // Only one request per entry gets through, remember the others for performAllocationsCompletely.
+        // naKey is published before the entry becomes REQUESTED, so a request that sees REQUESTED reads the winning key.
+        uint* const state = &table.needsAllocation[hashMap_then_excessList_entry];
+        const uint previous = atomicCAS(state, NOT_REQUESTED, REQUEST_WRITING);
+        if (previous == NOT_REQUESTED) {
+            table.naKey[hashMap_then_excessList_entry] = key;
+            __threadfence();
+            atomicExch(state, REQUESTED);
             return;
         }
 
-        assert(hashMap_then_excessList_entry != BUCKET_NUM &&
-            hashMap_then_excessList_entry < NUMBER_TOTAL_ENTRIES());
-
-        needsAllocation[hashMap_then_excessList_entry] = true;
-        naKey[hashMap_then_excessList_entry] = key;
+        hprintf("already requested\n");
+        if (previous == REQUEST_WRITING) {
+            // might be this key, which the next round then finds allocated
+            deferRequest(key);
+            return;
+        }
+        __threadfence();
+        // the same key is usually requested many times, no need to defer it again
+        if (!(loadVolatile(&table.naKey[hashMap_then_excessList_entry]) == key)) {
+            atomicAdd(collidedRequests, 1);
+            deferRequest(key);
+        }
     }
 #define THREADS_PER_BLOCK 256
-    /**
-    Allocates entries that requested allocation. Allocates at most one entry per hash(key).
-    Further requests can allocate colliding entries.
-    */
-    void performAllocations() {
+private:
+    void launchPerformAllocationKernel() {
         cudaSafeCall(cudaGetLastError());
         cudaSafeCall(cudaDeviceSynchronize()); // Managed this is not accessible when still in use?
+        *table.excessListEntriesLeft = table.excessNum - 1 - table.countUsedExcessListEntries() - table.reservedExcessListEntries;
         performAllocationKernel << <
             /// Scheduling strategy: Fixed number of threads per block, working on all entries (to find those that have needsAllocation set)
-            (uint)ceil(NUMBER_TOTAL_ENTRIES() / (1. * THREADS_PER_BLOCK)),
+            (uint)ceil(table.NUMBER_TOTAL_ENTRIES() / (1. * THREADS_PER_BLOCK)),
             THREADS_PER_BLOCK
             >> >(this);
 #ifdef _DEBUG
         cudaSafeCall(cudaDeviceSynchronize());  // detect problems (failed assertions) early where this kernel is called
 #endif
         cudaSafeCall(cudaGetLastError());
+
+        // free lists were possibly over-popped
+        cudaDeviceSynchronize();
+        if (*freeSequenceNumberCount < 0) *freeSequenceNumberCount = 0;
+        if (*table.freeExcessListEntryCount < 0) *table.freeExcessListEntryCount = 0;
+
+        grow(*table.excessListEntriesLeft < 0);
+    }
+
+    /// Moves the next up to bucketCount old buckets to table
+    void migrationStep(const uint bucketCount) {
+        if (!migrating) return;
+        const uint endBucket = MIN(migratedBuckets + bucketCount, oldTable.bucketNum);
+
+        cudaDeviceSynchronize();
+        *migratedEntries = 0;
+        migrationKernel<Hasher, SequenceIdAllocationCallback> << <
+            (uint)ceil((endBucket - migratedBuckets) / (1. * THREADS_PER_BLOCK)),
+            THREADS_PER_BLOCK
+            >> >(this, migratedBuckets, endBucket);
+        cudaSafeCall(cudaGetLastError());
+        cudaSafeCall(cudaDeviceSynchronize());
+
+        assert(*migratedEntries <= table.reservedExcessListEntries);
+        table.reservedExcessListEntries -= *migratedEntries;
+        migratedBuckets = endBucket;
+        if (migratedBuckets < oldTable.bucketNum) return;
+
+        oldTable.free();
+        migrating = false;
+        table.reservedExcessListEntries = 0;
+    }
+
+    void completeMigration() {
+        if (migrating) migrationStep(oldTable.bucketNum);
+    }
+
+    /// Continues moving entries to the bigger table, then starts growing again if necessary.
+    /// Called after each performAllocationKernel, when there are no outstanding requests.
+    void grow(const bool excessListFull) {
+        if (excessListFull) completeMigration(); // need the space now
+        else migrationStep(MIGRATION_STEP);
+        if (migrating) return;
+
+        const uint entries = countAllocatedEntries();
+        const bool moreBuckets = entries > table.bucketNum && table.bucketNum < BUCKET_NUM;
+        const bool moreExcess = excessListFull || table.countUsedExcessListEntries() * 4 > (table.excessNum - 1) * 3;
+        if (!moreBuckets && !moreExcess) return;
+
+        oldTable = table;
+        // in the worst case, all old entries land in the excess list
+        table.allocate(
+            moreBuckets ? table.bucketNum * 2 : table.bucketNum,
+            MAX(moreExcess ? table.excessNum * 2 : table.excessNum, entries + 1));
+        table.reservedExcessListEntries = entries;
+        migrating = true;
+        migratedBuckets = 0;
+
+        // deferred requests and free sequence numbers must fit for both tables
+        const uint capacity = table.NUMBER_TOTAL_ENTRIES() + oldTable.NUMBER_TOTAL_ENTRIES();
+        cudaDeviceSynchronize();
+        zeroRealloc(deferredRequests, MIN(*deferredRequestsCount, requestsCapacity), capacity);
+        zeroRealloc(rerequests, 0, capacity);
+        zeroRealloc(freeSequenceNumbers, *freeSequenceNumberCount, capacity);
+        requestsCapacity = capacity;
+    }
+
+public:
+    /**
+    Allocates entries that requested allocation. Allocates at most one entry per hash(key).
+    Further requests can allocate colliding entries.
+    Also does the next step of growing.
+    */
+    void performAllocations() {
+        launchPerformAllocationKernel();
+        cudaDeviceSynchronize();
+        *droppedRequests += *deferredRequestsCount;
+        *deferredRequestsCount = 0; // deferred requests are dropped
+    }
+
+    /**
+    Allocates all entries that requested allocation since the last call to performAllocations(Completely).
+
+    Requests that collided with another request for the same entry (or found the excess list full) are deferred and resubmitted
+    internally until they are allocated. Each round allocates at least one key per hash(key) (unless the excess list ran full,
+    in which case it grows), so the number of rounds is bounded by the maximum number of new keys per hash(key)
+    plus the number of times the excess list has to grow.
+
+    Guaranteed to allocate every requested key, as long as no more requests than the two tables have entries
+    had to be deferred in one round. Otherwise the requests beyond that were lost: all others are still allocated,
+    then std::runtime_error is thrown (the lost ones count as droppedRequests).
+
+    \returns the number of rounds (performAllocationKernel launches) that were needed
+    */
+    uint performAllocationsCompletely() {
+        uint rounds = 0;
+        uint lostRequests = 0;
+        while (true) {
+            launchPerformAllocationKernel();
+            rounds++;
+
+            cudaDeviceSynchronize(); // want to read deferredRequestsCount
+            uint count = *deferredRequestsCount;
+            if (count > requestsCapacity) {
+                // only the first requestsCapacity were recorded
+                lostRequests += count - requestsCapacity;
+                count = requestsCapacity;
+            }
+            if (count == 0) break;
+
+            // resubmit all deferred requests, some of which might be deferred again
+            std::swap(deferredRequests, rerequests);
+            *deferredRequestsCount = 0;
+            rerequestAllocationKernel<Hasher, SequenceIdAllocationCallback> << <
+                (uint)ceil(count / (1. * THREADS_PER_BLOCK)),
+                THREADS_PER_BLOCK
+                >> >(this, count);
+            cudaSafeCall(cudaGetLastError());
+        }
+        if (lostRequests > 0) {
+            *droppedRequests += lostRequests;
+            throw std::runtime_error("HashMap::performAllocationsCompletely: " + std::to_string(lostRequests) +
+                " deferred requests did not fit and were not allocated");
+        }
+        return rounds;
+    }
+
+    /**
+    Requests removal of a specific key. Does nothing if the key is not allocated.
+    Any number of keys can be requested for removal before performRemovals.
+    */
+    GPU_ONLY void requestRemoval(const KeyType& key) {
+        HashEntry hashEntry; uint hashMap_then_excessList_entry;
+        if (table.findEntry(key, hashEntry, hashMap_then_excessList_entry))
+            table.needsRemoval[hashMap_then_excessList_entry] = 1;
+        else if (findOldEntry(key, hashEntry, hashMap_then_excessList_entry))
+            oldTable.needsRemoval[hashMap_then_excessList_entry] = 1;
+    }
+
+    /**
+    Removes all entries that requested removal, calling callback.deallocate for each of them.
+    Their sequence numbers and excess list entries will be reused by later allocations.
+    */
+    void performRemovals() {
+        cudaSafeCall(cudaGetLastError());
+        cudaSafeCall(cudaDeviceSynchronize());
+        performRemovalKernel << <
+            /// Scheduling strategy: one thread per bucket (of both tables), walking the whole excess list of that bucket
+            (uint)ceil(MAX(table.bucketNum, migrating ? oldTable.bucketNum : 0) / (1. * THREADS_PER_BLOCK)),
+            THREADS_PER_BLOCK
+            >> >(this);
+        cudaSafeCall(cudaGetLastError());
+        cudaSafeCall(cudaDeviceSynchronize());
+    }
+
+    /// Removes count keys given in device memory.
+    void removeKeys(const KeyType* const keys, const uint count) {
+        if (count == 0) return;
+        requestRemovalKernel<Hasher, SequenceIdAllocationCallback> << <
+            (uint)ceil(count / (1. * THREADS_PER_BLOCK)),
+            THREADS_PER_BLOCK
+            >> >(this, keys, count);
+        cudaSafeCall(cudaGetLastError());
+        performRemovals();
+    }
+
+    /**
+    Looks up count keys at once: out[i] = getSequenceNumber(keys[i]), 0 for keys that are not allocated.
+    keys and out must be in device memory.
+    Cheaper than individual lookups when many keys are known up front, see HashMapBatchedLookup.h.
+    */
+    void getSequenceNumbers(const KeyType* const keys, const uint count, uint* const out) {
+        batchedLookup::getSequenceNumbers<Hasher>(this, keys, count, out);
     }
 
     /// \returns 0 if the key is not allocated
     GPU_ONLY uint getSequenceNumber(const KeyType& key) {
         HashEntry hashEntry; uint _;
-        if (!findEntry(key, hashEntry, _)) return 0;
+        if (!table.findEntry(key, hashEntry, _) && !findOldEntry(key, hashEntry, _)) return 0;
         return hashEntry.getSequenceId();
     }
+
+    /**
+    Occupancy of the table right now, and the request counters since construction or resetRequestCounters().
+    Walks all lists once (one thread per bucket).
+    */
+    HashMapStatistics getStatistics() {
+        HashMapStatistics* statistics;
+        cudaSafeCall(cudaMallocManaged(&statistics, sizeof(HashMapStatistics)));
+        cudaSafeCall(cudaDeviceSynchronize());
+        memset(statistics, 0, sizeof(HashMapStatistics));
+
+        collectStatisticsKernel<Hasher, SequenceIdAllocationCallback> << <
+            (uint)ceil(table.bucketNum / (1. * THREADS_PER_BLOCK)),
+            THREADS_PER_BLOCK
+            >> >(this, statistics, false);
+        if (migrating) collectStatisticsKernel<Hasher, SequenceIdAllocationCallback> << <
+            (uint)ceil(oldTable.bucketNum / (1. * THREADS_PER_BLOCK)),
+            THREADS_PER_BLOCK
+            >> >(this, statistics, true);
+        cudaSafeCall(cudaGetLastError());
+        cudaSafeCall(cudaDeviceSynchronize());
+
+        HashMapStatistics s = *statistics;
+        cudaFree(statistics);
+        s.allocatedEntries = countAllocatedEntries();
+        s.bucketNum = table.bucketNum;
+        s.excessNum = table.excessNum;
+        s.usedExcessListEntries = table.countUsedExcessListEntries() + (migrating ? oldTable.countUsedExcessListEntries() : 0);
+        s.collidedRequests = *collidedRequests;
+        s.droppedRequests = *droppedRequests;
+        s.growing = migrating;
+        return s;
+    }
+
+    /**
+    Renumbers all entries: sequence number s becomes newSequenceNumbers[s].
+    newSequenceNumbers is in device memory, getLowestFreeSequenceNumber() many, and must map the sequence numbers in use
+    one-to-one to 1 to countAllocatedEntries(), so that afterwards no sequence numbers are free.
+    Does not notify SequenceIdAllocationCallback: the caller rearranges whatever it indexes by sequence number.
+    Finishes growing first, so only the entries of one table are renumbered
+    (the old table still holds stale copies of the entries already moved, and of keys removed since).
+    Must not be called while allocation or removal requests are outstanding.
+    */
+    void remapSequenceNumbers(const uint* const newSequenceNumbers) {
+        completeMigration();
+        const uint count = countAllocatedEntries();
+        remapSequenceNumbersKernel<Hasher, SequenceIdAllocationCallback> << <
+            (uint)ceil(table.NUMBER_TOTAL_ENTRIES() / (1. * THREADS_PER_BLOCK)),
+            THREADS_PER_BLOCK
+            >> >(this, newSequenceNumbers);
+        cudaSafeCall(cudaGetLastError());
+        cudaSafeCall(cudaDeviceSynchronize());
+
+        *lowestFreeSequenceNumber = count + 1;
+        *freeSequenceNumberCount = 0;
+    }
+
+    /// Restart counting collidedRequests and droppedRequests, e.g. once per frame
+    void resetRequestCounters() {
+        cudaDeviceSynchronize();
+        *collidedRequests = *droppedRequests = 0;
+    }
+
+    /**
+    Removes all entries at once, without notifying SequenceIdAllocationCallback:
+    a few memsets of the table, instead of walking the entries. Afterwards sequence numbers are handed out from 1 again.
+    Keeps the current size of the table (finishing or dropping an ongoing growth). Request counters are reset.
+    Must not be called while allocation or removal requests are outstanding.
+    */
+    void clear() {
+        cudaSafeCall(cudaDeviceSynchronize());
+        if (migrating) oldTable.free();
+        migrating = false;
+        migratedBuckets = 0;
+        table.clear();
+
+        *lowestFreeSequenceNumber = 1;
+        *freeSequenceNumberCount = 0;
+        *deferredRequestsCount = *migratedEntries = 0;
+        *collidedRequests = *droppedRequests = 0;
+    }
+
+    /**
+    Writes the entries and free lists to file, such that read restores exactly this state
+    (same keys, same sequence numbers) with a few bulk copies instead of replaying the allocations.
+    Finishes growing first. Throws std::runtime_error if the file cannot be written.
+    Must not be called while allocation or removal requests are outstanding.
+    */
+    void write(FILE* const file) {
+        completeMigration();
+        cudaSafeCall(cudaDeviceSynchronize());
+        assert(!migrating && *freeSequenceNumberCount >= 0 && *table.freeExcessListEntryCount >= 0);
+
+        const uint header[] = {
+            BUCKET_NUM, table.bucketNum, table.excessNum,
+            *table.lowestFreeExcessListEntry, (uint)*table.freeExcessListEntryCount,
+            *lowestFreeSequenceNumber, (uint)*freeSequenceNumberCount
+        };
+        fwriteChecked(header, 7, file);
+        fwriteDevice(table.hashMap_then_excessList, table.NUMBER_TOTAL_ENTRIES(), file);
+        fwriteDevice(table.freeExcessListEntries, header[4], file);
+        fwriteDevice(freeSequenceNumbers, header[6], file);
+    }
+
+    /**
+    Replaces the content of this by what write stored in file, for the same Hasher.
+    Does not notify SequenceIdAllocationCallback: the caller restores whatever it indexes by sequence number.
+    Request counters are reset.
+    Throws std::runtime_error if the file is too short or was written for another Hasher.
+    */
+    void read(FILE* const file) {
+        uint header[7];
+        freadChecked(header, 7, file);
+        if (header[0] != BUCKET_NUM) throw std::runtime_error("HashMap::read: written for another Hasher");
+        const uint bucketNum = header[1], excessNum = header[2];
+        assert(header[3] >= 1 && header[3] <= excessNum && header[4] < header[3]);
+        assert(header[5] >= 1 && header[6] < header[5]);
+
+        cudaSafeCall(cudaDeviceSynchronize());
+        table.free();
+        if (migrating) oldTable.free();
+        migrating = false;
+        migratedBuckets = 0;
+        table.allocate(bucketNum, excessNum);
+
+        // every sequence number below lowestFreeSequenceNumber was in use at some point, so they fit
+        requestsCapacity = MAX(requestsCapacity, table.NUMBER_TOTAL_ENTRIES());
+        assert(header[5] - 1 <= requestsCapacity);
+        zeroRealloc(deferredRequests, 0, requestsCapacity);
+        zeroRealloc(rerequests, 0, requestsCapacity);
+        zeroRealloc(freeSequenceNumbers, 0, requestsCapacity);
+
+        freadDevice(table.hashMap_then_excessList, table.NUMBER_TOTAL_ENTRIES(), file);
+        freadDevice(table.freeExcessListEntries, header[4], file);
+        freadDevice(freeSequenceNumbers, header[6], file);
+
+        cudaSafeCall(cudaDeviceSynchronize());
+        *table.lowestFreeExcessListEntry = header[3];
+        *table.freeExcessListEntryCount = header[4];
+        *lowestFreeSequenceNumber = header[5];
+        *freeSequenceNumberCount = header[6];
+        *deferredRequestsCount = *migratedEntries = 0;
+        *collidedRequests = *droppedRequests = 0;
+    }
 };
 
 template<typename Hasher, typename AllocCallback>
 KERNEL performAllocationKernel(typename HashMap<Hasher, AllocCallback>* hashMap) {
     assert(blockDim.x == THREADS_PER_BLOCK && blockDim.y == 1 && blockDim.z == 1);
     assert(
-        gridDim.x*blockDim.x >= hashMap->NUMBER_TOTAL_ENTRIES() && // all entries covered
+        gridDim.x*blockDim.x >= hashMap->table.NUMBER_TOTAL_ENTRIES() && // all entries covered
         gridDim.y == 1 &&
         gridDim.z == 1);
 
     hashMap->performAllocation(blockIdx.x*THREADS_PER_BLOCK + threadIdx.x);
 }
+
+template<typename Hasher, typename AllocCallback>
+KERNEL rerequestAllocationKernel(typename HashMap<Hasher, AllocCallback>* hashMap, const uint count) {
+    const uint i = blockIdx.x*THREADS_PER_BLOCK + threadIdx.x;
+    if (i >= count) return;
+    hashMap->requestAllocation(hashMap->rerequests[i]);
+}
+
+template<typename Hasher, typename AllocCallback>
+KERNEL performRemovalKernel(typename HashMap<Hasher, AllocCallback>* hashMap) {
+    const uint bucket = blockIdx.x*THREADS_PER_BLOCK + threadIdx.x;
+    hashMap->performRemoval(hashMap->table, bucket);
+    if (hashMap->migrating) hashMap->performRemoval(hashMap->oldTable, bucket);
+}
+
+template<typename Hasher, typename AllocCallback>
+KERNEL requestRemovalKernel(typename HashMap<Hasher, AllocCallback>* hashMap, const typename Hasher::KeyType* keys, const uint count) {
+    const uint i = blockIdx.x*THREADS_PER_BLOCK + threadIdx.x;
+    if (i >= count) return;
+    hashMap->requestRemoval(keys[i]);
+}
+
+template<typename Hasher, typename AllocCallback>
+KERNEL collectStatisticsKernel(typename HashMap<Hasher, AllocCallback>* hashMap, HashMapStatistics* statistics, const bool old) {
+    const uint bucket = blockIdx.x*THREADS_PER_BLOCK + threadIdx.x;
+    hashMap->collectStatistics(old ? hashMap->oldTable : hashMap->table, bucket, statistics, old);
+}
+
+template<typename Hasher, typename AllocCallback>
+KERNEL remapSequenceNumbersKernel(typename HashMap<Hasher, AllocCallback>* hashMap, const uint* newSequenceNumbers) {
+    auto& t = hashMap->table;
+    const uint i = blockIdx.x*THREADS_PER_BLOCK + threadIdx.x;
+    if (i >= t.NUMBER_TOTAL_ENTRIES()) return;
+    t.entry(i).remapSequenceId(newSequenceNumbers);
+}
+
+template<typename Hasher, typename AllocCallback>
+KERNEL migrationKernel(typename HashMap<Hasher, AllocCallback>* hashMap, const uint firstBucket, const uint endBucket) {
+    const uint oldBucket = firstBucket + blockIdx.x*THREADS_PER_BLOCK + threadIdx.x;
+    if (oldBucket >= endBucket) return;
+    hashMap->migrate(oldBucket);
+}
@@ -0,0 +1,100 @@
+#pragma once
+#include "CUDADefines.h"
+#include "cudaSafeCall.h"
+#include <thrust/device_vector.h>
+#include <thrust/sort.h>
+#include <thrust/scan.h>
+#include <thrust/functional.h>
+#include <thrust/execution_policy.h>
+
+/**
+Batched key -> sequence# lookup for HashMap and OpenAddressingHashMap, see their getSequenceNumbers.
+
+The keys are sorted by bucket (hash(key)) and then by key, so that
+* each distinct key is resolved by only one thread, and
+* threads of the same warp walk the same or neighbouring buckets (reading the same memory).
+The results are scattered back to the order of the input.
+*/
+namespace batchedLookup {
+
+    typedef unsigned int uint;
+
+    template<typename Hasher>
+    KERNEL hashKeys(const typename Hasher::KeyType* const keys, const uint count, uint* const hashes, uint* const order) {
+        const uint i = blockIdx.x * blockDim.x + threadIdx.x;
+        if (i >= count) return;
+        hashes[i] = Hasher::hash(keys[i]);
+        order[i] = i;
+    }
+
+    /// Orders key indices by hash, then by the bytes of the key (any total order on keys suffices to make equal keys adjacent)
+    template<typename KeyType>
+    struct ByHashThenKey {
+        const uint* hashes;
+        const KeyType* keys;
+
+        __host__ __device__ bool operator()(const uint a, const uint b) const {
+            if (hashes[a] != hashes[b]) return hashes[a] < hashes[b];
+            const unsigned char* ka = (const unsigned char*)&keys[a];
+            const unsigned char* kb = (const unsigned char*)&keys[b];
+            for (int i = 0; i < sizeof(KeyType); i++)
+                if (ka[i] != kb[i]) return ka[i] < kb[i];
+            return false;
+        }
+    };
+
+    /// leader[j] = j if the j-th key in sorted order differs from the previous one, 0 otherwise
+    template<typename KeyType>
+    KERNEL findLeaders(const KeyType* const keys, const uint* const order, const uint count, uint* const leader) {
+        const uint j = blockIdx.x * blockDim.x + threadIdx.x;
+        if (j >= count) return;
+        leader[j] = (j == 0 || !(keys[order[j]] == keys[order[j - 1]])) ? j : 0;
+    }
+
+    template<typename Map>
+    KERNEL resolveLeaders(Map* const map, const typename Map::KeyType* const keys, const uint* const order, const uint count, const uint* const leader, uint* const sortedOut) {
+        const uint j = blockIdx.x * blockDim.x + threadIdx.x;
+        if (j >= count || leader[j] != j) return;
+        sortedOut[j] = map->getSequenceNumber(keys[order[j]]);
+    }
+
+    static KERNEL scatter(const uint* const order, const uint count, const uint* const leader, const uint* const sortedOut, uint* const out) {
+        const uint j = blockIdx.x * blockDim.x + threadIdx.x;
+        if (j >= count) return;
+        out[order[j]] = sortedOut[leader[j]];
+    }
+
+    /// keys and out in device memory. out[i] is set to 0 for keys that are not allocated.
+    template<typename Hasher, typename Map>
+    void getSequenceNumbers(Map* const map, const typename Hasher::KeyType* const keys, const uint count, uint* const out) {
+        typedef typename Hasher::KeyType KeyType;
+        if (count == 0) return;
+
+        thrust::device_vector<uint> hashes(count), order(count), leader(count), sortedOut(count);
+        uint* const pHashes = thrust::raw_pointer_cast(hashes.data());
+        uint* const pOrder = thrust::raw_pointer_cast(order.data());
+        uint* const pLeader = thrust::raw_pointer_cast(leader.data());
+        uint* const pSortedOut = thrust::raw_pointer_cast(sortedOut.data());
+
+        const uint threads = 256;
+        const uint blocks = (count + threads - 1) / threads;
+
+        hashKeys<Hasher> << <blocks, threads >> >(keys, count, pHashes, pOrder);
+        cudaSafeCall(cudaGetLastError());
+
+        ByHashThenKey<KeyType> byHashThenKey = {pHashes, keys};
+        thrust::sort(thrust::device, pOrder, pOrder + count, byHashThenKey);
+
+        findLeaders<KeyType> << <blocks, threads >> >(keys, pOrder, count, pLeader);
+        cudaSafeCall(cudaGetLastError());
+        // leader[j] := index of the first occurrence of the j-th sorted key
+        thrust::inclusive_scan(thrust::device, pLeader, pLeader + count, pLeader, thrust::maximum<uint>());
+
+        resolveLeaders<Map> << <blocks, threads >> >(map, keys, pOrder, count, pLeader, pSortedOut);
+        cudaSafeCall(cudaGetLastError());
+
+        scatter << <blocks, threads >> >(pOrder, count, pLeader, pSortedOut, out);
+        cudaSafeCall(cudaGetLastError());
+        cudaSafeCall(cudaDeviceSynchronize());
+    }
+}
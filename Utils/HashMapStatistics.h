@@ -0,0 +1,70 @@
+#pragma once
+#include <string>
+#include <sstream>
+
+typedef unsigned int uint;
+
+/**
+Snapshot of the occupancy of a HashMap or OpenAddressingHashMap, see their getStatistics.
+
+Cheap enough to query once per frame, to size the tables and to notice degradation
+(long excess lists, many colliding or dropped allocation requests).
+*/
+struct HashMapStatistics {
+    /// chainLengthHistogram[i] counts the buckets holding i entries, the last one also counts all longer lists
+    static const uint CHAIN_LENGTH_HISTOGRAM_SIZE = 16;
+
+    /// Keys currently stored
+    uint allocatedEntries;
+
+    /// Current number of buckets
+    /// For OpenAddressingHashMap: slots
+    uint bucketNum;
+    /// Buckets holding at least one entry
+    /// For OpenAddressingHashMap: slots holding an entry
+    uint occupiedBuckets;
+
+    /// Current size of the excess list (0 for OpenAddressingHashMap)
+    uint excessNum;
+    /// Excess list entries in use
+    uint usedExcessListEntries;
+
+    /// For OpenAddressingHashMap: chainLengthHistogram[i] counts the entries stored i slots after the first one they probe
+    uint chainLengthHistogram[CHAIN_LENGTH_HISTOGRAM_SIZE];
+    /// Longest list (for OpenAddressingHashMap: longest distance of an entry from its first probe)
+    uint maxChainLength;
+
+    /// Requests that had to be postponed because another key had requested the same entry at the same time
+    /// (at most one request per bucket and performAllocations).
+    /// Counted since construction or resetRequestCounters.
+    uint collidedRequests;
+    /// Requests that were not allocated at all: requests postponed because of collisions or because the excess list was full
+    /// are dropped by performAllocations (performAllocationsCompletely resubmits them instead).
+    /// OpenAddressingHashMap only postpones a request while the slot it would take is just being requested by another thread.
+    /// Counted since construction or resetRequestCounters.
+    uint droppedRequests;
+
+    /// HashMap only: entries are being moved to a bigger table. The lists of both tables are counted in the histogram.
+    bool growing;
+
+    /// A single line JSON object with all the fields above
+    std::string toJSON() const {
+        std::ostringstream o;
+        o << "{"
+            << "\"allocatedEntries\":" << allocatedEntries
+            << ",\"bucketNum\":" << bucketNum
+            << ",\"occupiedBuckets\":" << occupiedBuckets
+            << ",\"excessNum\":" << excessNum
+            << ",\"usedExcessListEntries\":" << usedExcessListEntries
+            << ",\"chainLengthHistogram\":[";
+        for (uint i = 0; i < CHAIN_LENGTH_HISTOGRAM_SIZE; i++)
+            o << (i ? "," : "") << chainLengthHistogram[i];
+        o << "]"
+            << ",\"maxChainLength\":" << maxChainLength
+            << ",\"collidedRequests\":" << collidedRequests
+            << ",\"droppedRequests\":" << droppedRequests
+            << ",\"growing\":" << (growing ? "true" : "false")
+            << "}";
+        return o.str();
+    }
+};
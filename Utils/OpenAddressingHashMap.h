@@ -0,0 +1,560 @@
+#pragma once
+#include "HashMap.h" // VoidSequenceIdAllocationCallback, hprintf, THREADS_PER_BLOCK
+
+// Forward declarations
+template<typename Hasher, typename AllocCallback> class OpenAddressingHashMap;
+template<typename Hasher, typename AllocCallback>
+KERNEL performOpenAddressingAllocationKernel(typename OpenAddressingHashMap<Hasher, AllocCallback>* hashMap);
+template<typename Hasher, typename AllocCallback>
+KERNEL rerequestOpenAddressingAllocationKernel(typename OpenAddressingHashMap<Hasher, AllocCallback>* hashMap, const uint count);
+template<typename Hasher, typename AllocCallback>
+KERNEL rehashOpenAddressingKernel(typename OpenAddressingHashMap<Hasher, AllocCallback>* hashMap, const void* oldSlots);
+template<typename Hasher, typename AllocCallback>
+KERNEL performOpenAddressingRemovalKernel(typename OpenAddressingHashMap<Hasher, AllocCallback>* hashMap);
+template<typename Hasher, typename AllocCallback>
+KERNEL requestOpenAddressingRemovalKernel(typename OpenAddressingHashMap<Hasher, AllocCallback>* hashMap, const typename Hasher::KeyType* keys, const uint count);
+template<typename Hasher, typename AllocCallback>
+KERNEL collectOpenAddressingStatisticsKernel(typename OpenAddressingHashMap<Hasher, AllocCallback>* hashMap, HashMapStatistics* statistics);
+template<typename Hasher, typename AllocCallback>
+KERNEL remapOpenAddressingSequenceNumbersKernel(typename OpenAddressingHashMap<Hasher, AllocCallback>* hashMap, const uint* newSequenceNumbers);
+
+/**
+Drop-in alternative to HashMap (same template arguments, same interface and contract),
+storing the entries by open addressing instead of in excess lists:
+
+The entry of a key is in one of the MAX_PROBE slots following Hasher::hash(key) in a single table of
+BUCKET_NUM + EXCESS_NUM slots (so it uses the same amount of memory as the HashMap with the same arguments).
+Lookups read consecutive slots, instead of following the excess list with dependent random reads.
+
+Like for HashMap, allocation is not guaranteed in one requestAllocation(key) -> performAllocations() cycle:
+a request is postponed when the slot it would take is just being requested by another thread.
+performAllocationsCompletely() allocates all requested keys.
+
+Removed entries leave a tombstone which is skipped by lookups and reused by allocations.
+When more than an eighth of the slots are tombstones, performRemovals rehashes the table, so misses stay short.
+*/
+/* Implementation:
+requestAllocation probes the table from hash(key) on (the table does not change until performAllocations)
+and reserves the first empty or removed slot that no other key has requested, by setting its requestState with atomicCAS
+and writing the key to requestedKeys. Further requests of the same key find it there, so each key is requested once,
+however often it is requested. Finding a slot whose key is just being written (REQUEST_WRITING)
+postpones the request to the next round, because it might be the same key.
+performAllocationKernel runs one thread per slot and allocates the requested ones in place, without atomics on the slots.
+Lookups only happen in kernels other than performAllocationKernel.
+*/
+template<
+    typename Hasher, //!< must have static __device__ function uint Hasher::hash(const KeyType&) which generates values from 0 to Hasher::BUCKET_NUM-1
+    typename SequenceIdAllocationCallback = VoidSequenceIdAllocationCallback //!< must have __device__ void allocate(KeyType k, int sequenceId) and deallocate(KeyType k, int sequenceId) functions, called on the instance passed to the constructor
+>
+class OpenAddressingHashMap : public Managed {
+public:
+    typedef Hasher::KeyType KeyType;
+
+    /// Longest probe sequence. Allocation fails (assertion) if no free slot is found within it.
+    static const uint MAX_PROBE = 64;
+
+private:
+    static const uint BUCKET_NUM = Hasher::BUCKET_NUM;
+    const uint EXCESS_NUM;
+    /// Notified of every allocation and removal, lives in managed memory with this
+    SequenceIdAllocationCallback callback;
+    CPU_AND_GPU uint NUMBER_TOTAL_ENTRIES() const {
+        return (BUCKET_NUM + EXCESS_NUM);
+    }
+
+    /// Special values of Slot::sequenceId
+    static const uint EMPTY = 0;
+    static const uint REMOVED = 0xfffffffe;
+
+    struct Slot {
+        KeyType key;
+        /// any of 1 to lowestFreeSequenceNumber-1 or EMPTY or REMOVED
+        uint sequenceId;
+
+        GPU_ONLY bool isAllocated() const {
+            return sequenceId != EMPTY && sequenceId != REMOVED;
+        }
+    };
+
+    /// BUCKET_NUM + EXCESS_NUM many
+    GPU(Slot*) slots;
+
+    GPU_ONLY uint slotIndex(const KeyType& key, const uint probe) const {
+        const uint hash = Hasher::hash(key);
+        assert(hash < BUCKET_NUM);
+        return (hash + probe) % NUMBER_TOTAL_ENTRIES();
+    }
+
+    /// Values of requestState
+    static const uint NOT_REQUESTED = 0;
+    static const uint REQUEST_WRITING = 1;
+    static const uint REQUESTED = 2;
+
+    /// Per slot: whether requestedKeys holds a key that is to be allocated there. BUCKET_NUM + EXCESS_NUM many
+    GPU(uint*) requestState;
+    GPU(KeyType*) requestedKeys;
+
+    /// Requests postponed by requestAllocation, BUCKET_NUM + EXCESS_NUM many, the first *deferredRequestsCount are valid.
+    /// Resubmitted by performAllocationsCompletely.
+    GPU(KeyType*) deferredRequests;
+    /// Can exceed BUCKET_NUM + EXCESS_NUM, in which case the excess requests were lost
+    GPU(uint*) deferredRequestsCount;
+    /// Deferred requests of the previous round, resubmitted by rerequestOpenAddressingAllocationKernel
+    GPU(KeyType*) rerequests;
+
+    /// Slots holding REMOVED
+    GPU(uint*) removedSlots;
+
+    /// See HashMapStatistics
+    GPU(uint*) collidedRequests;
+    GPU(uint*) droppedRequests;
+
+    GPU_ONLY void deferRequest(const KeyType& key) {
+        const uint i = atomicAdd(deferredRequestsCount, 1);
+        if (i < NUMBER_TOTAL_ENTRIES()) deferredRequests[i] = key;
+    }
+
+    /// 0 or 1, BUCKET_NUM + EXCESS_NUM many
+    GPU(uchar*) needsRemoval;
+
+    /// Sequence numbers already used up. Starts at 1 (sequence number 0 is used to signify non-allocated)
+    GPU(uint*) lowestFreeSequenceNumber;
+
+    /// Sequence numbers below lowestFreeSequenceNumber that are free again, see HashMap
+    GPU(uint*) freeSequenceNumbers;
+    GPU(int*) freeSequenceNumberCount;
+
+    /// \returns the slot index of key or NUMBER_TOTAL_ENTRIES() if it is not allocated
+    GPU_ONLY uint findSlot(const KeyType& key) {
+        for (uint probe = 0; probe < MAX_PROBE; probe++) {
+            const uint i = slotIndex(key, probe);
+            const Slot slot = slots[i];
+            if (slot.sequenceId == EMPTY) break; // end of probe sequence
+            if (slot.sequenceId != REMOVED && slot.key == key) return i;
+        }
+        return NUMBER_TOTAL_ENTRIES();
+    }
+
+    /** Allocate a block of CUDA memory and memset it to 0 */
+    template<typename T> static void zeroMalloc(T*& p, const uint count = 1) {
+        cudaSafeCall(cudaMalloc(&p, sizeof(T) * count));
+        cudaSafeCall(cudaMemset(p, 0, sizeof(T) * count));
+    }
+
+    GPU_ONLY uint takeSequenceNumber() {
+        const int i = atomicSub(freeSequenceNumberCount, 1);
+        if (i > 0) return freeSequenceNumbers[i - 1];
+        return atomicAdd(lowestFreeSequenceNumber, 1);
+    }
+
+    friend KERNEL performOpenAddressingAllocationKernel<Hasher, SequenceIdAllocationCallback>(typename OpenAddressingHashMap<Hasher, SequenceIdAllocationCallback>* hashMap);
+    friend KERNEL rerequestOpenAddressingAllocationKernel<Hasher, SequenceIdAllocationCallback>(typename OpenAddressingHashMap<Hasher, SequenceIdAllocationCallback>* hashMap, const uint count);
+    friend KERNEL rehashOpenAddressingKernel<Hasher, SequenceIdAllocationCallback>(typename OpenAddressingHashMap<Hasher, SequenceIdAllocationCallback>* hashMap, const void* oldSlots);
+    friend KERNEL performOpenAddressingRemovalKernel<Hasher, SequenceIdAllocationCallback>(typename OpenAddressingHashMap<Hasher, SequenceIdAllocationCallback>* hashMap);
+    friend KERNEL collectOpenAddressingStatisticsKernel<Hasher, SequenceIdAllocationCallback>(typename OpenAddressingHashMap<Hasher, SequenceIdAllocationCallback>* hashMap, HashMapStatistics* statistics);
+    friend KERNEL remapOpenAddressingSequenceNumbersKernel<Hasher, SequenceIdAllocationCallback>(typename OpenAddressingHashMap<Hasher, SequenceIdAllocationCallback>* hashMap, const uint* newSequenceNumbers);
+
+    GPU_ONLY void performAllocation(const uint i) {
+        if (i >= NUMBER_TOTAL_ENTRIES() || requestState[i] != REQUESTED) return;
+        requestState[i] = NOT_REQUESTED;
+
+        Slot& slot = slots[i];
+        assert(!slot.isAllocated());
+        if (slot.sequenceId == REMOVED) atomicSub(removedSlots, 1);
+        slot.key = requestedKeys[i];
+        slot.sequenceId = takeSequenceNumber();
+        callback.allocate(slot.key, slot.sequenceId);
+        hprintf("allocated %d\n", slot.sequenceId);
+    }
+
+    /// Inserts the allocated slot oldSlot into the table, which holds no tombstones
+    GPU_ONLY void reinsert(const Slot& oldSlot) {
+        if (!oldSlot.isAllocated()) return;
+        for (uint probe = 0; probe < MAX_PROBE; probe++) {
+            const uint i = slotIndex(oldSlot.key, probe);
+            if (atomicCAS(&slots[i].sequenceId, EMPTY, oldSlot.sequenceId) == EMPTY) {
+                slots[i].key = oldSlot.key; // keys are distinct, no one looks at it before the kernel ends
+                return;
+            }
+        }
+        assert(false); // probe sequence full
+    }
+
+    GPU_ONLY void collectStatistics(const uint i, HashMapStatistics* const statistics) {
+        if (i >= NUMBER_TOTAL_ENTRIES() || !slots[i].isAllocated()) return;
+        const uint distance = (i + NUMBER_TOTAL_ENTRIES() - slotIndex(slots[i].key, 0)) % NUMBER_TOTAL_ENTRIES();
+        atomicAdd(&statistics->occupiedBuckets, 1);
+        atomicAdd(&statistics->chainLengthHistogram[MIN(distance, HashMapStatistics::CHAIN_LENGTH_HISTOGRAM_SIZE - 1)], 1);
+        atomicMax(&statistics->maxChainLength, distance);
+    }
+
+    GPU_ONLY void performRemoval(const uint i) {
+        if (i >= NUMBER_TOTAL_ENTRIES()) return;
+        if (!needsRemoval[i]) return;
+        needsRemoval[i] = 0;
+
+        Slot& slot = slots[i];
+        assert(slot.isAllocated());
+        callback.deallocate(slot.key, slot.sequenceId);
+        freeSequenceNumbers[atomicAdd(freeSequenceNumberCount, 1)] = slot.sequenceId;
+        slot.sequenceId = REMOVED;
+        atomicAdd(removedSlots, 1);
+    }
+
+    void launchPerformAllocationKernel() {
+        cudaSafeCall(cudaGetLastError());
+        cudaSafeCall(cudaDeviceSynchronize());
+        performOpenAddressingAllocationKernel<Hasher, SequenceIdAllocationCallback> << <
+            /// Scheduling strategy: one thread per slot (to find those that were requested)
+            (uint)ceil(NUMBER_TOTAL_ENTRIES() / (1. * THREADS_PER_BLOCK)),
+            THREADS_PER_BLOCK
+            >> >(this);
+        cudaSafeCall(cudaGetLastError());
+
+        // free list was possibly over-popped
+        cudaDeviceSynchronize();
+        if (*freeSequenceNumberCount < 0) *freeSequenceNumberCount = 0;
+    }
+
+    /// Reinserts all entries into an empty table, dropping the tombstones. Sequence numbers do not change.
+    void rehash() {
+        Slot* oldSlots;
+        cudaSafeCall(cudaMalloc(&oldSlots, sizeof(Slot) * NUMBER_TOTAL_ENTRIES()));
+        cudaSafeCall(cudaMemcpy(oldSlots, slots, sizeof(Slot) * NUMBER_TOTAL_ENTRIES(), cudaMemcpyDeviceToDevice));
+        cudaSafeCall(cudaMemset(slots, 0, sizeof(Slot) * NUMBER_TOTAL_ENTRIES())); // EMPTY
+        rehashOpenAddressingKernel<Hasher, SequenceIdAllocationCallback> << <
+            (uint)ceil(NUMBER_TOTAL_ENTRIES() / (1. * THREADS_PER_BLOCK)),
+            THREADS_PER_BLOCK
+            >> >(this, oldSlots);
+        cudaSafeCall(cudaGetLastError());
+        cudaSafeCall(cudaDeviceSynchronize());
+        cudaFree(oldSlots);
+        *removedSlots = 0;
+    }
+
+public:
+    OpenAddressingHashMap(const uint EXCESS_NUM, //<! must be at least one
+        const uint initialBucketNum = BUCKET_NUM, //<! ignored, only for compatibility with HashMap: this table does not grow
+        const SequenceIdAllocationCallback& callback = SequenceIdAllocationCallback() //<! copied, anything it points to must outlive this
+        ) : EXCESS_NUM(EXCESS_NUM), callback(callback) {
+        assert(EXCESS_NUM >= 1);
+        zeroMalloc(slots, NUMBER_TOTAL_ENTRIES());
+        zeroMalloc(requestState, NUMBER_TOTAL_ENTRIES());
+        zeroMalloc(requestedKeys, NUMBER_TOTAL_ENTRIES());
+        zeroMalloc(deferredRequests, NUMBER_TOTAL_ENTRIES());
+        zeroMalloc(rerequests, NUMBER_TOTAL_ENTRIES());
+        zeroMalloc(needsRemoval, NUMBER_TOTAL_ENTRIES());
+        zeroMalloc(freeSequenceNumbers, NUMBER_TOTAL_ENTRIES());
+
+        cudaMallocManaged(&deferredRequestsCount, sizeof(uint));
+        cudaMallocManaged(&removedSlots, sizeof(uint));
+        cudaMallocManaged(&lowestFreeSequenceNumber, sizeof(uint));
+        cudaMallocManaged(&freeSequenceNumberCount, sizeof(int));
+        cudaMallocManaged(&collidedRequests, sizeof(uint));
+        cudaMallocManaged(&droppedRequests, sizeof(uint));
+
+        cudaDeviceSynchronize();
+        *deferredRequestsCount = *removedSlots = 0;
+        *collidedRequests = *droppedRequests = 0;
+        *lowestFreeSequenceNumber = 1;
+        *freeSequenceNumberCount = 0;
+    }
+
+    virtual ~OpenAddressingHashMap() {
+        cudaFree(slots);
+        cudaFree(requestState);
+        cudaFree(requestedKeys);
+        cudaFree(deferredRequests);
+        cudaFree(rerequests);
+        cudaFree(needsRemoval);
+        cudaFree(freeSequenceNumbers);
+        cudaFree(deferredRequestsCount);
+        cudaFree(removedSlots);
+        cudaFree(lowestFreeSequenceNumber);
+        cudaFree(freeSequenceNumberCount);
+        cudaFree(collidedRequests);
+        cudaFree(droppedRequests);
+    }
+
+    CPU_AND_GPU uint getLowestFreeSequenceNumber() {
+        return *lowestFreeSequenceNumber;
+    }
+
+    /// Number of keys currently stored
+    uint countAllocatedEntries() {
+        cudaDeviceSynchronize(); // want to read managed counters
+        return getLowestFreeSequenceNumber() - 1 - *freeSequenceNumberCount;
+    }
+
+    /**
+    Requests allocation for a specific key.
+    Any number of requests can be made before performAllocations, the same key can be requested any number of times.
+    */
+    GPU_ONLY void requestAllocation(const KeyType& key) {
+        if (findSlot(key) != NUMBER_TOTAL_ENTRIES()) return; // already exists
+
+        for (uint probe = 0; probe < MAX_PROBE; probe++) {
+            const uint i = slotIndex(key, probe);
+            if (slots[i].isAllocated()) continue; // another key, findSlot did not find this one
+
+            const uint state = atomicCAS(&requestState[i], NOT_REQUESTED, REQUEST_WRITING);
+            if (state == NOT_REQUESTED) {
+                requestedKeys[i] = key;
+                __threadfence();
+                atomicExch(&requestState[i], REQUESTED);
+                return;
+            }
+            if (state == REQUEST_WRITING) {
+                // might be this key, try again next round
+                atomicAdd(collidedRequests, 1);
+                deferRequest(key);
+                return;
+            }
+            __threadfence();
+            if (requestedKeys[i] == key) return; // already requested
+            // requested by another key, the next free slot will do
+        }
+        assert(false); // probe sequence full
+    }
+
+    /**
+    Allocates entries that requested allocation.
+    Requests that collided with a concurrent request are dropped.
+    */
+    void performAllocations() {
+        launchPerformAllocationKernel();
+        *droppedRequests += *deferredRequestsCount;
+        *deferredRequestsCount = 0; // deferred requests are dropped
+    }
+
+    /**
+    Allocates all entries that requested allocation since the last call to performAllocations(Completely).
+    Guaranteed to allocate every requested key, as long as no more than BUCKET_NUM + EXCESS_NUM requests
+    had to be deferred in one round. Otherwise the requests beyond that were lost: all others are still allocated,
+    then std::runtime_error is thrown (the lost ones count as droppedRequests), like HashMap does.
+    \returns the number of rounds (performAllocationKernel launches) that were needed
+    */
+    uint performAllocationsCompletely() {
+        uint rounds = 0;
+        uint lostRequests = 0;
+        while (true) {
+            launchPerformAllocationKernel();
+            rounds++;
+
+            uint count = *deferredRequestsCount;
+            if (count > NUMBER_TOTAL_ENTRIES()) {
+                // only the first NUMBER_TOTAL_ENTRIES() were recorded
+                lostRequests += count - NUMBER_TOTAL_ENTRIES();
+                count = NUMBER_TOTAL_ENTRIES();
+            }
+            if (count == 0) break;
+
+            // resubmit all deferred requests, some of which might be deferred again
+            std::swap(deferredRequests, rerequests);
+            *deferredRequestsCount = 0;
+            rerequestOpenAddressingAllocationKernel<Hasher, SequenceIdAllocationCallback> << <
+                (uint)ceil(count / (1. * THREADS_PER_BLOCK)),
+                THREADS_PER_BLOCK
+                >> >(this, count);
+            cudaSafeCall(cudaGetLastError());
+        }
+        if (lostRequests > 0) {
+            *droppedRequests += lostRequests;
+            throw std::runtime_error("OpenAddressingHashMap::performAllocationsCompletely: " + std::to_string(lostRequests) +
+                " deferred requests did not fit and were not allocated");
+        }
+        return rounds;
+    }
+
+    /// Slots holding a tombstone, see performRemovals
+    uint countRemovedSlots() {
+        cudaDeviceSynchronize(); // want to read managed counter
+        return *removedSlots;
+    }
+
+    /**
+    Requests removal of a specific key. Does nothing if the key is not allocated.
+    */
+    GPU_ONLY void requestRemoval(const KeyType& key) {
+        const uint i = findSlot(key);
+        if (i == NUMBER_TOTAL_ENTRIES()) return;
+        needsRemoval[i] = 1;
+    }
+
+    /**
+    Removes all entries that requested removal, calling callback.deallocate for each of them.
+    Rehashes the table when more than an eighth of its slots are tombstones, so that the probe sequences of misses,
+    which end only at an empty slot, stay short.
+    */
+    void performRemovals() {
+        cudaSafeCall(cudaGetLastError());
+        cudaSafeCall(cudaDeviceSynchronize());
+        performOpenAddressingRemovalKernel<Hasher, SequenceIdAllocationCallback> << <
+            (uint)ceil(NUMBER_TOTAL_ENTRIES() / (1. * THREADS_PER_BLOCK)),
+            THREADS_PER_BLOCK
+            >> >(this);
+        cudaSafeCall(cudaGetLastError());
+        cudaSafeCall(cudaDeviceSynchronize());
+        if (*removedSlots > NUMBER_TOTAL_ENTRIES() / 8) rehash();
+    }
+
+    /// Removes count keys given in device memory.
+    void removeKeys(const KeyType* const keys, const uint count) {
+        if (count == 0) return;
+        requestOpenAddressingRemovalKernel<Hasher, SequenceIdAllocationCallback> << <
+            (uint)ceil(count / (1. * THREADS_PER_BLOCK)),
+            THREADS_PER_BLOCK
+            >> >(this, keys, count);
+        cudaSafeCall(cudaGetLastError());
+        performRemovals();
+    }
+
+    /**
+    Looks up count keys at once: out[i] = getSequenceNumber(keys[i]), 0 for keys that are not allocated.
+    keys and out must be in device memory.
+    Cheaper than individual lookups when many keys are known up front, see HashMapBatchedLookup.h.
+    */
+    void getSequenceNumbers(const KeyType* const keys, const uint count, uint* const out) {
+        batchedLookup::getSequenceNumbers<Hasher>(this, keys, count, out);
+    }
+
+    /// \returns 0 if the key is not allocated
+    GPU_ONLY uint getSequenceNumber(const KeyType& key) {
+        const uint i = findSlot(key);
+        if (i == NUMBER_TOTAL_ENTRIES()) return 0;
+        return slots[i].sequenceId;
+    }
+
+    /// See HashMap::getStatistics and HashMapStatistics for how the fields apply to open addressing
+    HashMapStatistics getStatistics() {
+        HashMapStatistics* statistics;
+        cudaSafeCall(cudaMallocManaged(&statistics, sizeof(HashMapStatistics)));
+        cudaSafeCall(cudaDeviceSynchronize());
+        memset(statistics, 0, sizeof(HashMapStatistics));
+
+        collectOpenAddressingStatisticsKernel<Hasher, SequenceIdAllocationCallback> << <
+            (uint)ceil(NUMBER_TOTAL_ENTRIES() / (1. * THREADS_PER_BLOCK)),
+            THREADS_PER_BLOCK
+            >> >(this, statistics);
+        cudaSafeCall(cudaGetLastError());
+        cudaSafeCall(cudaDeviceSynchronize());
+
+        HashMapStatistics s = *statistics;
+        cudaFree(statistics);
+        s.allocatedEntries = countAllocatedEntries();
+        s.bucketNum = NUMBER_TOTAL_ENTRIES();
+        s.excessNum = s.usedExcessListEntries = 0;
+        s.collidedRequests = *collidedRequests;
+        s.droppedRequests = *droppedRequests;
+        s.growing = false;
+        return s;
+    }
+
+    /// See HashMap::remapSequenceNumbers
+    void remapSequenceNumbers(const uint* const newSequenceNumbers) {
+        const uint count = countAllocatedEntries();
+        remapOpenAddressingSequenceNumbersKernel<Hasher, SequenceIdAllocationCallback> << <
+            (uint)ceil(NUMBER_TOTAL_ENTRIES() / (1. * THREADS_PER_BLOCK)),
+            THREADS_PER_BLOCK
+            >> >(this, newSequenceNumbers);
+        cudaSafeCall(cudaGetLastError());
+        cudaSafeCall(cudaDeviceSynchronize());
+
+        *lowestFreeSequenceNumber = count + 1;
+        *freeSequenceNumberCount = 0;
+    }
+
+    void resetRequestCounters() {
+        cudaDeviceSynchronize();
+        *collidedRequests = *droppedRequests = 0;
+    }
+
+    /// See HashMap::clear. Also drops the tombstones.
+    void clear() {
+        cudaSafeCall(cudaDeviceSynchronize());
+        cudaSafeCall(cudaMemset(slots, 0, sizeof(Slot) * NUMBER_TOTAL_ENTRIES())); // EMPTY
+        cudaSafeCall(cudaMemset(needsRemoval, 0, sizeof(uchar) * NUMBER_TOTAL_ENTRIES()));
+        cudaSafeCall(cudaMemset(requestState, 0, sizeof(uint) * NUMBER_TOTAL_ENTRIES())); // NOT_REQUESTED
+
+        cudaSafeCall(cudaDeviceSynchronize());
+        *lowestFreeSequenceNumber = 1;
+        *freeSequenceNumberCount = 0;
+        *deferredRequestsCount = *removedSlots = 0;
+        *collidedRequests = *droppedRequests = 0;
+    }
+
+    /// See HashMap::write
+    void write(FILE* const file) {
+        cudaSafeCall(cudaDeviceSynchronize());
+        assert(*freeSequenceNumberCount >= 0);
+
+        const uint header[] = { BUCKET_NUM, EXCESS_NUM, *lowestFreeSequenceNumber, (uint)*freeSequenceNumberCount };
+        fwriteChecked(header, 4, file);
+        fwriteDevice(slots, NUMBER_TOTAL_ENTRIES(), file);
+        fwriteDevice(freeSequenceNumbers, header[3], file);
+    }
+
+    /// See HashMap::read. The file must have been written by a table with the same EXCESS_NUM.
+    void read(FILE* const file) {
+        uint header[4];
+        freadChecked(header, 4, file);
+        if (header[0] != BUCKET_NUM || header[1] != EXCESS_NUM)
+            throw std::runtime_error("OpenAddressingHashMap::read: written for another Hasher or EXCESS_NUM");
+        assert(header[2] >= 1 && header[3] < header[2] && header[3] <= NUMBER_TOTAL_ENTRIES());
+
+        freadDevice(slots, NUMBER_TOTAL_ENTRIES(), file);
+        freadDevice(freeSequenceNumbers, header[3], file);
+        cudaSafeCall(cudaMemset(needsRemoval, 0, sizeof(uchar) * NUMBER_TOTAL_ENTRIES()));
+        cudaSafeCall(cudaMemset(requestState, 0, sizeof(uint) * NUMBER_TOTAL_ENTRIES())); // NOT_REQUESTED
+
+        cudaSafeCall(cudaDeviceSynchronize());
+        *lowestFreeSequenceNumber = header[2];
+        *freeSequenceNumberCount = header[3];
+        *deferredRequestsCount = 0;
+        *collidedRequests = *droppedRequests = 0;
+        rehash(); // drops the tombstones of the table that was written
+    }
+};
+
+template<typename Hasher, typename AllocCallback>
+KERNEL performOpenAddressingAllocationKernel(typename OpenAddressingHashMap<Hasher, AllocCallback>* hashMap) {
+    hashMap->performAllocation(blockIdx.x*THREADS_PER_BLOCK + threadIdx.x);
+}
+
+template<typename Hasher, typename AllocCallback>
+KERNEL rerequestOpenAddressingAllocationKernel(typename OpenAddressingHashMap<Hasher, AllocCallback>* hashMap, const uint count) {
+    const uint i = blockIdx.x*THREADS_PER_BLOCK + threadIdx.x;
+    if (i >= count) return;
+    hashMap->requestAllocation(hashMap->rerequests[i]);
+}
+
+template<typename Hasher, typename AllocCallback>
+KERNEL rehashOpenAddressingKernel(typename OpenAddressingHashMap<Hasher, AllocCallback>* hashMap, const void* oldSlots) {
+    const uint i = blockIdx.x*THREADS_PER_BLOCK + threadIdx.x;
+    if (i >= hashMap->NUMBER_TOTAL_ENTRIES()) return;
+    hashMap->reinsert(((const typename OpenAddressingHashMap<Hasher, AllocCallback>::Slot*)oldSlots)[i]);
+}
+
+template<typename Hasher, typename AllocCallback>
+KERNEL performOpenAddressingRemovalKernel(typename OpenAddressingHashMap<Hasher, AllocCallback>* hashMap) {
+    hashMap->performRemoval(blockIdx.x*THREADS_PER_BLOCK + threadIdx.x);
+}
+
+template<typename Hasher, typename AllocCallback>
+KERNEL requestOpenAddressingRemovalKernel(typename OpenAddressingHashMap<Hasher, AllocCallback>* hashMap, const typename Hasher::KeyType* keys, const uint count) {
+    const uint i = blockIdx.x*THREADS_PER_BLOCK + threadIdx.x;
+    if (i >= count) return;
+    hashMap->requestRemoval(keys[i]);
+}
+
+template<typename Hasher, typename AllocCallback>
+KERNEL collectOpenAddressingStatisticsKernel(typename OpenAddressingHashMap<Hasher, AllocCallback>* hashMap, HashMapStatistics* statistics) {
+    hashMap->collectStatistics(blockIdx.x*THREADS_PER_BLOCK + threadIdx.x, statistics);
+}
+
+template<typename Hasher, typename AllocCallback>
+KERNEL remapOpenAddressingSequenceNumbersKernel(typename OpenAddressingHashMap<Hasher, AllocCallback>* hashMap, const uint* newSequenceNumbers) {
+    const uint i = blockIdx.x*THREADS_PER_BLOCK + threadIdx.x;
+    if (i >= hashMap->NUMBER_TOTAL_ENTRIES() || !hashMap->slots[i].isAllocated()) return;
+    hashMap->slots[i].sequenceId = newSequenceNumbers[hashMap->slots[i].sequenceId];
+}
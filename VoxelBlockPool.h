@@ -0,0 +1,86 @@
+#pragma once
+#include "itmlibdefines.h"
+#include "ITMCUDAUtils.h"
+#include <vector>
+
+/**
+Device storage for the voxel blocks of a Scene, indexed by sequence number.
+
+Instead of one array for the largest possible scene, memory is mapped in chunks of CHUNK_SIZE blocks
+as reserve asks for them, up to a hard cap of maxBlocks blocks fixed at construction.
+Chunks are never moved or freed before the pool is, so sequence numbers and ITMVoxelBlock pointers stay valid
+while the pool grows. get is O(1): one lookup in the chunk table, then one in the chunk.
+*/
+class VoxelBlockPool : public Managed {
+public:
+    static const uint CHUNK_SIZE = voxelBlockPoolChunkSize;
+    static_assert((CHUNK_SIZE & (CHUNK_SIZE - 1)) == 0, "voxelBlockPoolChunkSize must be 2^n");
+
+    VoxelBlockPool(const uint maxBlocks) : maxBlocks(maxBlocks), chunkCount(0) {
+        assert(maxBlocks > 0);
+        cudaMallocManaged(&chunks, sizeof(ITMVoxelBlock*) * maxChunks());
+    }
+
+    virtual ~VoxelBlockPool() {
+        cudaDeviceSynchronize();
+        for (uint c = 0; c < chunkCount; c++) cudaFree(chunks[c]);
+        cudaFree(chunks);
+    }
+
+    GPU_ONLY DEVICEPTR(ITMVoxelBlock*) get(const uint sequenceNumber) {
+        assert(sequenceNumber < getCapacity());
+        return &chunks[sequenceNumber / CHUNK_SIZE][sequenceNumber % CHUNK_SIZE];
+    }
+
+    /// Maps chunks until sequence numbers 0 to n-1 have storage. n must not exceed maxBlocks.
+    /// The new blocks are not initialized.
+    void reserve(const uint n) {
+        assert(n <= maxBlocks);
+        const uint needed = (n + CHUNK_SIZE - 1) / CHUNK_SIZE;
+        if (needed <= chunkCount) return;
+        cudaSafeCall(cudaDeviceSynchronize()); // want to write managed chunks
+        for (; chunkCount < needed; chunkCount++)
+            cudaSafeCall(cudaMalloc(&chunks[chunkCount], sizeof(ITMVoxelBlock) * CHUNK_SIZE));
+    }
+
+    /// Number of blocks that have storage, a multiple of CHUNK_SIZE
+    CPU_AND_GPU uint getCapacity() const { return chunkCount * CHUNK_SIZE; }
+    CPU_AND_GPU uint getMaxBlocks() const { return maxBlocks; }
+
+    /// Copies the blocks with sequence numbers first to first+count-1 to out,
+    /// which is host or device memory as given by kind (cudaMemcpyDeviceToHost or cudaMemcpyDeviceToDevice)
+    void copyTo(const uint first, const uint count, ITMVoxelBlock* const out, const cudaMemcpyKind kind) {
+        forEachChunkPart(first, count, [&](ITMVoxelBlock* const blocks, const uint done, const uint n) {
+            cudaSafeCall(cudaMemcpy(out + done, blocks, sizeof(ITMVoxelBlock) * n, kind));
+        });
+    }
+
+    /// Copies count blocks from in to sequence numbers first to first+count-1,
+    /// in is host or device memory as given by kind (cudaMemcpyHostToDevice or cudaMemcpyDeviceToDevice)
+    void copyFrom(const uint first, const uint count, const ITMVoxelBlock* const in, const cudaMemcpyKind kind) {
+        forEachChunkPart(first, count, [&](ITMVoxelBlock* const blocks, const uint done, const uint n) {
+            cudaSafeCall(cudaMemcpy(blocks, in + done, sizeof(ITMVoxelBlock) * n, kind));
+        });
+    }
+
+private:
+    uint maxChunks() const { return (maxBlocks + CHUNK_SIZE - 1) / CHUNK_SIZE; }
+
+    /// Calls f(blocks, done, n) for each run of n consecutive blocks within one chunk, done blocks were handled before
+    template<typename F>
+    void forEachChunkPart(const uint first, const uint count, F f) {
+        assert(first + count <= getCapacity());
+        cudaSafeCall(cudaDeviceSynchronize()); // want to read managed chunks
+        for (uint done = 0; done < count;) {
+            const uint i = first + done;
+            const uint n = MIN(count - done, CHUNK_SIZE - i % CHUNK_SIZE);
+            f(chunks[i / CHUNK_SIZE] + i % CHUNK_SIZE, done, n);
+            done += n;
+        }
+    }
+
+    const uint maxBlocks;
+    uint chunkCount;
+    /// maxChunks() entries, the first chunkCount are mapped. Managed.
+    ITMVoxelBlock** chunks;
+};
@@ -0,0 +1,249 @@
+#pragma once
+#include "itmlibdefines.h"
+#include <stdio.h>
+#include <string>
+#include <vector>
+#include <list>
+#include <unordered_map>
+#include <stdexcept>
+#include <errno.h>
+#include <string.h>
+
+/**
+Host side storage for the voxel blocks a Scene swapped out of localVBA, see Scene::swapOutUnseenVoxelBlocks.
+
+Keeps up to hostCapacity blocks in host memory. Beyond that, the blocks that were swapped out longest ago
+are written to a file on disk, which is created on first use and deleted with the store.
+Slots of the file whose blocks were taken back are reused.
+
+File offsets are 64 bit, so the file can outgrow 2 GB (about 350k blocks). Failing to open, seek, read or write it
+throws std::runtime_error, since continuing would lose or corrupt the blocks.
+
+Blocks are stored as bytes, so this works for any ITMVoxelBlock layout. In host memory they are run length encoded
+word by word (see compress): swapped out blocks are cold, and mostly runs of equal voxels
+(the initial value, or saturated at +-1 with full weight).
+*/
+class VoxelBlockStore {
+public:
+    VoxelBlockStore(const size_t hostCapacity, const std::string fileName) :
+        hostCapacity(hostCapacity), fileName(fileName), hostBytes(0), file(NULL), fileEnd(0) {}
+
+    ~VoxelBlockStore() {
+        if (!file) return;
+        fclose(file);
+        remove(fileName.c_str());
+    }
+
+    /// Stores block under block.pos_, which must not be stored yet
+    void put(const ITMVoxelBlock& block) {
+        const VoxelBlockPos pos = block.pos_;
+        assert(!contains(pos));
+        const unsigned char* const bytes = reinterpret_cast<const unsigned char*>(&block);
+
+        hostOrder.push_back(pos);
+        HostBlock& h = host[pos];
+        compress(bytes, h.bytes);
+        hostBytes += h.bytes.size();
+        h.order = --hostOrder.end();
+
+        while (host.size() > hostCapacity) spillOldest();
+    }
+
+    /// Removes the block at pos from the store and copies it to out.
+    /// \returns false if no block is stored at pos
+    bool take(const VoxelBlockPos pos, ITMVoxelBlock& out) {
+        unsigned char* const bytes = reinterpret_cast<unsigned char*>(&out);
+
+        auto h = host.find(pos);
+        if (h != host.end()) {
+            decompress(h->second.bytes, bytes);
+            hostBytes -= h->second.bytes.size();
+            hostOrder.erase(h->second.order);
+            host.erase(h);
+            return true;
+        }
+
+        auto d = disk.find(pos);
+        if (d == disk.end()) return false;
+        seek(d->second);
+        if (fread(bytes, sizeof(ITMVoxelBlock), 1, file) != 1) fail("cannot read from");
+        freeOffsets.push_back(d->second);
+        disk.erase(d);
+        return true;
+    }
+
+    /// Drops the blocks whose position p satisfies drop(p)
+    /// \returns the number of blocks dropped
+    template<typename F>
+    size_t removeIf(F drop) {
+        size_t removed = 0;
+        for (auto h = host.begin(); h != host.end();) {
+            if (!drop(h->first)) { ++h; continue; }
+            hostBytes -= h->second.bytes.size();
+            hostOrder.erase(h->second.order);
+            h = host.erase(h);
+            removed++;
+        }
+        for (auto d = disk.begin(); d != disk.end();) {
+            if (!drop(d->first)) { ++d; continue; }
+            freeOffsets.push_back(d->second);
+            d = disk.erase(d);
+            removed++;
+        }
+        return removed;
+    }
+
+    /// Calls f(block) for a copy of each stored block, leaving the store as it is
+    template<typename F>
+    void forEach(F f) {
+        std::vector<unsigned char> bytes(sizeof(ITMVoxelBlock));
+        const ITMVoxelBlock& block = *reinterpret_cast<const ITMVoxelBlock*>(bytes.data());
+        for (auto& h : host) {
+            decompress(h.second.bytes, bytes.data());
+            f(block);
+        }
+        for (auto& d : disk) {
+            seek(d.second);
+            if (fread(bytes.data(), sizeof(ITMVoxelBlock), 1, file) != 1) fail("cannot read from");
+            f(block);
+        }
+    }
+
+    /// Drops all blocks. The file is kept, its slots are reused.
+    void clear() {
+        removeIf([](const VoxelBlockPos&) { return true; });
+    }
+
+    bool contains(const VoxelBlockPos pos) const {
+        return host.count(pos) || disk.count(pos);
+    }
+
+    /// Number of blocks stored
+    size_t size() const { return host.size() + disk.size(); }
+    /// Number of blocks stored in the file
+    size_t sizeOnDisk() const { return disk.size(); }
+    /// Number of blocks stored in host memory
+    size_t sizeInHost() const { return host.size(); }
+    /// Bytes the blocks in host memory take (compressed), without bookkeeping
+    size_t getHostBytes() const { return hostBytes; }
+
+private:
+    struct PosHash {
+        size_t operator()(const VoxelBlockPos& p) const {
+            return ((uint)p.x * 73856093u) ^ ((uint)p.y * 19349669u) ^ ((uint)p.z * 83492791u);
+        }
+    };
+
+    struct HostBlock {
+        std::vector<unsigned char> bytes;
+        std::list<VoxelBlockPos>::iterator order;
+    };
+
+    enum Encoding : unsigned char { RAW, RUN_LENGTH };
+
+    /// out = RUN_LENGTH, then (run length, word) pairs of uints for the whole words of block, then its remaining bytes.
+    /// out = RAW, then the bytes of block, if that is not longer.
+    static void compress(const unsigned char* const block, std::vector<unsigned char>& out) {
+        const size_t words = sizeof(ITMVoxelBlock) / sizeof(uint);
+        out.assign(1, RUN_LENGTH);
+        for (size_t i = 0; i < words;) {
+            uint word, next;
+            memcpy(&word, block + i * sizeof(uint), sizeof(uint));
+            uint run = 1;
+            for (; i + run < words; run++) {
+                memcpy(&next, block + (i + run) * sizeof(uint), sizeof(uint));
+                if (next != word) break;
+            }
+            append(out, run);
+            append(out, word);
+            i += run;
+
+            if (out.size() >= sizeof(ITMVoxelBlock)) {
+                out.assign(1, RAW);
+                out.insert(out.end(), block, block + sizeof(ITMVoxelBlock));
+                return;
+            }
+        }
+        out.insert(out.end(), block + words * sizeof(uint), block + sizeof(ITMVoxelBlock));
+    }
+
+    static void decompress(const std::vector<unsigned char>& in, unsigned char* const block) {
+        if (in[0] == RAW) {
+            assert(in.size() == 1 + sizeof(ITMVoxelBlock));
+            memcpy(block, in.data() + 1, sizeof(ITMVoxelBlock));
+            return;
+        }
+        const size_t words = sizeof(ITMVoxelBlock) / sizeof(uint);
+        size_t p = 1;
+        for (size_t i = 0; i < words;) {
+            uint run, word;
+            memcpy(&run, &in[p], sizeof(uint));
+            memcpy(&word, &in[p + sizeof(uint)], sizeof(uint));
+            p += 2 * sizeof(uint);
+            assert(run >= 1 && i + run <= words);
+            for (; run > 0; run--, i++) memcpy(block + i * sizeof(uint), &word, sizeof(uint));
+        }
+        assert(in.size() - p == sizeof(ITMVoxelBlock) - words * sizeof(uint));
+        memcpy(block + words * sizeof(uint), in.data() + p, sizeof(ITMVoxelBlock) - words * sizeof(uint));
+    }
+
+    static void append(std::vector<unsigned char>& out, const uint x) {
+        const unsigned char* const bytes = reinterpret_cast<const unsigned char*>(&x);
+        out.insert(out.end(), bytes, bytes + sizeof(uint));
+    }
+
+    void fail(const char* const what) const {
+        throw std::runtime_error(std::string("VoxelBlockStore: ") + what + " " + fileName + ": " + strerror(errno));
+    }
+
+    void seek(const long long offset) {
+#ifdef _MSC_VER
+        const int result = _fseeki64(file, offset, SEEK_SET);
+#else
+        const int result = fseeko(file, offset, SEEK_SET);
+#endif
+        if (result != 0) fail("cannot seek in");
+    }
+
+    /// Moves the block that is in host memory longest to the file, uncompressed
+    void spillOldest() {
+        if (!file) {
+            file = fopen(fileName.c_str(), "w+b");
+            if (!file) fail("cannot create");
+        }
+        const VoxelBlockPos pos = hostOrder.front();
+        auto h = host.find(pos);
+        assert(h != host.end());
+
+        long long offset;
+        if (freeOffsets.empty()) {
+            offset = fileEnd;
+            fileEnd += sizeof(ITMVoxelBlock);
+        }
+        else {
+            offset = freeOffsets.back();
+            freeOffsets.pop_back();
+        }
+        std::vector<unsigned char> block(sizeof(ITMVoxelBlock));
+        decompress(h->second.bytes, block.data());
+        seek(offset);
+        if (fwrite(block.data(), sizeof(ITMVoxelBlock), 1, file) != 1) fail("cannot write to"); // the block stays in host
+        disk[pos] = offset;
+        hostOrder.pop_front();
+        hostBytes -= h->second.bytes.size();
+        host.erase(h);
+    }
+
+    const size_t hostCapacity;
+    const std::string fileName;
+
+    /// Positions of the blocks in host, in the order they were put
+    std::list<VoxelBlockPos> hostOrder;
+    std::unordered_map<VoxelBlockPos, HostBlock, PosHash> host;
+    size_t hostBytes;
+
+    FILE* file;
+    long long fileEnd;
+    std::unordered_map<VoxelBlockPos, long long, PosHash> disk;
+    std::vector<long long> freeOffsets;
+};
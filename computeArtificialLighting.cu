@@ -1,12 +1,18 @@
 #include "computeArtificialLighting.h"
 #include "Scene.h"
 #include "itmrepresentationaccess.h"
-static __managed__ Vector3f lightNormal;
+
+#if VOXEL_HAS_COLOR // the result is stored as colour
 struct ComputeLighting {
-    doForEachAllocatedVoxel_process() {
+    Scene* scene;
+    Vector3f lightNormal;
+
+    doForEachAllocatedVoxel_process_member() {
         // skip voxels without computable normal
         bool found = true;
-        const Vector3f normal = computeSingleNormalFromSDFByForwardDifference(globalPos, found);
+        VoxelBlockCache cache(scene);
+        cache.insert(const_cast<ITMVoxelBlock*>(vb));
+        const Vector3f normal = computeSingleNormalFromSDFByForwardDifference(globalPos, found, cache);
         if (!found) return;
 
         float cos = max(0.f, dot(normal, lightNormal));
@@ -16,20 +22,21 @@ struct ComputeLighting {
     }
 };
 
-void computeArtificialLighting(Vector3f lightNormal) {
+void computeArtificialLighting(Scene* const scene, Vector3f lightNormal) {
     cudaDeviceSynchronize();
     assert(abs(length(lightNormal) - 1) < 0.1);
-    assert(Scene::getCurrentScene());
+    assert(scene);
 
-    ::lightNormal = lightNormal;
-    Scene::getCurrentScene()->doForEachAllocatedVoxel<ComputeLighting>();
+    const ComputeLighting lighting = {scene, lightNormal};
+    scene->doForEachAllocatedVoxel(lighting);
 
     cudaDeviceSynchronize();
 }
 
 
-void computeArtificialLighting_() {
-    computeArtificialLighting(Vector3f(0, 1, 0));
+void computeArtificialLighting_(Scene* const scene) {
+    computeArtificialLighting(scene, Vector3f(0, 1, 0));
 }
 
-int* v = (int*)computeArtificialLighting_;
\ No newline at end of file
+int* v = (int*)computeArtificialLighting_;
+#endif
@@ -1,6 +1,7 @@
 #include "itmlibdefines.h"
+class Scene;
 /**
-computes max(voxelNormal . lightNormal, 0) at each voxel in the current scene
+computes max(voxelNormal . lightNormal, 0) at each voxel in scene
 where the normal can be computed and stores it as its color
 */
-void computeArtificialLighting(Vector3f lightNormal);
\ No newline at end of file
+void computeArtificialLighting(Scene* scene, Vector3f lightNormal);
\ No newline at end of file
@@ -6,19 +6,13 @@
 
 #include <iostream>
 using namespace std;
-/// Exchange information
-__managed__ long long transform_reduce_resultMemory[100 * 100]; // use only in one module
-
-template <typename T>
-CPU_AND_GPU T& transform_reduce_result() {
-    assert(sizeof(T) <= sizeof(transform_reduce_resultMemory));
-    return *(T*)transform_reduce_resultMemory;
-}
 
 /// Constructor must define
 /// Constructor::ExtraData(), add, atomicAdd
 /// static const uint Constructor::m
-/// bool Constructor::generate(const uint i, VectorX<float, m>& , float& bi)
+/// bool Constructor::generate(const uint i, VectorX<float, m>& , float& bi) const
+/// The Constructor passed to construct is copied to the device, so it must be plain old data
+/// (pointers to managed or device memory are fine).
 template<typename Constructor>
 struct AtA_Atb_Add {
     static const uint m = Constructor::m;
@@ -34,10 +28,12 @@ struct AtA_Atb_Add {
         CPU_AND_GPU ElementType(AtA _AtA, Atb _Atb, ExtraData _extraData) : _AtA(_AtA), _Atb(_Atb), _extraData(_extraData) {}
     };
 
-    static GPU_ONLY bool generate(const uint i, ElementType& out) {
+    Constructor constructor;
+
+    GPU_ONLY bool generate(const uint i, ElementType& out) const {
         // Some threads contribute zero
         VectorX<float, m> ai; float bi;
-        if (!Constructor::generate(i, ai, bi, out._extraData)) return false;
+        if (!constructor.generate(i, ai, bi, out._extraData)) return false;
 
         // Construct ai_aiT, ai_bi
         out._AtA = MatrixSQX<float, m>::make_aaT(ai);
@@ -103,7 +99,7 @@ GPU_ONLY uint linear_global_threadId() {
 const int MAX_REDUCE_BLOCK_SIZE = 4*4*4; // TODO this actually depends on shared memory demand of Constructor (::m, ExtraData etc.) -- template-specialize on it?
 
 template<class Constructor>
-KERNEL transform_reduce_if_device(const uint n) {
+KERNEL transform_reduce_if_device(const uint n, const Constructor constructor, typename Constructor::ElementType* const result) {
     const uint tid = linear_threadIdx();
     assert(tid < MAX_REDUCE_BLOCK_SIZE, "tid %d", tid);
     const uint i = linear_global_threadId();
@@ -118,7 +114,7 @@ KERNEL transform_reduce_if_device(const uint n) {
     __shared__ typename Constructor::ElementType reduced_elements[MAX_REDUCE_BLOCK_SIZE]; // this is pretty heavy on shared memory!
 
     typename Constructor::ElementType& ei = reduced_elements[tid];
-    if (i >= n || !Constructor::generate(i, ei)) {
+    if (i >= n || !constructor.generate(i, ei)) {
         ei = Constructor::neutralElement();
     }
     else
@@ -141,8 +137,7 @@ KERNEL transform_reduce_if_device(const uint n) {
     assert(tid == 0);
 
     // Sum globally, using atomics
-    auto& result = transform_reduce_result<Constructor::ElementType>();
-    Constructor::atomicOperate(result, reduced_elements[0]);
+    Constructor::atomicOperate(*result, reduced_elements[0]);
 }
 
 CPU_AND_GPU bool isPowerOf2(unsigned int x) {
@@ -156,11 +151,11 @@ CPU_AND_GPU bool isPowerOf2(unsigned int x) {
 /**
 Constructor must provide:
 * Constructor::ElementType
-* Constructor::generate(i) which will be called with i from 0 to n and may return false causing its result to be replaced with
+* constructor.generate(i) which will be called with i from 0 to n and may return false causing its result to be replaced with
 * CPU_AND_GPU Constructor::neutralElement()
 * Constructor::operate and atomicOperate define the binary operation
 
-Constructor::generate is run once in each CUDA thread.
+constructor.generate is run once in each CUDA thread, constructor is copied to the device.
 The division into threads *can* be manually specified -- doing so will not significantly affect the outcome if the Constructor is agnostic to threadIdx et.al.
 If gridDim and/or blockDim are nonzero, it will be checked for conformance with n (must be bigger than or equal).
 gridDim can be left 0,0,0 in which case it is computed as ceil(n/volume(blockDim)),1,1.
@@ -171,7 +166,7 @@ Both gridDim and blockDim default to one-dimension.
 */
 template<class Constructor>
 Constructor::ElementType
-transform_reduce_if(const uint n, dim3 gridDim = dim3(0, 0, 0), dim3 blockDim = dim3(0, 0, 0)) {
+transform_reduce_if(const Constructor& constructor, const uint n, dim3 gridDim = dim3(0, 0, 0), dim3 blockDim = dim3(0, 0, 0)) {
     // Configure kernel scheduling
     if (gridDim.x == 0) {
         assert(gridDim.y == gridDim.z && gridDim.z == 0);
@@ -189,16 +184,21 @@ transform_reduce_if(const uint n, dim3 gridDim = dim3(0, 0, 0), dim3 blockDim =
     assert(volume(blockDim) > 0);
     assert(volume(blockDim) <= MAX_REDUCE_BLOCK_SIZE);
 
-    // Set up storage for result
-    transform_reduce_result<typename Constructor::ElementType>() = Constructor::neutralElement();
+    // Set up storage for result, per call such that concurrent calls don't interfere
+    typename Constructor::ElementType* result;
+    cudaSafeCall(cudaMallocManaged(&result, sizeof(typename Constructor::ElementType)));
+    cudaSafeCall(cudaDeviceSynchronize());
+    *result = Constructor::neutralElement();
 
     LAUNCH_KERNEL(
         (transform_reduce_if_device<Constructor>),
         gridDim, blockDim,
-        n);
+        n, constructor, result);
     cudaDeviceSynchronize();
 
-    return transform_reduce_result<Constructor::ElementType>();
+    const typename Constructor::ElementType r = *result;
+    cudaFree(result);
+    return r;
 }
 
 /**
@@ -208,15 +208,16 @@ Row i (0-based) of A and b[i] are generated by bool Constructor::generate(uint i
 It is thrown away if generate returns false.
 */
 template<class Constructor>
-AtA_Atb_Add<Constructor>::ElementType construct(const uint n, dim3 gridDim = dim3(0, 0, 0), dim3 blockDim = dim3(0, 0, 0)) {
+AtA_Atb_Add<Constructor>::ElementType construct(const Constructor& constructor, const uint n, dim3 gridDim = dim3(0, 0, 0), dim3 blockDim = dim3(0, 0, 0)) {
     assert(Constructor::m < 100);
-    return transform_reduce_if<AtA_Atb_Add<Constructor>>(n, gridDim, blockDim);
+    const AtA_Atb_Add<Constructor> add = {constructor};
+    return transform_reduce_if(add, n, gridDim, blockDim);
 }
 
 /// \see construct
 template<class Constructor>
-AtA_Atb_Add<Constructor>::Atb constructAndSolve(int n, dim3 gridDim, dim3 blockDim, Constructor::ExtraData& out_extra_sum) {
-    auto result = construct<Constructor>(n, gridDim, blockDim);
+AtA_Atb_Add<Constructor>::Atb constructAndSolve(const Constructor& constructor, int n, dim3 gridDim, dim3 blockDim, Constructor::ExtraData& out_extra_sum) {
+    auto result = construct(constructor, n, gridDim, blockDim);
     out_extra_sum = result._extraData;
     cout << result._AtA << endl;
     cout << result._Atb << endl;
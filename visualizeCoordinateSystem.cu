@@ -44,15 +44,15 @@ BeginGLRender::BeginGLRender(
 
 
          i = pixelLocId(x, H - 1-y, depthImage->noDims);// must invert y axis for destination
-        if (depthImageEyeZ < viewFrustum_min) {
+        if (depthImageEyeZ < defaultViewFrustum_min) {
             gl_depthbuffer_float_image->GetData()[i] = 1; // raycast hit nothing -> z-buffer value = max = 1
             continue;
         }
-        assert(depthImageEyeZ <= viewFrustum_max);
+        assert(depthImageEyeZ <= defaultViewFrustum_max);
 
         const float z = // projectionMatrix.nb
-            viewFrustum_max*(depthImageEyeZ - viewFrustum_min) /
-            (depthImageEyeZ*(viewFrustum_max - viewFrustum_min));
+            defaultViewFrustum_max*(depthImageEyeZ - defaultViewFrustum_min) /
+            (depthImageEyeZ*(defaultViewFrustum_max - defaultViewFrustum_min));
 
         gl_depthbuffer_float_image->GetData()[i] = z;
         assert(z >= 0 && z <= 1);
@@ -121,8 +121,8 @@ BeginGLRender::BeginGLRender(
     float cy = depthCameraIntrinsics.projectionParamsSimple.py;
     float width = W;
     float height = H;
-    float zmin = viewFrustum_min;
-    float zmax = viewFrustum_max;
+    float zmin = defaultViewFrustum_min;
+    float zmax = defaultViewFrustum_max;
 
     float columnMajorProjectionMatrix[16] = {
         // col1